@@ -1,8 +1,15 @@
 /*
  * inventory.c – Retail Store Inventory Management System
  * Standard : C11
- * Compile  : gcc -std=c11 -Wall -Wextra -o inventory inventory.c
- * Run      : ./inventory
+ * Compile  : cmake -S . -B build && cmake --build build (see CMakeLists.txt
+ *            for the Release, LTO, PGO and sanitizer builds), or
+ *            gcc -std=c11 -Wall -Wextra -pthread -o inventory inventory.c main.c
+ *            (Windows: add -lws2_32; -DINVENTORY_STATS=0 drops the
+ *            statistics counters; -DMONEY_DIGITS=N keeps N price
+ *            decimals instead of 2)
+ * Library  : everything here is static but the inventory.h API (see
+ *            "Library API"); main.c, the program, is built on it.
+ * Run      : see main.c for the command line.
  *
  * _POSIX_C_SOURCE 200809L is defined first to expose strcasecmp()
  * from <strings.h> (a POSIX function, not in strict C11).
@@ -11,34 +18,268 @@
  *   name,quantity,price
  *   Apple,100,0.99
  *   # Lines starting with '#' are comments and are ignored.
+ *
+ * Saving also writes inventory.snap, a binary image of the store that
+ * is mapped on the next start instead of parsing the CSV (see
+ * "Binary snapshot"). Edits made to inventory.txt are picked up: the
+ * CSV is imported whenever it changed after the snapshot was written.
+ * Between saves every change is appended to inventory.wal and replayed
+ * on the next start, so quitting without saving (or crashing) keeps it.
  */
 #define _POSIX_C_SOURCE 200809L
 
+#ifdef _WIN32
+#include <winsock2.h>  /* --serve (link with ws2_32) */
+#include <ws2tcpip.h>
 #include <windows.h>
+#include <io.h>        /* _isatty     */
+#include <direct.h>    /* _mkdir, _chdir, _rmdir (--bench) */
+#else
+#include <fcntl.h>     /* open        */
+#include <sys/mman.h>  /* mmap        */
+#include <unistd.h>    /* read, close, isatty */
+#include <pthread.h>
+#include <signal.h>    /* sigwait     */
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h> /* TCP_NODELAY */
+#include <netdb.h>     /* getaddrinfo */
+#include <poll.h>      /* poll (--serve) */
+#endif
+#include <sys/stat.h>  /* stat, fstat */
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>   /* strcasecmp (POSIX) */
 #include <ctype.h>
 #include <errno.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "inventory.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h> /* AVX2 valuation kernel, selected at run time */
+#define HAVE_AVX2_KERNEL 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>  /* NEON valuation kernel */
+#define HAVE_NEON_KERNEL 1
+#endif
+
+/* Operation counters and latency histograms ("stats"); 0 compiles them out. */
+#ifndef INVENTORY_STATS
+#define INVENTORY_STATS 1
+#endif
+
+#if defined(__GNUC__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p) ((void)(p))
+#endif
 
 /* ─── Constants ─────────────────────────────────────────────── */
-#define MAX_ITEMS       500
-#define MAX_NAME_LEN    64
+#define ITEM_CHUNK_SHIFT 12     /* 4096 items per storage chunk  */
+#define ITEM_CHUNK      (1 << ITEM_CHUNK_SHIFT)
+#define ITEM_CHUNK_MASK (ITEM_CHUNK - 1)
+#define NAME_BLOCK_SHIFT 20     /* 1 MiB name-pool blocks        */
+#define NAME_BLOCK      ((size_t)1 << NAME_BLOCK_SHIFT)
+#define NAME_MAX_BLOCKS (1u << (32 - NAME_BLOCK_SHIFT))
+#define NAME_NONE       UINT32_MAX
 #define INVENTORY_FILE  "inventory.txt"
+#define SNAPSHOT_FILE   "inventory.snap"
+#define SNAPSHOT_TMP    "inventory.snap.tmp"
+#define SNAPSHOT_BAD    "inventory.snap.bad" /* a damaged one, set aside */
+#define INVENTORY_TMP   "inventory.txt.tmp"
+#define SAVE_BUF        (1 << 20) /* user-space buffer for saves        */
+#define WAL_FILE        "inventory.wal"
+#define WAL_TMP         "inventory.wal.tmp"
+#define WAL_GROUP_MS    50        /* fsync batching window (group mode)  */
+#define WAL_CHECKPOINT_BYTES ((uint64_t)64 << 20) /* log size that triggers a checkpoint */
 #define LINE_BUF        256
+#define INDEX_MIN_CAP   64      /* initial slots per index shard (power of two) */
+#define INDEX_SHARD_BITS 6      /* 64 index shards                          */
+#define INDEX_SHARDS    (1 << INDEX_SHARD_BITS)
+#define LOAD_BATCH      32      /* CSV records scanned per prefetch batch  */
+#define BATCH_OPS       256     /* --batch commands per lookup/log batch    */
+#define IMPORT_ROWS     16384   /* delta-file rows per sorted merge run     */
+#define LIST_PAGE       40      /* rows per page when listing to a terminal */
+#define ABC_A           80      /* class A: items making up this % of value */
+#define ABC_AB          95      /* ... and B, together with A               */
+#define ABC_TOP         10      /* items the menu's ABC report lists        */
+#define SEARCH_TOP      20      /* matches menu_search() shows              */
+#define SEARCH_DELTA    1024    /* search additions buffered before a merge */
+#define TRI_BITS        16      /* trigram buckets: 1 << TRI_BITS           */
+#define SERVE_THREADS   64      /* default --serve-threads                  */
+#define SERVE_MAX_THREADS INVENTORY_MAX_SERVE_THREADS
+#define SERVE_LINE_MAX  (64 << 10) /* longest request line a client may send */
+#define REPL_HELLO      "INVREPL1\n" /* a follower's greeting to --replicate  */
+#define REPL_BACKLOG    ((size_t)64 << 20) /* feed kept for a lagging follower */
+#define REPL_FOLLOWERS  16      /* followers one primary feeds at once      */
+#define REPL_SNAP_FILE  "inventory.repl.snap" /* catch-up snapshot being sent */
+#define REPL_SNAP_TMP   "inventory.repl.snap.tmp"
+#define REPL_RETRY_MS   1000    /* a follower's wait between reconnects     */
+#define MAX_LOAD_THREADS INVENTORY_MAX_THREADS
+#define LOAD_PAR_MIN    (1 << 20) /* files smaller than this load serially */
+#define FILE_AHEAD_PAGE 4096    /* read-ahead touches one byte per page      */
+#define STAT_STRIPES    64      /* counter stripes, one per thread ideally  */
+#define STAT_BUCKETS    160     /* latency buckets: 4 per power of two of ns */
+#define STAT_PROBES     16      /* probe-length buckets: 1..15, 16 or more  */
+#define STATS_INTERVAL  10      /* default --stats-interval, in seconds     */
+#define BENCH_ROWS      1000000 /* default --bench catalog size             */
+#define BENCH_MAX_ROWS  INVENTORY_BENCH_MAX_ROWS
+#define BENCH_REPS      3       /* runs of each whole-store benchmark       */
+#define BENCH_OPS       100000  /* timed calls of each per-item benchmark   */
+#define BENCH_DIR       "inventory-bench"
+#define FUZZ_OPS        4000000 /* default --fuzz operation count           */
+#define FUZZ_KEYS       65536   /* names the fuzz workload draws from       */
+#define FUZZ_BATCH      65536   /* operations between full comparisons      */
+#define FUZZ_THREADS    8       /* workers of the concurrent fuzz phase     */
+#define FUZZ_HOT        64      /* keys they share, so that updates collide */
+#define FUZZ_DIR        "inventory-fuzz"
+
+/* ─── Money ──────────────────────────────────────────────────── */
+/*
+ * Prices and values are fixed-point: a Money counts 1/MONEY_SCALE of a
+ * currency unit (cents unless built with -DMONEY_DIGITS=N, N in 1..6).
+ * Sums of them are exact integer arithmetic, identical however a scan
+ * is split or ordered, and text converts to and from them directly
+ * (money_scan(), money_put()) without passing through a double.
+ * Snapshots and logs record the scale and are only read back by a
+ * build with the same one.
+ */
+#ifndef MONEY_DIGITS
+#define MONEY_DIGITS 2
+#endif
+#if MONEY_DIGITS < 1 || MONEY_DIGITS > 6
+#error "MONEY_DIGITS must be from 1 to 6"
+#endif
+typedef int64_t Money;
+#define MONEY_SCALE ((Money)(MONEY_DIGITS == 1 ? 10 : MONEY_DIGITS == 2 ? 100 :       \
+                             MONEY_DIGITS == 3 ? 1000 : MONEY_DIGITS == 4 ? 10000 : \
+                             MONEY_DIGITS == 5 ? 100000 : 1000000))
+#define MONEY_MAX  (1000000000 * MONEY_SCALE) /* highest accepted price: 1e9 */
+#define MONEY_BUF  24                         /* money_str() buffer size      */
 
 /* ─── Data structure ─────────────────────────────────────────── */
+/*
+ * Items are stored column-wise, ITEM_CHUNK at a time: each chunk holds
+ * one contiguous array per field, so scans such as recompute_total()
+ * touch only the columns they need. Names are not stored inline: `name`
+ * is a handle into the name pool (see name_str()).
+ */
+typedef struct {
+    Money    price[ITEM_CHUNK];    /* unit price             */
+    int32_t  qty[ITEM_CHUNK];      /* units in stock         */
+    uint32_t name[ITEM_CHUNK];     /* name-pool handle       */
+    uint32_t name_len[ITEM_CHUNK]; /* name length in bytes   */
+    uint32_t hash[ITEM_CHUNK];     /* case-folded name hash  */
+    uint32_t seq[ITEM_CHUNK];      /* insertion order        */
+} ItemChunk;
+
+/* Field accessors for item i (0 <= i < g_count); all are lvalues. */
+#define ITEM_COL(col, i) (g_chunks[(i) >> ITEM_CHUNK_SHIFT]->col[(i) & ITEM_CHUNK_MASK])
+#define ITEM_PRICE(i)    ITEM_COL(price, i)
+#define ITEM_QTY(i)      ITEM_COL(qty, i)
+#define ITEM_NAME(i)     ITEM_COL(name, i)
+#define ITEM_LEN(i)      ITEM_COL(name_len, i)
+#define ITEM_HASH(i)     ITEM_COL(hash, i)
+#define ITEM_SEQ(i)      ITEM_COL(seq, i)
+
+/* One open-addressing slot: idx < 0 marks an empty slot. */
 typedef struct {
-    char   name[MAX_NAME_LEN]; /* product name              */
-    int    quantity;           /* units in stock            */
-    double price;              /* unit price (currency)     */
-} Item;
+    uint32_t hash;  /* cached name hash of item idx */
+    int      idx;   /* position in the store, or -1 */
+} IndexSlot;
 
 /* ─── Global store ───────────────────────────────────────────── */
-static Item g_items[MAX_ITEMS]; /* in-memory item array */
-static int  g_count = 0;        /* current number of items */
+/*
+ * Chunks are reached through a growable directory, so capacity grows
+ * one chunk at a time and a chunk never moves in memory once allocated.
+ * g_mem_limit caps the bytes the store and its index may hold
+ * (0 = unlimited).
+ */
+static ItemChunk **g_chunks = NULL; /* chunk directory                 */
+static uint64_t *g_chunk_epoch;     /* per slot: see "Store versions"  */
+static size_t  g_chunk_cnt  = 0;    /* chunks allocated                */
+static size_t  g_chunk_dir  = 0;    /* directory slots                 */
+static int     g_count      = 0;    /* current number of items         */
+static uint32_t g_seq_next  = 0;    /* ITEM_SEQ for the next new item  */
+static _Atomic size_t g_mem_used = 0; /* bytes held by store, index, names */
+static size_t  g_mem_limit  = 0;    /* configurable cap, 0 = unlimited */
+
+/* Maintained by every mutation so calculate_total() is O(1). */
+static _Atomic Money   g_total_cents = 0; /* Σ quantity × price          */
+static _Atomic int64_t g_total_units = 0; /* Σ quantity                   */
+static bool    g_check_totals = false; /* --check-totals debug mode     */
+static int     g_load_threads = 1;     /* --load-threads, 0 = all CPUs  */
+static bool    g_snapshot_only = false; /* --snapshot-only: no CSV on save */
+static bool    g_lazy_load = false;    /* --lazy-load: page the snapshot in on use */
+static bool    g_snap_compress = false; /* --snapshot-compress: encode saved snapshots */
+
+/* --order: how list_inventory() and export_csv() walk the store by default. */
+typedef enum { ORDER_INSERTION, ORDER_NAME, ORDER_STORE } ViewOrder;
+static ViewOrder g_order = ORDER_INSERTION;
+
+/* --durability: how far a logged change gets before it is reported. */
+typedef enum {
+    DUR_OFF,   /* no write-ahead log; changes persist only on save */
+    DUR_WRITE, /* written to the OS: survives a program crash      */
+    DUR_GROUP, /* plus an fsync within WAL_GROUP_MS                */
+    DUR_SYNC   /* fsync'd before the change is reported            */
+} Durability;
+static Durability g_durability = DUR_GROUP;
+
+/* --serve: worker threads share the store (see "Server mode"). */
+static bool g_serving = false;
+static bool g_shape_shared;       /* a change runs under shard locks (serve_shape()) */
+static atomic_bool g_compact_due; /* it put off name_pool_compact() */
+
+/*
+ * Address range of the mapped snapshot, if one was loaded. Chunks, index
+ * tables and name blocks inside it are borrowed, not heap-allocated, so
+ * mem_free() leaves them alone.
+ */
+static uintptr_t g_snap_lo = 0, g_snap_hi = 0;
+static _Atomic size_t g_snap_charge; /* of it, counted in g_mem_used (--mem-limit) */
+
+/*
+ * The name index is split into INDEX_SHARDS independent tables chosen
+ * by the top bits of the hash, so a shard can be rebuilt or grown
+ * without touching the others (and by separate threads during a
+ * parallel load).
+ */
+typedef struct {
+    IndexSlot *tab;  /* name → position, linear probing */
+    size_t     cap;  /* slot count (power of two)       */
+    size_t     used; /* filled slots                    */
+} IndexShard;
+
+static IndexShard g_shards[INDEX_SHARDS];
+
+/*
+ * Name pool: a bump allocator over NAME_BLOCK-sized blocks. A handle is
+ * (block << NAME_BLOCK_SHIFT) | offset; names are NUL-terminated so they
+ * can be printed directly. A name longer than a block gets a block of
+ * its own. Space freed by remove_item() is reclaimed by name_pool_compact().
+ */
+typedef struct {
+    uint32_t block; /* block being filled                 */
+    size_t   top;   /* bump offset within it              */
+    size_t   end;   /* its size; 0 = no block yet         */
+} NameCursor;
+
+static char      *g_name_blocks[NAME_MAX_BLOCKS]; /* block addresses      */
+static size_t     g_name_block_sz[NAME_MAX_BLOCKS];
+static uint32_t   g_name_nblocks = 0;  /* blocks in use                   */
+static NameCursor g_name_cur     = { 0, 0, 0 }; /* main bump cursor       */
+static size_t     g_name_dead    = 0;  /* bytes owned by removed items    */
+static size_t     g_name_live    = 0;  /* bytes owned by current items    */
+static atomic_flag g_name_lock   = ATOMIC_FLAG_INIT; /* guards the block directory */
 
 /* ══════════════════════════════════════════════════════════════
  *  Utility helpers
@@ -55,244 +296,7676 @@ static void trim(char *s) {
         s[--len] = '\0';
 }
 
-/* Case-insensitive linear search. Returns index, or -1 if absent. */
-static int find_item(const char *name) {
-    for (int i = 0; i < g_count; i++)
-        if (strcasecmp(g_items[i].name, name) == 0)
-            return i;
-    return -1;
+/* Decimal digits of v, written backwards ending at `end`; returns the start. */
+static inline char *fmt_u64(char *end, uint64_t v) {
+    do { *--end = (char)('0' + v % 10); v /= 10; } while (v);
+    return end;
+}
+
+/*
+ * money_scan_dec
+ *   Decimal text [b, e) as Money: an optional sign, digits with an
+ *   optional point, an optional exponent ("1.5e3"). Rounded half away
+ *   from zero to MONEY_DIGITS places, exactly. False for anything else
+ *   or for magnitudes of 1e18 units of MONEY_SCALE or more.
+ */
+static bool money_scan_dec(const char *b, const char *e, Money *out) {
+    char dig[32];           /* significant digits; value = 0.dig × 10^point */
+    int  nd = 0, point = 0;
+    bool neg = false, any = false, dot = false;
+    const char *p = b;
+    if (p < e && (*p == '+' || *p == '-')) neg = *p++ == '-';
+    for (; p < e; p++) {
+        if (*p == '.' && !dot) { dot = true; continue; }
+        if (*p < '0' || *p > '9') break;
+        any = true;
+        if (nd == 0 && *p == '0') { point -= dot; continue; }
+        if (nd < (int)sizeof dig) dig[nd++] = *p; /* later ones cannot round */
+        point += !dot;
+    }
+    if (!any) return false;
+    if (p < e && (*p == 'e' || *p == 'E')) {
+        bool eneg = false;
+        int  x = 0;
+        if (++p < e && (*p == '+' || *p == '-')) eneg = *p++ == '-';
+        if (p == e) return false;
+        for (; p < e && *p >= '0' && *p <= '9'; p++)
+            if ((x = x * 10 + (*p - '0')) > 400) return false;
+        point += eneg ? -x : x;
+    }
+    if (p != e) return false;
+
+    int   k = nd ? point + MONEY_DIGITS : 0; /* digits left of the scaled point */
+    Money v = 0;
+    if (k > 18) return false;
+    for (int i = 0; i < k; i++) v = v * 10 + (i < nd ? dig[i] - '0' : 0);
+    if (k >= 0 && k < nd && dig[k] >= '5') v++;
+    *out = neg ? -v : v;
+    return true;
+}
+
+/*
+ * money_scan
+ *   Text [b, e) as Money. Decimals take money_scan_dec(); any other form
+ *   strtod() reads in full (a hex float such as "0x10", for 16.00) is
+ *   converted through a double and rounded the same way. False if the
+ *   text is neither, or for NaN and magnitudes of 1e18 units or more.
+ */
+static bool money_scan(const char *b, const char *e, Money *out) {
+    if (money_scan_dec(b, e, out)) return true;
+    char   tmp[64], *ep;
+    size_t n = (size_t)(e - b);
+    if (n == 0 || n >= sizeof tmp) return false;
+    memcpy(tmp, b, n);
+    tmp[n] = '\0';
+    double v = strtod(tmp, &ep) * (double)MONEY_SCALE;
+    if (*ep != '\0' || !(v > -1e18 && v < 1e18)) return false;
+    *out = (Money)(v < 0 ? v - 0.5 : v + 0.5);
+    return true;
+}
+
+/* m as decimal text ("-12.50"), written backwards ending at `end`; returns the start. */
+static char *money_put(char *end, Money m) {
+    uint64_t u = m < 0 ? 0 - (uint64_t)m : (uint64_t)m;
+    for (int d = 0; d < MONEY_DIGITS; d++) { *--end = (char)('0' + u % 10); u /= 10; }
+    *--end = '.';
+    end = fmt_u64(end, u);
+    if (m < 0) *--end = '-';
+    return end;
+}
+
+/* m as a NUL-terminated string in buf (MONEY_BUF bytes). */
+static char *money_str(char *buf, Money m) {
+    buf[MONEY_BUF - 1] = '\0';
+    return money_put(buf + MONEY_BUF - 1, m);
 }
 
 /* ══════════════════════════════════════════════════════════════
- *  File I/O
+ *  Threads
+ *    A minimal fork/join layer over Win32 threads or pthreads.
  * ══════════════════════════════════════════════════════════════ */
 
+typedef void (*task_fn)(void *ctx, int worker);
+
+typedef struct {
+    task_fn fn;
+    void   *ctx;
+    int     worker;
+} TaskArg;
+
+#ifdef _WIN32
+static DWORD WINAPI task_entry(LPVOID p) {
+    TaskArg *a = p; a->fn(a->ctx, a->worker); return 0;
+}
+#else
+static void *task_entry(void *p) {
+    TaskArg *a = p; a->fn(a->ctx, a->worker); return NULL;
+}
+#endif
+
+/* Start fn(a->ctx, a->worker) on a new thread. `a` must outlive it. */
+#ifdef _WIN32
+typedef HANDLE Thread;
+static bool thread_start(Thread *t, TaskArg *a) {
+    *t = CreateThread(NULL, 0, task_entry, a, 0, NULL);
+    return *t != NULL;
+}
+static void thread_join(Thread t) {
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+#else
+typedef pthread_t Thread;
+static bool thread_start(Thread *t, TaskArg *a) {
+    return pthread_create(t, NULL, task_entry, a) == 0;
+}
+static void thread_join(Thread t) { pthread_join(t, NULL); }
+#endif
+
 /*
- * load_inventory
- *   Reads CSV rows from INVENTORY_FILE into g_items[].
- *   A missing file is treated as an empty inventory (not an error).
- *   Returns true on success.
+ * parallel_run
+ *   Calls fn(ctx, w) for w = 0..n-1, each on its own thread (worker 0
+ *   on the caller's), and returns once all have finished. If a thread
+ *   cannot be started its share runs on the caller instead.
  */
-static bool load_inventory(void) {
-    FILE *fp = fopen(INVENTORY_FILE, "r");
-    if (!fp) {
-        if (errno == ENOENT) {
-            printf("[INFO] '%s' not found – starting with empty inventory.\n",
-                   INVENTORY_FILE);
-            return true;
+static void parallel_run(int n, task_fn fn, void *ctx) {
+    TaskArg arg[MAX_LOAD_THREADS];
+    Thread  th[MAX_LOAD_THREADS];
+    bool started[MAX_LOAD_THREADS] = { false };
+    for (int w = 1; w < n; w++) {
+        arg[w] = (TaskArg){ fn, ctx, w };
+        started[w] = thread_start(&th[w], &arg[w]);
+    }
+    fn(ctx, 0);
+    for (int w = 1; w < n; w++) {
+        if (started[w]) thread_join(th[w]);
+        else            fn(ctx, w);
+    }
+}
+
+/* Mutex and condition variable, for the long-lived helper threads. */
+#ifdef _WIN32
+typedef CRITICAL_SECTION   Mutex;
+typedef CONDITION_VARIABLE Cond;
+static void mutex_init(Mutex *m)   { InitializeCriticalSection(m); }
+static void mutex_lock(Mutex *m)   { EnterCriticalSection(m); }
+static void mutex_unlock(Mutex *m) { LeaveCriticalSection(m); }
+static void cond_init(Cond *c)     { InitializeConditionVariable(c); }
+static void cond_signal(Cond *c)   { WakeConditionVariable(c); }
+static void cond_broadcast(Cond *c) { WakeAllConditionVariable(c); }
+/* Wait on c (releasing m) for up to ms milliseconds; ms < 0 waits forever. */
+static void cond_wait_ms(Cond *c, Mutex *m, int ms) {
+    SleepConditionVariableCS(c, m, ms < 0 ? INFINITE : (DWORD)ms);
+}
+#else
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t  Cond;
+static void mutex_init(Mutex *m)   { pthread_mutex_init(m, NULL); }
+static void mutex_lock(Mutex *m)   { pthread_mutex_lock(m); }
+static void mutex_unlock(Mutex *m) { pthread_mutex_unlock(m); }
+static void cond_init(Cond *c)     { pthread_cond_init(c, NULL); }
+static void cond_signal(Cond *c)   { pthread_cond_signal(c); }
+static void cond_broadcast(Cond *c) { pthread_cond_broadcast(c); }
+/* Wait on c (releasing m) for up to ms milliseconds; ms < 0 waits forever. */
+static void cond_wait_ms(Cond *c, Mutex *m, int ms) {
+    if (ms < 0) { pthread_cond_wait(c, m); return; }
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec  += ms / 1000;
+    ts.tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+    pthread_cond_timedwait(c, m, &ts);
+}
+#endif
+
+/* Reader-writer lock (the server's index shard locks); writers are not starved. */
+#ifdef _WIN32
+typedef SRWLOCK RwLock;
+static void rw_init(RwLock *l)          { InitializeSRWLock(l); }
+static void rw_lock_shared(RwLock *l)   { AcquireSRWLockShared(l); }
+static void rw_unlock_shared(RwLock *l) { ReleaseSRWLockShared(l); }
+static void rw_lock(RwLock *l)          { AcquireSRWLockExclusive(l); }
+static void rw_unlock(RwLock *l)        { ReleaseSRWLockExclusive(l); }
+#else
+typedef pthread_rwlock_t RwLock;
+static void rw_init(RwLock *l) {
+    pthread_rwlockattr_t a;
+    pthread_rwlockattr_init(&a);
+#ifdef __GLIBC__
+    pthread_rwlockattr_setkind_np(&a, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(l, &a);
+    pthread_rwlockattr_destroy(&a);
+}
+static void rw_lock_shared(RwLock *l)   { pthread_rwlock_rdlock(l); }
+static void rw_unlock_shared(RwLock *l) { pthread_rwlock_unlock(l); }
+static void rw_lock(RwLock *l)          { pthread_rwlock_wrlock(l); }
+static void rw_unlock(RwLock *l)        { pthread_rwlock_unlock(l); }
+#endif
+
+/* Monotonic clock in nanoseconds, for --bench. */
+static uint64_t now_ns(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER c;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&c);
+    uint64_t f = (uint64_t)freq.QuadPart, t = (uint64_t)c.QuadPart;
+    return t / f * 1000000000u + t % f * 1000000000u / f;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/* Number of online CPUs (at least 1). */
+static int cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+/* Grow a heap array so it holds at least n elements of elem bytes. */
+static bool vec_reserve(void *pbuf, size_t *cap, size_t n, size_t elem) {
+    void **buf = pbuf;
+    if (n <= *cap) return true;
+    size_t nc = *cap ? *cap : 64;
+    while (nc < n) nc *= 2;
+    void *nb = realloc(*buf, nc * elem);
+    if (!nb) return false;
+    *buf = nb; *cap = nc;
+    return true;
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Item store
+ * ══════════════════════════════════════════════════════════════ */
+
+/*
+ * Allocate n bytes charged against g_mem_limit. NULL if over the cap.
+ * Safe to call from several threads at once.
+ */
+static void *mem_alloc(size_t n) {
+    size_t used = atomic_fetch_add(&g_mem_used, n) + n;
+    if (g_mem_limit && (used > g_mem_limit || used < n)) {
+        atomic_fetch_sub(&g_mem_used, n);
+        return NULL;
+    }
+    void *p = malloc(n);
+    if (!p) atomic_fetch_sub(&g_mem_used, n);
+    return p;
+}
+
+static void mem_free(void *p, size_t n) {
+    if (!p) return;
+    if ((uintptr_t)p >= g_snap_lo && (uintptr_t)p < g_snap_hi) return; /* mapped */
+    free(p);
+    atomic_fetch_sub(&g_mem_used, n);
+}
+
+/*
+ * store_reserve
+ *   Ensures chunks exist for at least n items. The directory doubles
+ *   as needed; chunks themselves are never reallocated.
+ *   Returns false when memory (or the configured cap) is exhausted.
+ */
+static bool store_reserve(size_t n) {
+    while (g_chunk_cnt * ITEM_CHUNK < n) {
+        if (g_chunk_cnt == g_chunk_dir) {
+            size_t dir = g_chunk_dir ? g_chunk_dir * 2 : 16;
+            ItemChunk **d = mem_alloc(dir * sizeof *d);
+            uint64_t   *ep = d ? mem_alloc(dir * sizeof *ep) : NULL;
+            if (!ep) { mem_free(d, dir * sizeof *d); return false; }
+            if (g_chunk_cnt) {
+                memcpy(d, g_chunks, g_chunk_cnt * sizeof *d);
+                memcpy(ep, g_chunk_epoch, g_chunk_cnt * sizeof *ep);
+            }
+            mem_free(g_chunks, g_chunk_dir * sizeof *d);
+            mem_free(g_chunk_epoch, g_chunk_dir * sizeof *ep);
+            g_chunks      = d;
+            g_chunk_epoch = ep;
+            g_chunk_dir   = dir;
+        }
+        ItemChunk *c = mem_alloc(sizeof *c);
+        if (!c) return false;
+        g_chunk_epoch[g_chunk_cnt] = 0;
+        g_chunks[g_chunk_cnt++]    = c;
+    }
+    return true;
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Deferred snapshot checks
+ *    With --lazy-load the snapshot's payload checksum is never read, so
+ *    snapshot_check() only bounds its tables, and what they hold is
+ *    checked a section at a time as it is first used: an index table
+ *    when its shard is first looked up (every live slot names an item
+ *    of the snapshot and hashes to that shard), an item chunk when
+ *    index_probe() first reaches one of its items (every name handle
+ *    and length lies in a name block and ends at a terminator). Passes
+ *    over the whole store (pins, the search index, name compaction)
+ *    check whatever is left first. A damaged section is found before
+ *    anything is read through it: each operation first checks what it
+ *    will read (snap_ready()), and fails with OP_DAMAGED if that is
+ *    damaged. The snapshot is then set aside and the store fails every
+ *    later request, so that the next start imports the CSV and replays
+ *    the log, as when the damage is found at load time.
+ *
+ *    The same table charges the mapping to --mem-limit as it is
+ *    written: a chunk or index table changed in place turns its clean
+ *    file pages into private copies, so it is charged in full the
+ *    first time (chunk_own(), shard_own()).
+ * ══════════════════════════════════════════════════════════════ */
+
+enum { SNAP_UNCHECKED = 1, SNAP_DIRTY = 2 };
+
+static struct {
+    Mutex          lock;            /* one check at a time                  */
+    _Atomic size_t left;            /* sections still unchecked             */
+    atomic_uint_fast64_t shard_unchecked, shard_dirty; /* bit s: shard s    */
+    atomic_uchar  *chunk;           /* SNAP_UNCHECKED / SNAP_DIRTY per chunk */
+    size_t         nchunks;         /* chunks in the mapping; 0 = not lazy  */
+    int            count;           /* items in the snapshot                */
+    uint32_t       nblocks;         /* its name blocks (g_name_nblocks grows) */
+    atomic_bool    damaged;         /* a check failed: requests are refused */
+} g_lazy;
+
+_Static_assert(INDEX_SHARDS <= 64, "g_lazy keeps one bit per shard");
+
+/* Whether a damaged section was found; the store then refuses every request. */
+static inline bool snap_failed(void) {
+    return atomic_load_explicit(&g_lazy.damaged, memory_order_acquire);
+}
+
+/* Fail the store on a damaged section of a lazily loaded snapshot (see above). */
+static void snap_damaged(const char *what) {
+    if (atomic_exchange(&g_lazy.damaged, true)) return;
+    if (rename(SNAPSHOT_FILE, SNAPSHOT_BAD) == 0)
+        fprintf(stderr, "[ERROR] '%s' is damaged (%s); moved it to '%s'. Requests fail "
+                        "until a restart imports '%s' and replays '%s'.\n",
+                SNAPSHOT_FILE, what, SNAPSHOT_BAD, INVENTORY_FILE, WAL_FILE);
+    else
+        fprintf(stderr, "[ERROR] '%s' is damaged (%s). Requests fail until it is deleted "
+                        "and a restart imports '%s' and replays '%s'.\n",
+                SNAPSHOT_FILE, what, INVENTORY_FILE, WAL_FILE);
+}
+
+static bool snap_check_shard(int s) {
+    const IndexShard *sh = &g_shards[s];
+    size_t live = 0;
+    for (size_t i = 0; i < sh->cap; i++) {
+        int32_t idx = sh->tab[i].idx;
+        if (idx < 0) continue;
+        if (idx >= g_lazy.count || (int)(sh->tab[i].hash >> (32 - INDEX_SHARD_BITS)) != s) {
+            live = SIZE_MAX;
+            break;
+        }
+        live++;
+    }
+    if (live == sh->used) return true; /* a probe must find a free slot */
+    snap_damaged("index table");
+    return false;
+}
+
+static bool snap_check_chunk(size_t c) {
+    const ItemChunk *ch = g_chunks[c];
+    size_t n = (size_t)g_lazy.count - c * ITEM_CHUNK;
+    if (n > ITEM_CHUNK) n = ITEM_CHUNK;
+    for (size_t k = 0; k < n; k++) {
+        uint32_t h = ch->name[k], b = h >> NAME_BLOCK_SHIFT;
+        size_t   off = h & (NAME_BLOCK - 1), len = ch->name_len[k];
+        if (b >= g_lazy.nblocks || len == 0 || off >= g_name_block_sz[b] ||
+            len >= g_name_block_sz[b] - off || g_name_blocks[b][off + len] != '\0') {
+            snap_damaged("item names");
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Check shard s (s >= 0) or chunk c, unless done already; false if damaged. */
+static bool snap_check(int s, size_t c) {
+    mutex_lock(&g_lazy.lock);
+    bool ok = !snap_failed(); /* nothing more is read once one section failed */
+    if (ok && s >= 0 && (atomic_load(&g_lazy.shard_unchecked) >> s & 1)) {
+        ok = snap_check_shard(s);
+        if (ok) {
+            atomic_fetch_and(&g_lazy.shard_unchecked, ~((uint_fast64_t)1 << s));
+            atomic_fetch_sub(&g_lazy.left, 1);
+        }
+    } else if (ok && s < 0 && (atomic_load(&g_lazy.chunk[c]) & SNAP_UNCHECKED)) {
+        ok = snap_check_chunk(c);
+        if (ok) {
+            atomic_fetch_and(&g_lazy.chunk[c], (unsigned char)~SNAP_UNCHECKED);
+            atomic_fetch_sub(&g_lazy.left, 1);
+        }
+    }
+    mutex_unlock(&g_lazy.lock);
+    return ok;
+}
+
+/* Before index shard s is read; false if it is damaged. */
+static inline bool snap_touch_shard(int s) {
+    if (atomic_load_explicit(&g_lazy.left, memory_order_acquire) &&
+        (atomic_load_explicit(&g_lazy.shard_unchecked, memory_order_acquire) >> s & 1))
+        return snap_check(s, 0);
+    return true;
+}
+
+/* Before item i's fields are read; false if its chunk is damaged. */
+static inline bool snap_touch_item(int i) {
+    size_t c = (size_t)i >> ITEM_CHUNK_SHIFT;
+    if (atomic_load_explicit(&g_lazy.left, memory_order_acquire) && c < g_lazy.nchunks &&
+        (atomic_load_explicit(&g_lazy.chunk[c], memory_order_acquire) & SNAP_UNCHECKED))
+        return snap_check(-1, c);
+    return true;
+}
+
+/* Before a pass over the whole store; false once the store is damaged. */
+static bool snap_touch_all(void) {
+    if (!atomic_load_explicit(&g_lazy.left, memory_order_acquire)) return !snap_failed();
+    bool ok = true;
+    for (int s = 0; ok && s < INDEX_SHARDS; s++) ok = snap_touch_shard(s);
+    for (size_t c = 0; ok && c < g_lazy.nchunks; c++)
+        ok = snap_touch_item((int)(c << ITEM_CHUNK_SHIFT));
+    return ok && !snap_failed();
+}
+
+/* Charge `bytes` of the mapping, about to be written in place, to --mem-limit. */
+static void snap_charge_dirty(size_t bytes) {
+    atomic_fetch_add(&g_mem_used, bytes);
+    atomic_fetch_add(&g_snap_charge, bytes);
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Store versions
+ *    store_pin() freezes the store as a StoreImage in O(chunks): it
+ *    copies the chunk directory and the index shard headers and opens
+ *    a new epoch. From then on a writer about to change a chunk or an
+ *    index table last written in an older epoch first copies it
+ *    (chunk_own(), shard_own()) and retires the original, which is
+ *    freed once every pin that may still read it has been released:
+ *    epoch-based reclamation, with pins as the readers. So a save, a
+ *    checkpoint or a listing reads one consistent image while writers
+ *    carry on, and only the chunks they touch are copied. Names are
+ *    shared: while anything is pinned the pool is only appended to
+ *    (name_pool_compact() waits).
+ *
+ *    Pins are taken, and copies made, while writers are quiescent (one
+ *    thread, or the server's exclusive gate), so the directory and the
+ *    epoch tags are never written concurrently. Server workers that
+ *    would write a pinned chunk under the shared gate take the
+ *    exclusive path instead (see serve_point()).
+ * ══════════════════════════════════════════════════════════════ */
+
+/*
+ * StoreImage: a view of the store that snapshot_save(), the listings
+ * and abc_analyze() read. store_image_live() views the live store in
+ * place (for the thread that owns it); store_pin() a frozen version.
+ */
+typedef struct {
+    ItemChunk **chunks;
+    size_t      nchunks;
+    int         count;
+    IndexShard  shards[INDEX_SHARDS];
+    char      **name_blocks;
+    size_t     *name_block_sz;
+    uint32_t    name_nblocks;
+    int64_t     total_cents, total_units;
+    uint64_t    lsn;    /* last logged change the image includes */
+    uint32_t    seq_next;
+    uint64_t    bound;  /* pinned: sees memory of epochs before this */
+    bool        pinned; /* release with store_unpin()               */
+} StoreImage;
+
+#define IMG_COL(im, col, i) ((im)->chunks[(i) >> ITEM_CHUNK_SHIFT]->col[(i) & ITEM_CHUNK_MASK])
+
+static inline const char *img_name(const StoreImage *im, int i) {
+    uint32_t h = IMG_COL(im, name, i);
+    return im->name_blocks[h >> NAME_BLOCK_SHIFT] + (h & (NAME_BLOCK - 1));
+}
+
+static void store_image_live(StoreImage *im, uint64_t lsn) {
+    snap_touch_all();
+    im->chunks        = g_chunks;
+    im->nchunks       = ((size_t)g_count + ITEM_CHUNK - 1) / ITEM_CHUNK;
+    im->count         = g_count;
+    memcpy(im->shards, g_shards, sizeof g_shards);
+    im->name_blocks   = g_name_blocks;
+    im->name_block_sz = g_name_block_sz;
+    im->name_nblocks  = g_name_nblocks;
+    im->total_cents   = g_total_cents;
+    im->total_units   = g_total_units;
+    im->lsn           = lsn;
+    im->seq_next      = g_seq_next;
+    im->bound         = 0;
+    im->pinned        = false;
+}
+
+/* Memory a pin may still read, waiting for the pins to go. */
+typedef struct {
+    void    *p;
+    size_t   bytes;
+    uint64_t epoch; /* g_ver.epoch when retired */
+} Retired;
+
+static struct {
+    Mutex     lock;     /* pins and retired                             */
+    Cond      released; /* broadcast whenever a pin is released          */
+    uint64_t  epoch;    /* tag for memory written now                    */
+    atomic_uint_fast64_t bound; /* newest pin's bound; 0 = nothing pinned */
+    uint64_t *pins;     size_t npins, pins_cap;   /* bounds, oldest first */
+    Retired  *retired;  size_t nretired, retired_cap;
+} g_ver;
+
+/* Epoch in which each index table was created or last copied; that of
+ * each chunk is g_chunk_epoch[], which grows with the chunk directory. */
+static uint64_t g_shard_epoch[INDEX_SHARDS];
+
+/* Set while serving: takes (true) or releases (false) the exclusive gate. */
+static void (*g_pin_gate)(bool take);
+
+static void version_init(void) {
+    mutex_init(&g_ver.lock);
+    cond_init(&g_ver.released);
+    mutex_init(&g_lazy.lock);
+}
+
+/* True if a pinned image may see memory tagged with `epoch`. */
+static inline bool version_shared(uint64_t epoch) {
+    return epoch < atomic_load_explicit(&g_ver.bound, memory_order_acquire);
+}
+
+/* Wait (briefly) for a pin to be released. */
+static void version_wait(void) {
+    mutex_lock(&g_ver.lock);
+    if (g_ver.npins) cond_wait_ms(&g_ver.released, &g_ver.lock, 100);
+    mutex_unlock(&g_ver.lock);
+}
+
+/* Wait until nothing is pinned, before freeing the store wholesale. */
+static void version_quiesce(void) {
+    mutex_lock(&g_ver.lock);
+    while (g_ver.npins) cond_wait_ms(&g_ver.released, &g_ver.lock, -1);
+    mutex_unlock(&g_ver.lock);
+}
+
+/* Free p (bytes long, tagged `epoch`), or retire it if a pin may see it. */
+static void version_drop(void *p, size_t bytes, uint64_t epoch) {
+    if (!p) return;
+    mutex_lock(&g_ver.lock);
+    bool seen = g_ver.npins && version_shared(epoch);
+    while (seen && !vec_reserve(&g_ver.retired, &g_ver.retired_cap, g_ver.nretired + 1,
+                                sizeof *g_ver.retired)) {
+        cond_wait_ms(&g_ver.released, &g_ver.lock, 100);
+        seen = g_ver.npins && version_shared(epoch);
+    }
+    if (seen) g_ver.retired[g_ver.nretired++] = (Retired){ p, bytes, g_ver.epoch };
+    else      mem_free(p, bytes);
+    mutex_unlock(&g_ver.lock);
+}
+
+/*
+ * chunk_own
+ *   Chunk c, first copied if a pinned image shares it. Waits for a pin
+ *   to be released if the copy does not fit in memory (after which it
+ *   may no longer be needed).
+ */
+static ItemChunk *chunk_own(size_t c) {
+    while (version_shared(g_chunk_epoch[c])) {
+        ItemChunk *p = mem_alloc(sizeof *p);
+        if (!p) { version_wait(); continue; }
+        memcpy(p, g_chunks[c], sizeof *p);
+        version_drop(g_chunks[c], sizeof *p, g_chunk_epoch[c]);
+        g_chunks[c]      = p;
+        g_chunk_epoch[c] = g_ver.epoch;
+    }
+    if (c < g_lazy.nchunks && (uintptr_t)g_chunks[c] >= g_snap_lo &&
+        (uintptr_t)g_chunks[c] < g_snap_hi &&
+        !(atomic_fetch_or(&g_lazy.chunk[c], SNAP_DIRTY) & SNAP_DIRTY))
+        snap_charge_dirty(sizeof(ItemChunk));
+    return g_chunks[c];
+}
+
+/* Make item i's chunk writable. */
+#define ITEM_OWN(i) ((void)chunk_own((size_t)(i) >> ITEM_CHUNK_SHIFT))
+
+/* Copy every field of item src into position dst. */
+static void item_copy(int dst, int src) {
+    snap_touch_item(dst); /* not while another thread checks its chunk */
+    ITEM_OWN(dst);
+    ITEM_PRICE(dst) = ITEM_PRICE(src);
+    ITEM_QTY(dst)   = ITEM_QTY(src);
+    ITEM_NAME(dst)  = ITEM_NAME(src);
+    ITEM_LEN(dst)   = ITEM_LEN(src);
+    ITEM_HASH(dst)  = ITEM_HASH(src);
+    ITEM_SEQ(dst)   = ITEM_SEQ(src);
+}
+
+/* Shard s's table, made writable the same way. */
+static void shard_own(int s) {
+    IndexShard *sh = &g_shards[s];
+    while (sh->tab && version_shared(g_shard_epoch[s])) {
+        size_t     bytes = sh->cap * sizeof *sh->tab;
+        IndexSlot *t     = mem_alloc(bytes);
+        if (!t) { version_wait(); continue; }
+        memcpy(t, sh->tab, bytes);
+        version_drop(sh->tab, bytes, g_shard_epoch[s]);
+        sh->tab          = t;
+        g_shard_epoch[s] = g_ver.epoch;
+    }
+    if (g_lazy.nchunks && (uintptr_t)sh->tab >= g_snap_lo && (uintptr_t)sh->tab < g_snap_hi &&
+        !(atomic_fetch_or(&g_lazy.shard_dirty, (uint_fast64_t)1 << s) >> s & 1))
+        snap_charge_dirty(sh->cap * sizeof *sh->tab);
+}
+
+/*
+ * store_pin
+ *   Freezes the current store as `im`, recording `lsn` as the last
+ *   change it holds. Writers must be quiescent. Returns false if memory
+ *   is short or the store is damaged (snap_failed()); release a pinned
+ *   image with store_unpin().
+ */
+static bool store_pin(StoreImage *im, uint64_t lsn) {
+    if (!snap_touch_all()) return false;
+    store_image_live(im, lsn);
+    ItemChunk **dir = malloc((im->nchunks + 1) * sizeof *dir);
+    if (!dir) return false;
+    if (im->nchunks) memcpy(dir, g_chunks, im->nchunks * sizeof *dir);
+    mutex_lock(&g_ver.lock);
+    if (!vec_reserve(&g_ver.pins, &g_ver.pins_cap, g_ver.npins + 1, sizeof *g_ver.pins)) {
+        mutex_unlock(&g_ver.lock);
+        free(dir);
+        return false;
+    }
+    im->bound = ++g_ver.epoch;
+    g_ver.pins[g_ver.npins++] = im->bound;
+    atomic_store_explicit(&g_ver.bound, im->bound, memory_order_release);
+    mutex_unlock(&g_ver.lock);
+    im->chunks = dir;
+    im->pinned = true;
+    return true;
+}
+
+/*
+ * view_pin
+ *   The image a report reads: while serving, a version pinned under the
+ *   exclusive gate (held just for the pin), otherwise the live store.
+ *   Release it with store_unpin(). False as for store_pin().
+ */
+static bool view_pin(StoreImage *im) {
+    if (!g_pin_gate) { store_image_live(im, 0); return !snap_failed(); }
+    g_pin_gate(true);
+    bool ok = store_pin(im, 0);
+    g_pin_gate(false);
+    return ok;
+}
+
+/* Release a pinned image (from any thread) and free what no pin can see any more. */
+static void store_unpin(StoreImage *im) {
+    if (!im->pinned) return;
+    mutex_lock(&g_ver.lock);
+    size_t k = 0;
+    while (g_ver.pins[k] != im->bound) k++;
+    memmove(&g_ver.pins[k], &g_ver.pins[k + 1], (g_ver.npins - k - 1) * sizeof *g_ver.pins);
+    g_ver.npins--;
+    atomic_store_explicit(&g_ver.bound, g_ver.npins ? g_ver.pins[g_ver.npins - 1] : 0,
+                          memory_order_release);
+    /* A pin can see what was retired in its own epoch or later. */
+    uint64_t oldest = g_ver.npins ? g_ver.pins[0] : UINT64_MAX;
+    size_t   m = 0;
+    for (size_t r = 0; r < g_ver.nretired; r++) {
+        if (g_ver.retired[r].epoch < oldest)
+            mem_free(g_ver.retired[r].p, g_ver.retired[r].bytes);
+        else
+            g_ver.retired[m++] = g_ver.retired[r];
+    }
+    g_ver.nretired = m;
+    cond_broadcast(&g_ver.released);
+    mutex_unlock(&g_ver.lock);
+    free(im->chunks);
+    im->chunks = NULL;
+    im->pinned = false;
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Valuation
+ * ══════════════════════════════════════════════════════════════ */
+
+/*
+ * Per-chunk valuation kernels. Each returns Σ qty[k]×price[k] for
+ * k < n in wrapping 64-bit arithmetic, so every kernel, and any split
+ * or order of the chunks, gives the same bits. x86 and NEON have no
+ * 64-bit vector multiply; the vector variants build each product from
+ * three 32×32→64 multiplies of its halves.
+ */
+static Money chunk_value_scalar(const ItemChunk *c, size_t n) {
+    uint64_t sum = 0;
+    for (size_t k = 0; k < n; k++) sum += (uint64_t)(int64_t)c->qty[k] * (uint64_t)c->price[k];
+    return (Money)sum;
+}
+
+#if defined(HAVE_AVX2_KERNEL)
+__attribute__((target("avx2")))
+static Money chunk_value_avx2(const ItemChunk *c, size_t n) {
+    __m256i sum = _mm256_setzero_si256();
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4) {
+        __m256i q  = _mm256_cvtepi32_epi64(_mm_loadu_si128((const __m128i *)(c->qty + k)));
+        __m256i p  = _mm256_loadu_si256((const __m256i *)(c->price + k));
+        __m256i lo = _mm256_mul_epu32(q, p);
+        __m256i hi = _mm256_add_epi64(_mm256_mul_epu32(q, _mm256_srli_epi64(p, 32)),
+                                      _mm256_mul_epu32(_mm256_srli_epi64(q, 32), p));
+        sum = _mm256_add_epi64(sum, _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32)));
+    }
+    uint64_t lane[4];
+    _mm256_storeu_si256((__m256i *)lane, sum);
+    uint64_t total = lane[0] + lane[1] + lane[2] + lane[3];
+    for (; k < n; k++) total += (uint64_t)(int64_t)c->qty[k] * (uint64_t)c->price[k];
+    return (Money)total;
+}
+#elif defined(HAVE_NEON_KERNEL)
+static Money chunk_value_neon(const ItemChunk *c, size_t n) {
+    uint64x2_t sum = vdupq_n_u64(0);
+    size_t k = 0;
+    for (; k + 2 <= n; k += 2) {
+        uint64x2_t q  = vreinterpretq_u64_s64(vmovl_s32(vld1_s32(c->qty + k)));
+        uint64x2_t p  = vreinterpretq_u64_s64(vld1q_s64(c->price + k));
+        uint32x2_t ql = vmovn_u64(q), qh = vshrn_n_u64(q, 32);
+        uint32x2_t pl = vmovn_u64(p), ph = vshrn_n_u64(p, 32);
+        uint64x2_t hi = vmlal_u32(vmull_u32(ql, ph), qh, pl);
+        sum = vaddq_u64(sum, vaddq_u64(vmull_u32(ql, pl), vshlq_n_u64(hi, 32)));
+    }
+    uint64_t total = vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+    for (; k < n; k++) total += (uint64_t)(int64_t)c->qty[k] * (uint64_t)c->price[k];
+    return (Money)total;
+}
+#endif
+
+/*
+ * recompute_total
+ *   Full scan for Σ quantity × price, chunk by chunk with the widest
+ *   kernel the CPU supports.
+ */
+static Money recompute_total(void) {
+    Money (*kernel)(const ItemChunk *, size_t) = chunk_value_scalar;
+#if defined(HAVE_AVX2_KERNEL)
+    if (__builtin_cpu_supports("avx2")) kernel = chunk_value_avx2;
+#elif defined(HAVE_NEON_KERNEL)
+    kernel = chunk_value_neon;
+#endif
+
+    uint64_t total = 0;
+    for (int base = 0; base < g_count; base += ITEM_CHUNK) {
+        size_t n = (size_t)(g_count - base);
+        if (n > ITEM_CHUNK) n = ITEM_CHUNK;
+        total += (uint64_t)kernel(g_chunks[base >> ITEM_CHUNK_SHIFT], n);
+    }
+    return (Money)total;
+}
+
+/*
+ * Running totals. Every mutation applies an exact Money delta, so
+ * reading the total never needs a scan. With --check-totals each
+ * mutation also compares the cached value against recompute_total().
+ */
+
+/*
+ * Apply a delta to the running totals. While serving, point requests
+ * do this concurrently, so it is an atomic add;
+ * otherwise a plain load and store.
+ */
+static inline void totals_add(int64_t units, int64_t cents) {
+    if (g_serving) {
+        atomic_fetch_add_explicit(&g_total_units, units, memory_order_relaxed);
+        atomic_fetch_add_explicit(&g_total_cents, cents, memory_order_relaxed);
+        return;
+    }
+    atomic_store_explicit(&g_total_units,
+                          atomic_load_explicit(&g_total_units, memory_order_relaxed) + units,
+                          memory_order_relaxed);
+    atomic_store_explicit(&g_total_cents,
+                          atomic_load_explicit(&g_total_cents, memory_order_relaxed) + cents,
+                          memory_order_relaxed);
+}
+
+/* Abort loudly if the cached totals disagree with a full recompute. */
+static void totals_check(const char *op) {
+    if (!g_check_totals) return;
+    int64_t units = 0;
+    for (int i = 0; i < g_count; i++) units += ITEM_QTY(i);
+    Money   cents = recompute_total();
+    if (cents != g_total_cents || units != g_total_units) {
+        fprintf(stderr, "[BUG] Totals drifted after %s: cached %lld cents / %lld units, "
+                        "recomputed %lld cents / %lld units.\n", op,
+                (long long)g_total_cents, (long long)g_total_units,
+                (long long)cents, (long long)units);
+        abort();
+    }
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Name pool
+ * ══════════════════════════════════════════════════════════════ */
+
+/* NUL-terminated text for a name-pool handle. */
+static inline const char *name_str(uint32_t h) {
+    return g_name_blocks[h >> NAME_BLOCK_SHIFT] + (h & (NAME_BLOCK - 1));
+}
+
+/*
+ * name_intern_at
+ *   Copies s[0..len) plus a terminator into the block `cur` is filling,
+ *   starting a new block when it is full. Each thread may bump its own
+ *   cursor; only block creation is serialized. The caller accounts the
+ *   bytes in g_name_live. Returns the handle, or NAME_NONE when memory
+ *   is exhausted.
+ */
+static uint32_t name_intern_at(NameCursor *cur, const char *s, size_t len) {
+    size_t need = len + 1;
+    if (cur->top + need > cur->end) {
+        size_t sz = need > NAME_BLOCK ? need : NAME_BLOCK;
+        char *b = mem_alloc(sz);
+        if (!b) return NAME_NONE;
+        while (atomic_flag_test_and_set_explicit(&g_name_lock, memory_order_acquire)) {}
+        uint32_t id = g_name_nblocks;
+        if (id < NAME_MAX_BLOCKS) {
+            g_name_blocks[id]   = b;
+            g_name_block_sz[id] = sz;
+            g_name_nblocks++;
+        }
+        atomic_flag_clear_explicit(&g_name_lock, memory_order_release);
+        if (id == NAME_MAX_BLOCKS) { mem_free(b, sz); return NAME_NONE; }
+        cur->block = id; cur->top = 0; cur->end = sz;
+    }
+    uint32_t h = (cur->block << NAME_BLOCK_SHIFT) | (uint32_t)cur->top;
+    char *dst = g_name_blocks[cur->block] + cur->top;
+    memcpy(dst, s, len);
+    dst[len] = '\0';
+    cur->top += need;
+    return h;
+}
+
+/* Intern through the main cursor. */
+static uint32_t name_intern(const char *s, size_t len) {
+    uint32_t h = name_intern_at(&g_name_cur, s, len);
+    if (h != NAME_NONE) g_name_live += len + 1;
+    return h;
+}
+
+/* Release every pool block. */
+static void name_pool_reset(void) {
+    for (uint32_t b = 0; b < g_name_nblocks; b++)
+        mem_free(g_name_blocks[b], g_name_block_sz[b]);
+    g_name_nblocks = 0;
+    g_name_cur  = (NameCursor){ 0, 0, 0 };
+    g_name_dead = g_name_live = 0;
+}
+
+/*
+ * name_pool_compact
+ *   Re-interns every live name into fresh blocks once removed items
+ *   account for more than half of the pool, then frees the old blocks.
+ *   Best effort: if the copy cannot be allocated, or a pinned image
+ *   still reads the old blocks, the pool is left as is.
+ */
+static void name_pool_compact(void) {
+    if (g_name_dead <= g_name_live || g_name_dead < NAME_BLOCK) return;
+    if (g_shape_shared) { atomic_store(&g_compact_due, true); return; } /* see serve_after() */
+    if (atomic_load_explicit(&g_ver.bound, memory_order_acquire)) return; /* blocks pinned */
+    if (!snap_touch_all()) return;
+
+    /* Intern into blocks appended after the old ones. */
+    uint32_t   first    = g_name_nblocks;
+    NameCursor old_cur  = g_name_cur;
+    size_t     old_live = g_name_live;
+    g_name_cur.end = 0; /* force a new block */
+    g_name_live = 0;
+    uint32_t *fresh = malloc((size_t)g_count * sizeof *fresh);
+    bool ok = fresh != NULL;
+    for (int i = 0; ok && i < g_count; i++) {
+        fresh[i] = name_intern(name_str(ITEM_NAME(i)), ITEM_LEN(i));
+        ok = fresh[i] != NAME_NONE;
+    }
+    if (!ok) {
+        for (uint32_t b = first; b < g_name_nblocks; b++)
+            mem_free(g_name_blocks[b], g_name_block_sz[b]);
+        g_name_nblocks = first;
+        g_name_cur = old_cur; g_name_live = old_live;
+        free(fresh);
+        return;
+    }
+
+    /* Slide the new blocks down to the front of the directory. */
+    uint32_t shift = first << NAME_BLOCK_SHIFT;
+    for (int i = 0; i < g_count; i++) ITEM_NAME(i) = fresh[i] - shift;
+    free(fresh);
+    for (uint32_t b = 0; b < first; b++) mem_free(g_name_blocks[b], g_name_block_sz[b]);
+    memmove(g_name_blocks, g_name_blocks + first,
+            (g_name_nblocks - first) * sizeof *g_name_blocks);
+    memmove(g_name_block_sz, g_name_block_sz + first,
+            (g_name_nblocks - first) * sizeof *g_name_block_sz);
+    g_name_nblocks -= first;
+    g_name_cur.block -= first;
+    g_name_dead = 0;
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Statistics
+ *    Call counts and latency histograms for the core operations, and
+ *    the number of slots each name-index probe examines. Counters live
+ *    in STAT_STRIPES cache-line-aligned stripes; each thread claims one
+ *    on first use, so counting is an uncontended atomic add, and
+ *    stat_collect() merges them. Latencies fall into log-linear buckets,
+ *    four per power of two, so percentiles are accurate to 25% from a
+ *    fixed few hundred counters. Build with -DINVENTORY_STATS=0 to
+ *    compile all of it out.
+ * ══════════════════════════════════════════════════════════════ */
+
+typedef enum {
+    STAT_FIND, STAT_ADD, STAT_REMOVE, STAT_UPDATE, STAT_RESERVE, STAT_RELEASE,
+    STAT_IMPORT, STAT_LOAD, STAT_SAVE, STAT_OPS
+} StatOp;
+
+#if INVENTORY_STATS
+static const char *const stat_names[STAT_OPS] = {
+    "find", "add", "remove", "update", "reserve", "release", "import", "load", "save"
+};
+
+typedef struct {
+    _Alignas(64) atomic_uint_fast64_t count[STAT_OPS];
+    atomic_uint_fast64_t ns[STAT_OPS], max[STAT_OPS];
+    atomic_uint_fast64_t hist[STAT_OPS][STAT_BUCKETS];
+    atomic_uint_fast64_t probe[STAT_PROBES]; /* probes by slots examined - 1 */
+    atomic_uint_fast64_t probe_slots;
+} StatStripe;
+
+static StatStripe g_stat[STAT_STRIPES];
+static atomic_uint g_stat_next;
+static _Thread_local StatStripe *t_stat;
+
+/* Gauges, set by whoever changes the store: items and name-index slots. */
+static atomic_size_t g_stat_items, g_stat_slots;
+
+static StatStripe *stat_stripe(void) {
+    if (!t_stat)
+        t_stat = &g_stat[atomic_fetch_add_explicit(&g_stat_next, 1, memory_order_relaxed) %
+                         STAT_STRIPES];
+    return t_stat;
+}
+
+static unsigned stat_bucket(uint64_t ns) {
+    if (ns < 4) return (unsigned)ns;
+#if defined(__GNUC__)
+    unsigned e = 63u - (unsigned)__builtin_clzll(ns);
+#else
+    unsigned e = 2;
+    while (ns >> (e + 1)) e++;
+#endif
+    unsigned b = 4 * (e - 1) + (unsigned)((ns >> (e - 2)) & 3);
+    return b < STAT_BUCKETS ? b : STAT_BUCKETS - 1;
+}
+
+/* The largest latency bucket b holds. */
+static uint64_t stat_bucket_top(unsigned b) {
+    if (b < 4) return b;
+    unsigned e = b / 4 + 1;
+    return ((uint64_t)(4 + b % 4 + 1) << (e - 2)) - 1;
+}
+
+static inline uint64_t stat_begin(void) { return now_ns(); }
+
+/* Record one call of `op` that began at stat_begin() time t0. */
+static void stat_end(StatOp op, uint64_t t0) {
+    uint64_t    ns = now_ns() - t0;
+    StatStripe *s  = stat_stripe();
+    atomic_fetch_add_explicit(&s->count[op], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->ns[op], ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->hist[op][stat_bucket(ns)], 1, memory_order_relaxed);
+    uint_fast64_t m = atomic_load_explicit(&s->max[op], memory_order_relaxed);
+    while (ns > m && !atomic_compare_exchange_weak_explicit(&s->max[op], &m, ns,
+                                                            memory_order_relaxed,
+                                                            memory_order_relaxed)) {}
+}
+
+/* An index probe that examined `slots` slots (at least 1). */
+static inline void stat_probe(size_t slots) {
+    StatStripe *s = stat_stripe();
+    atomic_fetch_add_explicit(&s->probe[slots < STAT_PROBES ? slots - 1 : STAT_PROBES - 1], 1,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->probe_slots, slots, memory_order_relaxed);
+}
+
+static inline void stat_items(void) {
+    atomic_store_explicit(&g_stat_items, (size_t)g_count, memory_order_relaxed);
+}
+
+/* Name-index tables grew (or shrank) by `delta` slots. */
+static inline void stat_slots(size_t delta) {
+    atomic_fetch_add_explicit(&g_stat_slots, delta, memory_order_relaxed);
+}
+
+typedef struct {
+    uint64_t count[STAT_OPS], ns[STAT_OPS], max[STAT_OPS];
+    uint64_t hist[STAT_OPS][STAT_BUCKETS];
+    uint64_t probe[STAT_PROBES], probes, probe_slots;
+    size_t   items, slots;
+} StatTotals;
+
+/* Merge every stripe into *t. Safe alongside writers (each counter is exact). */
+static void stat_collect(StatTotals *t) {
+    memset(t, 0, sizeof *t);
+    for (int k = 0; k < STAT_STRIPES; k++) {
+        StatStripe *s = &g_stat[k];
+        for (int op = 0; op < STAT_OPS; op++) {
+            t->count[op] += atomic_load_explicit(&s->count[op], memory_order_relaxed);
+            t->ns[op]    += atomic_load_explicit(&s->ns[op], memory_order_relaxed);
+            uint64_t m = atomic_load_explicit(&s->max[op], memory_order_relaxed);
+            if (m > t->max[op]) t->max[op] = m;
+            for (int b = 0; b < STAT_BUCKETS; b++)
+                t->hist[op][b] += atomic_load_explicit(&s->hist[op][b], memory_order_relaxed);
+        }
+        for (int b = 0; b < STAT_PROBES; b++) {
+            uint64_t n = atomic_load_explicit(&s->probe[b], memory_order_relaxed);
+            t->probe[b] += n;
+            t->probes   += n;
+        }
+        t->probe_slots += atomic_load_explicit(&s->probe_slots, memory_order_relaxed);
+    }
+    t->items = atomic_load_explicit(&g_stat_items, memory_order_relaxed);
+    t->slots = atomic_load_explicit(&g_stat_slots, memory_order_relaxed);
+}
+
+/* Bucket holding the pct-th percentile of the n counts in h[0..nb), or 0. */
+static unsigned stat_percentile(const uint64_t *h, unsigned nb, uint64_t n, int pct) {
+    uint64_t rank = (n * (uint64_t)pct + 99) / 100, seen = 0;
+    for (unsigned b = 0; b < nb; b++)
+        if ((seen += h[b]) >= rank && rank) return b;
+    return 0;
+}
+#else
+static inline uint64_t stat_begin(void) { return 0; }
+static inline void stat_end(StatOp op, uint64_t t0) { (void)op; (void)t0; }
+static inline void stat_probe(size_t slots) { (void)slots; }
+static inline void stat_items(void) {}
+static inline void stat_slots(size_t delta) { (void)delta; }
+#endif
+
+/* ══════════════════════════════════════════════════════════════
+ *  Name index
+ *    Open-addressing hash table (linear probing) over the item store,
+ *    keyed on a case-folded FNV-1a hash so that lookups honour the
+ *    same case-insensitive equality as strcasecmp().
+ * ══════════════════════════════════════════════════════════════ */
+
+/* FNV-1a over the lower-cased bytes of s[0..len). */
+static uint32_t name_hash(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint32_t)(unsigned char)tolower((unsigned char)s[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static inline IndexShard *index_shard(uint32_t hash) {
+    int s = (int)(hash >> (32 - INDEX_SHARD_BITS));
+    snap_touch_shard(s);
+    return &g_shards[s];
+}
+
+/* Insert (hash → idx) without checking for an existing entry. */
+static void index_put(IndexSlot *tab, size_t cap, uint32_t hash, int idx) {
+    size_t mask = cap - 1;
+    size_t i = hash & mask;
+    while (tab[i].idx >= 0) i = (i + 1) & mask;
+    tab[i].hash = hash;
+    tab[i].idx  = idx;
+}
+
+/*
+ * shard_reserve
+ *   Makes room for `n` entries in one shard at a load factor of at most
+ *   1/2, rehashing the shard's own entries into a larger table. The
+ *   table is then writable: not shared with a pinned image.
+ *   Returns false if memory is exhausted (old table kept intact).
+ */
+static bool shard_reserve(IndexShard *sh, size_t n) {
+    int s = (int)(sh - g_shards);
+    if (sh->tab && n * 2 <= sh->cap) { shard_own(s); return true; }
+
+    size_t cap = sh->cap ? sh->cap : INDEX_MIN_CAP;
+    while (n * 2 > cap) cap *= 2;
+
+    IndexSlot *tab = mem_alloc(cap * sizeof *tab);
+    if (!tab) return false;
+    for (size_t i = 0; i < cap; i++) tab[i].idx = -1;
+    for (size_t i = 0; i < sh->cap; i++)
+        if (sh->tab[i].idx >= 0) index_put(tab, cap, sh->tab[i].hash, sh->tab[i].idx);
+
+    version_drop(sh->tab, sh->cap * sizeof *sh->tab, g_shard_epoch[s]);
+    stat_slots(cap - sh->cap);
+    sh->tab = tab;
+    sh->cap = cap;
+    g_shard_epoch[s] = g_ver.epoch;
+    return true;
+}
+
+/* Make room for one more entry with this hash. */
+static bool index_reserve_for(uint32_t hash) {
+    IndexShard *sh = index_shard(hash);
+    if (shard_reserve(sh, sh->used + 1)) return true;
+    fprintf(stderr, "[ERROR] Out of memory growing name index.\n");
+    return false;
+}
+
+/*
+ * Pre-size every shard for about n entries spread evenly by hash.
+ * A hint only: returns false if some shard could not be grown. Under a
+ * --mem-limit the index grows on demand instead, so an over-estimate
+ * cannot starve the store of its budget.
+ */
+static bool index_presize(size_t n) {
+    if (g_mem_limit) return true;
+    size_t per = n / INDEX_SHARDS + n / (INDEX_SHARDS * 8) + 16;
+    bool ok = true;
+    for (int s = 0; s < INDEX_SHARDS; s++)
+        ok = shard_reserve(&g_shards[s], per) && ok;
+    return ok;
+}
+
+/* Drop every entry, keeping the allocated tables. */
+static void index_clear(void) {
+    for (int s = 0; s < INDEX_SHARDS; s++) {
+        IndexShard *sh = &g_shards[s];
+        for (size_t i = 0; i < sh->cap; i++) sh->tab[i].idx = -1;
+        sh->used = 0;
+    }
+}
+
+/*
+ * index_probe
+ *   Locates the slot holding `name`, or the empty slot ending its probe
+ *   run (where it would be inserted). A shard with no table yet yields a
+ *   shared empty slot, so insertion always needs index_reserve_for() first.
+ */
+static IndexSlot *index_probe(const char *name, size_t len, uint32_t hash) {
+    static IndexSlot none = { 0, -1 };
+    IndexShard *sh = index_shard(hash);
+    if (!sh->tab) return &none;
+    size_t mask = sh->cap - 1;
+    size_t i = hash & mask, slots = 1;
+    while (sh->tab[i].idx >= 0) {
+        if (sh->tab[i].hash == hash) {
+            int idx = sh->tab[i].idx;
+            snap_touch_item(idx);
+            if (ITEM_LEN(idx) == len &&
+                strncasecmp(name_str(ITEM_NAME(idx)), name, len) == 0)
+                break;
+        }
+        i = (i + 1) & mask;
+        slots++;
+    }
+    stat_probe(slots);
+    return &sh->tab[i];
+}
+
+/* Fill the empty slot returned by index_probe() for `hash`. */
+static void index_fill(IndexSlot *slot, uint32_t hash, int idx) {
+    slot->hash = hash;
+    slot->idx  = idx;
+    index_shard(hash)->used++;
+}
+
+/* Start-of-run address for `hash`, for prefetching ahead of a probe. */
+static inline const void *index_home(uint32_t hash) {
+    IndexShard *sh = index_shard(hash);
+    return sh->tab ? &sh->tab[hash & (sh->cap - 1)] : NULL;
+}
+
+/*
+ * index_remove
+ *   Deletes the entry at `slot` using backward-shift deletion, so no
+ *   tombstones are left behind and probe runs stay short.
+ */
+static void index_remove(IndexSlot *slot) {
+    IndexShard *sh = index_shard(slot->hash);
+    size_t hole = (size_t)(slot - sh->tab);
+    shard_own((int)(sh - g_shards));
+    IndexSlot  *tab = sh->tab;
+    size_t mask = sh->cap - 1;
+    size_t i    = (hole + 1) & mask;
+    while (tab[i].idx >= 0) {
+        size_t home = tab[i].hash & mask;
+        /* Move entry i into the hole unless its home lies in (hole, i]. */
+        bool stays = (hole <= i) ? (home > hole && home <= i)
+                                 : (home > hole || home <= i);
+        if (!stays) {
+            tab[hole] = tab[i];
+            hole = i;
+        }
+        i = (i + 1) & mask;
+    }
+    tab[hole].idx = -1;
+    sh->used--;
+}
+
+/*
+ * The slot holding item idx, which must be indexed, for writing. For
+ * the last item of a lazily loaded snapshot snap_ready_shape() has
+ * found it first.
+ */
+static IndexSlot *index_slot_of(int idx) {
+    uint32_t    hash = ITEM_HASH(idx);
+    IndexShard *sh   = index_shard(hash);
+    shard_own((int)(sh - g_shards));
+    size_t mask = sh->cap - 1;
+    size_t i    = hash & mask;
+    while (sh->tab[i].idx != idx) i = (i + 1) & mask;
+    return &sh->tab[i];
+}
+
+/*
+ * snap_ready
+ *   Checks what a lookup of `hash` reads in a lazily loaded snapshot
+ *   (see "Deferred snapshot checks"): the shard's table and the items
+ *   of the probe run that have that hash. Single-item operations call
+ *   it first, under the locks of the lookup; false (OP_DAMAGED) once
+ *   the store is damaged, before anything has changed.
+ */
+static bool snap_ready(uint32_t hash) {
+    if (snap_failed()) return false;
+    if (!atomic_load_explicit(&g_lazy.left, memory_order_acquire)) return true;
+    int s = (int)(hash >> (32 - INDEX_SHARD_BITS));
+    if (!snap_touch_shard(s)) return false;
+    const IndexShard *sh = &g_shards[s];
+    if (!sh->tab) return true;
+    size_t mask = sh->cap - 1;
+    for (size_t i = hash & mask; sh->tab[i].idx >= 0; i = (i + 1) & mask)
+        if (sh->tab[i].hash == hash && !snap_touch_item(sh->tab[i].idx)) return false;
+    return true;
+}
+
+/*
+ * snap_ready_shape
+ *   The same for what an insertion or a removal reads besides: the
+ *   chunk a new item goes to and, `removing`, the last item, which
+ *   moves into the gap, and its index slot, which its hash must lead
+ *   to. Called under the locks ordering those changes (g_serve.shape).
+ */
+static bool snap_ready_shape(bool removing) {
+    if (snap_failed()) return false;
+    if (!g_lazy.nchunks) return true;
+    int last = g_count - 1;
+    if (!removing) return snap_touch_item(g_count);
+    if (last < 0) return true;
+    if (!snap_touch_item(last)) return false;
+    if (last >= g_lazy.count) return true; /* appended since the load */
+    uint32_t hash = ITEM_HASH(last);
+    if (!snap_touch_shard((int)(hash >> (32 - INDEX_SHARD_BITS)))) return false;
+    const IndexShard *sh = &g_shards[hash >> (32 - INDEX_SHARD_BITS)];
+    size_t mask = sh->cap - 1;
+    for (size_t i = hash & mask, n = 0; sh->tab && n < sh->cap; i = (i + 1) & mask, n++)
+        if (sh->tab[i].idx == last) return true;
+    snap_damaged("item hashes");
+    return false;
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Ordered views
+ *    Removal moves the last item into the gap, so store order drifts
+ *    from insertion order. Callers that care (listing, CSV export) walk
+ *    a permutation from store_view() instead.
+ * ══════════════════════════════════════════════════════════════ */
+
+static _Thread_local const StoreImage *t_view; /* image view_cmp_name() sorts */
+
+static int view_cmp_name(const void *a, const void *b) {
+    return strcasecmp(img_name(t_view, *(const int *)a), img_name(t_view, *(const int *)b));
+}
+
+/*
+ * store_view
+ *   Positions of image im's items in the requested order as a malloc'd
+ *   array of im->count entries, or NULL meaning store order (also
+ *   returned when the image is already in insertion order, or memory is
+ *   short). Insertion order is an O(n) radix sort on the sequence numbers.
+ */
+static int *store_view(const StoreImage *im, ViewOrder order) {
+    if (order == ORDER_STORE || im->count < 2) return NULL;
+    size_t n = (size_t)im->count;
+    int *v = malloc(n * sizeof *v);
+    if (!v) return NULL;
+
+    if (order == ORDER_NAME) {
+        for (size_t i = 0; i < n; i++) v[i] = (int)i;
+        t_view = im;
+        qsort(v, n, sizeof *v, view_cmp_name);
+        return v;
+    }
+
+    bool sorted = true;
+    for (size_t i = 1; i < n && sorted; i++)
+        sorted = IMG_COL(im, seq, i - 1) < IMG_COL(im, seq, i);
+    uint64_t *key = sorted ? NULL : malloc(2 * n * sizeof *key);
+    if (!key) { free(v); return NULL; }
+
+    /* LSD radix sort of (seq << 32 | position), 11 bits per pass. */
+    uint64_t *a = key, *b = key + n;
+    uint32_t  all = 0;
+    for (size_t i = 0; i < n; i++) {
+        a[i] = (uint64_t)IMG_COL(im, seq, i) << 32 | i;
+        all |= IMG_COL(im, seq, i);
+    }
+    for (int shift = 32; shift < 64 && (all >> (shift - 32)); shift += 11) {
+        size_t count[1 << 11] = { 0 };
+        for (size_t i = 0; i < n; i++) count[(a[i] >> shift) & 0x7FF]++;
+        size_t sum = 0;
+        for (int d = 0; d < (1 << 11); d++) { size_t c = count[d]; count[d] = sum; sum += c; }
+        for (size_t i = 0; i < n; i++) b[count[(a[i] >> shift) & 0x7FF]++] = a[i];
+        uint64_t *t = a; a = b; b = t;
+    }
+    for (size_t i = 0; i < n; i++) v[i] = (int)(uint32_t)a[i];
+    free(key);
+    return v;
+}
+
+/* Reassign ITEM_SEQ as 0..n-1 in insertion order, once the counter wraps. */
+static void seq_renumber(void) {
+    StoreImage live;
+    store_image_live(&live, 0);
+    int *v = store_view(&live, ORDER_INSERTION);
+    for (size_t c = 0; c < live.nchunks; c++) chunk_own(c);
+    for (int k = 0; k < g_count; k++) ITEM_SEQ(v ? v[k] : k) = (uint32_t)k;
+    free(v);
+    g_seq_next = (uint32_t)g_count;
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Name search
+ *    Partial-name lookup for menu_search() and the search command.
+ *    Case-folded copies of the names are kept sorted, so prefix matches
+ *    are a binary search and a walk; a trigram index over them finds
+ *    substring matches by checking only the names that share the
+ *    query's rarest trigram, and per-name character masks cut short
+ *    the scan for queries of one or two characters. The index is built
+ *    by the first search and then kept current by store_append() and
+ *    store_delete(): additions go to a small sorted delta and removals
+ *    leave tombstones, both folded into the main array once they grow
+ *    (search_merge()). Matches are names, turned into positions through
+ *    the name index, so removals reshuffling the store never touch it.
+ * ══════════════════════════════════════════════════════════════ */
+
+typedef struct {
+    uint32_t off, len; /* folded name at text + off */
+} SearchKey;
+
+static struct {
+    bool       built;
+    char      *text;    size_t text_len;  /* main names, folded, sorted */
+    SearchKey *key;     size_t n;
+    uint64_t  *mask;    size_t ndead;     /* key[] chars; 0 = removed   */
+    uint64_t  *bmask;                     /* mask[] OR'd per 64 entries */
+    uint32_t  *tri_off;                   /* trigram bucket → tri_ids   */
+    uint32_t  *tri_ids; size_t nids;      /* key[] positions, ascending */
+    SearchKey  dkey[SEARCH_DELTA];        /* delta, sorted              */
+    size_t     nd;
+    char      *dtext;   size_t dtext_len, dtext_cap;
+} g_search;
+
+static void fold(char *dst, const char *src, size_t n) {
+    for (size_t i = 0; i < n; i++) dst[i] = (char)tolower((unsigned char)src[i]);
+}
+
+/* Which characters occur in a folded name: one bit per letter or digit,
+ * the rest shared. A name can only contain q if it has all of q's bits. */
+static uint64_t char_mask(const char *s, size_t n) {
+    uint64_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+        unsigned c = (unsigned char)s[i];
+        m |= 1ull << (c - 'a' < 26 ? c - 'a' : c - '0' < 10 ? 26 + c - '0' : 36 + c % 28);
+    }
+    return m;
+}
+
+static int fold_cmp(const char *a, size_t al, const char *b, size_t bl) {
+    int c = memcmp(a, b, al < bl ? al : bl);
+    return c ? c : (al > bl) - (al < bl);
+}
+
+static bool has_sub(const char *s, size_t n, const char *q, size_t m) {
+    for (const char *end = s + n; (size_t)(end - s) >= m; s++) {
+        s = memchr(s, q[0], (size_t)(end - s) - m + 1);
+        if (!s) return false;
+        if (memcmp(s, q, m) == 0) return true;
+    }
+    return false;
+}
+
+/* A stored (unfolded) name, s, starts with the folded q; and contains it. */
+static bool fold_starts(const char *s, size_t n, const char *q, size_t m) {
+    if (n < m) return false;
+    for (size_t i = 0; i < m; i++)
+        if ((char)tolower((unsigned char)s[i]) != q[i]) return false;
+    return true;
+}
+
+static bool fold_has(const char *s, size_t n, const char *q, size_t m) {
+    for (size_t i = 0; i + m <= n; i++)
+        if (fold_starts(s + i, n - i, q, m)) return true;
+    return false;
+}
+
+/* Contains q but does not start with it (prefix matches are listed first). */
+static bool sub_only(const char *s, size_t n, const char *q, size_t m) {
+    return n > m && memcmp(s, q, m) != 0 && has_sub(s + 1, n - 1, q, m);
+}
+
+static inline uint32_t tri_hash(const char *p) {
+    uint32_t t = (uint32_t)(unsigned char)p[0] << 16 | (uint32_t)(unsigned char)p[1] << 8 |
+                 (unsigned char)p[2];
+    return (t * 2654435761u) >> (32 - TRI_BITS);
+}
+
+static void search_free(void) {
+    mem_free(g_search.text, g_search.text_len);
+    mem_free(g_search.key, (g_search.n + 1) * sizeof *g_search.key);
+    mem_free(g_search.mask, (g_search.n + 1) * sizeof *g_search.mask);
+    mem_free(g_search.bmask, (g_search.n / 64 + 1) * sizeof *g_search.bmask);
+    mem_free(g_search.tri_off, ((size_t)(1 << TRI_BITS) + 1) * sizeof *g_search.tri_off);
+    mem_free(g_search.tri_ids, g_search.nids * sizeof *g_search.tri_ids);
+    mem_free(g_search.dtext, g_search.dtext_cap);
+    memset(&g_search, 0, sizeof g_search);
+}
+
+static const char *g_sort_text; /* for search_cmp() */
+
+static int search_cmp(const void *a, const void *b) {
+    const SearchKey *x = a, *y = b;
+    return fold_cmp(g_sort_text + x->off, x->len, g_sort_text + y->off, y->len);
+}
+
+/* Trigram postings for key[0, n): bucket b lists its names in tri_ids. */
+static bool search_build_tri(const char *text, const SearchKey *key, size_t n) {
+    size_t    nb   = (size_t)1 << TRI_BITS;
+    uint32_t *off  = mem_alloc((nb + 1) * sizeof *off);
+    uint32_t *last = malloc(nb * sizeof *last);
+    if (!off || !last) { mem_free(off, (nb + 1) * sizeof *off); free(last); return false; }
+    memset(off, 0, (nb + 1) * sizeof *off);
+    memset(last, 0xFF, nb * sizeof *last);
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j + 3 <= key[i].len; j++) {
+            uint32_t b = tri_hash(text + key[i].off + j);
+            if (last[b] != (uint32_t)i) { last[b] = (uint32_t)i; off[b + 1]++; }
+        }
+    for (size_t b = 0; b < nb; b++) off[b + 1] += off[b];
+    size_t    nids = off[nb];
+    uint32_t *ids  = mem_alloc(nids * sizeof *ids + 1);
+    if (!ids) { mem_free(off, (nb + 1) * sizeof *off); free(last); return false; }
+    memcpy(last, off, nb * sizeof *last); /* now: next free slot per bucket */
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j + 3 <= key[i].len; j++) {
+            uint32_t b = tri_hash(text + key[i].off + j);
+            if (last[b] == off[b] || ids[last[b] - 1] != (uint32_t)i) ids[last[b]++] = (uint32_t)i;
+        }
+    free(last);
+    g_search.tri_off = off;
+    g_search.tri_ids = ids;
+    g_search.nids    = nids;
+    return true;
+}
+
+/*
+ * search_merge
+ *   (Re)builds the main array: from the store on first use, otherwise by
+ *   merging the live entries with the delta. On failure the index is
+ *   dropped and searches fall back to scanning the store.
+ */
+static void search_merge(void) {
+    size_t n = 0, bytes = 0;
+    if (g_search.built) {
+        n = g_search.n - g_search.ndead + g_search.nd;
+        bytes = g_search.dtext_len;
+        for (size_t i = 0; i < g_search.n; i++)
+            if (g_search.mask[i]) bytes += g_search.key[i].len;
+    } else {
+        if (!snap_touch_all()) return; /* damaged: no index */
+        n = (size_t)g_count;
+        for (int i = 0; i < g_count; i++) bytes += ITEM_LEN(i);
+    }
+    char      *text = mem_alloc(bytes + 1);
+    SearchKey *key  = mem_alloc((n + 1) * sizeof *key);
+    uint64_t  *mask = mem_alloc((n + 1) * sizeof *mask);
+    uint64_t  *bmask = mem_alloc((n / 64 + 1) * sizeof *bmask);
+    if (!text || !key || !mask || !bmask) goto fail;
+
+    size_t len = 0, k = 0;
+    if (g_search.built) {
+        size_t i = 0, d = 0;
+        while (i < g_search.n || d < g_search.nd) {
+            if (i < g_search.n && !g_search.mask[i]) { i++; continue; }
+            const SearchKey *mk = i < g_search.n ? &g_search.key[i] : NULL;
+            const SearchKey *dk = d < g_search.nd ? &g_search.dkey[d] : NULL;
+            bool main = mk && (!dk || fold_cmp(g_search.text + mk->off, mk->len,
+                                               g_search.dtext + dk->off, dk->len) < 0);
+            const char *src = main ? g_search.text + mk->off : g_search.dtext + dk->off;
+            uint32_t    sl  = main ? mk->len : dk->len;
+            memcpy(text + len, src, sl);
+            key[k++] = (SearchKey){ (uint32_t)len, sl };
+            len += sl;
+            if (main) i++; else d++;
+        }
+    } else {
+        for (int i = 0; i < g_count; i++) {
+            fold(text + len, name_str(ITEM_NAME(i)), ITEM_LEN(i));
+            key[k++] = (SearchKey){ (uint32_t)len, ITEM_LEN(i) };
+            len += ITEM_LEN(i);
+        }
+        g_sort_text = text;
+        qsort(key, k, sizeof *key, search_cmp);
+    }
+    memset(bmask, 0, (n / 64 + 1) * sizeof *bmask);
+    for (size_t i = 0; i < n; i++) bmask[i / 64] |= mask[i] = char_mask(text + key[i].off, key[i].len);
+
+    search_free();
+    if (search_build_tri(text, key, n)) {
+        g_search.text = text; g_search.text_len = bytes + 1;
+        g_search.key  = key;
+        g_search.mask = mask; g_search.bmask = bmask;
+        g_search.n    = n;
+        g_search.built = true;
+        return;
+    }
+fail:
+    mem_free(text, bytes + 1);
+    mem_free(key, (n + 1) * sizeof *key);
+    mem_free(mask, (n + 1) * sizeof *mask);
+    mem_free(bmask, (n / 64 + 1) * sizeof *bmask);
+    search_free();
+}
+
+/* Position of the first key[] entry not below q in a sorted run. */
+static size_t search_lower(const char *text, const SearchKey *key, size_t n,
+                           const char *q, size_t m) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (fold_cmp(text + key[mid].off, key[mid].len, q, m) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* A name was added to the store. */
+static void search_note_add(const char *name, size_t len) {
+    if (!g_search.built) return;
+    if (g_search.dtext_len + len > g_search.dtext_cap) {
+        size_t cap = g_search.dtext_cap ? g_search.dtext_cap * 2 : 4096;
+        while (cap < g_search.dtext_len + len) cap *= 2;
+        char *t = mem_alloc(cap);
+        if (!t) { search_free(); return; }
+        if (g_search.dtext_len) memcpy(t, g_search.dtext, g_search.dtext_len);
+        mem_free(g_search.dtext, g_search.dtext_cap);
+        g_search.dtext = t; g_search.dtext_cap = cap;
+    }
+    char *f = g_search.dtext + g_search.dtext_len;
+    fold(f, name, len);
+    size_t at = search_lower(g_search.dtext, g_search.dkey, g_search.nd, f, len);
+    memmove(&g_search.dkey[at + 1], &g_search.dkey[at], (g_search.nd - at) * sizeof *g_search.dkey);
+    g_search.dkey[at] = (SearchKey){ (uint32_t)g_search.dtext_len, (uint32_t)len };
+    g_search.dtext_len += len;
+    if (++g_search.nd == SEARCH_DELTA) search_merge();
+}
+
+/* A name was removed from the store. */
+static void search_note_del(const char *name, size_t len) {
+    if (!g_search.built) return;
+    char  stack[LINE_BUF], *f = len <= sizeof stack ? stack : malloc(len);
+    if (!f) { search_free(); return; }
+    fold(f, name, len);
+    size_t at = search_lower(g_search.dtext, g_search.dkey, g_search.nd, f, len);
+    if (at < g_search.nd && fold_cmp(g_search.dtext + g_search.dkey[at].off,
+                                     g_search.dkey[at].len, f, len) == 0) {
+        memmove(&g_search.dkey[at], &g_search.dkey[at + 1],
+                (g_search.nd - at - 1) * sizeof *g_search.dkey);
+        g_search.nd--;
+    } else {
+        at = search_lower(g_search.text, g_search.key, g_search.n, f, len);
+        if (at < g_search.n && g_search.mask[at] &&
+            fold_cmp(g_search.text + g_search.key[at].off, g_search.key[at].len, f, len) == 0) {
+            g_search.mask[at] = 0;
+            g_search.ndead++;
+        }
+    }
+    if (f != stack) free(f);
+    if (g_search.ndead > g_search.n / 4 + SEARCH_DELTA) search_merge();
+}
+
+/* Item position for a folded name held by the index. */
+static int search_pos(const char *f, size_t len) {
+    return index_probe(f, len, name_hash(f, len))->idx;
+}
+
+/*
+ * search_find
+ *   Up to k items whose name starts with q, then up to the remainder
+ *   whose name contains it, each group in name order (case-insensitive).
+ *   Positions go to out[]; *more is set when the list was cut at k.
+ */
+static int search_find(const char *q, size_t m, int *out, int k, bool *more) {
+    int got = 0;
+    *more = false;
+    if (k <= 0 || m == 0) return 0;
+    if (!g_search.built) search_merge();
+    char stack[LINE_BUF], *f = m <= sizeof stack ? stack : malloc(m);
+    if (!f) return 0;
+    fold(f, q, m);
+
+    if (!g_search.built) {
+        /* No index (out of memory): scan the store, unless it is damaged. */
+        for (int pass = snap_touch_all() ? 0 : 2; pass < 2 && got < k; pass++)
+            for (int i = 0; i < g_count; i++) {
+                const char *nm = name_str(ITEM_NAME(i));
+                size_t      nl = ITEM_LEN(i);
+                bool pre = fold_starts(nm, nl, f, m);
+                if (pass == 0 ? !pre : pre || !fold_has(nm, nl, f, m)) continue;
+                if (got == k) { *more = true; break; }
+                out[got++] = i;
+            }
+        if (f != stack) free(f);
+        return got;
+    }
+
+    const char *t = g_search.text, *dt = g_search.dtext;
+    const SearchKey *key = g_search.key, *dkey = g_search.dkey;
+    size_t n = g_search.n, nd = g_search.nd;
+
+    /* Prefix matches: merge the main and delta runs. */
+    size_t i = search_lower(t, key, n, f, m), d = search_lower(dt, dkey, nd, f, m);
+    for (;;) {
+        while (i < n && !g_search.mask[i]) i++;
+        bool mi = i < n  && key[i].len  >= m && memcmp(t + key[i].off, f, m) == 0;
+        bool md = d < nd && dkey[d].len >= m && memcmp(dt + dkey[d].off, f, m) == 0;
+        if (!mi && !md) break;
+        bool main = mi && (!md || fold_cmp(t + key[i].off, key[i].len,
+                                           dt + dkey[d].off, dkey[d].len) < 0);
+        if (got == k) { *more = true; goto done; }
+        const SearchKey *sk = main ? &key[i++] : &dkey[d++];
+        out[got++] = search_pos((main ? t : dt) + sk->off, sk->len);
+    }
+
+    /* Substring matches: candidates from the query's rarest trigram. */
+    const uint32_t *cand = NULL;
+    size_t   ncand = n;
+    uint64_t qmask = char_mask(f, m);
+    if (m >= 3) {
+        for (size_t j = 0; j + 3 <= m; j++) {
+            uint32_t b = tri_hash(f + j);
+            size_t   c = g_search.tri_off[b + 1] - g_search.tri_off[b];
+            if (!cand || c < ncand) { cand = g_search.tri_ids + g_search.tri_off[b]; ncand = c; }
+        }
+    }
+    for (size_t c = 0, e = 0, dd = 0;;) {
+        /* Merge the next main and delta matches, in name order. */
+        for (; c < ncand; c++) {
+            if (!cand && c % 64 == 0)   /* whole-index scan: skip blocks */
+                while (c < ncand && (g_search.bmask[c / 64] & qmask) != qmask) c += 64;
+            if (c >= ncand) { c = ncand; break; }
+            e = cand ? cand[c] : c;
+            if ((g_search.mask[e] & qmask) == qmask &&
+                sub_only(t + key[e].off, key[e].len, f, m)) break;
+        }
+        while (dd < nd && !sub_only(dt + dkey[dd].off, dkey[dd].len, f, m)) dd++;
+        if (c == ncand && dd == nd) break;
+        bool main = c < ncand && (dd == nd || fold_cmp(t + key[e].off, key[e].len,
+                                                       dt + dkey[dd].off, dkey[dd].len) < 0);
+        if (got == k) { *more = true; goto done; }
+        const SearchKey *sk = main ? &key[e] : &dkey[dd];
+        out[got++] = search_pos((main ? t : dt) + sk->off, sk->len);
+        if (main) c++; else dd++;
+    }
+done:
+    if (f != stack) free(f);
+    return got;
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Ordered indexes
+ *    Items by quantity and by price, for the low-stock and price-range
+ *    reports: a range of k items costs O(log n + k). Each index is a
+ *    treap whose nodes are stored by item position (one per item, no
+ *    allocation per change), ordered by (key, ITEM_SEQ) and balanced by
+ *    a hash of ITEM_SEQ. Like the name search they are built by the
+ *    first report and then maintained. Quantities change lock-free
+ *    while serving, so a change only marks the item (ord_touch()); the
+ *    marked items are re-keyed when the store is next held exclusively
+ *    for a report (ord_sync()). Each node keeps the key it is filed
+ *    under, so the tree stays consistent in between.
+ * ══════════════════════════════════════════════════════════════ */
+
+#define ORD_NONE UINT32_MAX
+
+typedef struct {
+    uint32_t l, r;
+    int64_t  key;   /* quantity or price, as filed */
+} OrdNode;
+
+typedef struct {
+    OrdNode *node;  /* by item position */
+    uint32_t root;
+} OrdIndex;
+
+static struct {
+    bool             built;
+    OrdIndex         qty, price;
+    size_t           cap;
+    _Atomic uint8_t *dirty;  /* item changed since last filed */
+    int             *dlist;  /* the changed items             */
+    _Atomic size_t   nd;
+} g_ord;
+
+static inline int64_t ord_key(const OrdIndex *ix, int i) {
+    return ix == &g_ord.qty ? ITEM_QTY(i) : ITEM_PRICE(i);
+}
+
+static inline uint32_t ord_prio(int i) {
+    uint32_t h = ITEM_SEQ(i);
+    h ^= h >> 16; h *= 0x85EBCA6Bu; h ^= h >> 13; h *= 0xC2B2AE35u; h ^= h >> 16;
+    return h;
+}
+
+static inline bool ord_less(const OrdIndex *ix, uint32_t a, uint32_t b) {
+    int64_t ka = ix->node[a].key, kb = ix->node[b].key;
+    return ka < kb || (ka == kb && ITEM_SEQ(a) < ITEM_SEQ(b));
+}
+
+/* Split t into the nodes ordered before x (*l) and the rest (*r). */
+static void ord_split(OrdIndex *ix, uint32_t t, uint32_t x, uint32_t *l, uint32_t *r) {
+    while (t != ORD_NONE) {
+        if (ord_less(ix, t, x)) { *l = t; l = &ix->node[t].r; t = *l; }
+        else                    { *r = t; r = &ix->node[t].l; t = *r; }
+    }
+    *l = *r = ORD_NONE;
+}
+
+/* Join a and b, every node of a ordered before every node of b. */
+static uint32_t ord_merge(OrdIndex *ix, uint32_t a, uint32_t b) {
+    uint32_t root, *link = &root;
+    while (a != ORD_NONE && b != ORD_NONE) {
+        if (ord_prio((int)a) > ord_prio((int)b)) { *link = a; link = &ix->node[a].r; a = *link; }
+        else                                     { *link = b; link = &ix->node[b].l; b = *link; }
+    }
+    *link = a != ORD_NONE ? a : b;
+    return root;
+}
+
+/* File item i under its current node key. */
+static void ord_insert(OrdIndex *ix, uint32_t i) {
+    uint32_t *link = &ix->root, p = ord_prio((int)i);
+    while (*link != ORD_NONE && ord_prio((int)*link) >= p)
+        link = ord_less(ix, i, *link) ? &ix->node[*link].l : &ix->node[*link].r;
+    ord_split(ix, *link, i, &ix->node[i].l, &ix->node[i].r);
+    *link = i;
+}
+
+/* The link pointing at filed item i. */
+static uint32_t *ord_link(OrdIndex *ix, uint32_t i) {
+    uint32_t *link = &ix->root;
+    while (*link != i) link = ord_less(ix, i, *link) ? &ix->node[*link].l : &ix->node[*link].r;
+    return link;
+}
+
+static void ord_erase(OrdIndex *ix, uint32_t i) {
+    uint32_t *link = ord_link(ix, i);
+    *link = ord_merge(ix, ix->node[i].l, ix->node[i].r);
+}
+
+static void ord_free(void) {
+    mem_free(g_ord.qty.node, g_ord.cap * sizeof(OrdNode));
+    mem_free(g_ord.price.node, g_ord.cap * sizeof(OrdNode));
+    mem_free((void *)g_ord.dirty, g_ord.cap);
+    mem_free(g_ord.dlist, g_ord.cap * sizeof *g_ord.dlist);
+    memset(&g_ord, 0, sizeof g_ord);
+}
+
+/* Room for n items. Existing nodes are copied; false (leaving the index
+ * as it was) when memory is short. */
+static bool ord_reserve(size_t n) {
+    if (n <= g_ord.cap) return true;
+    size_t   cap = g_ord.cap ? g_ord.cap : 1024;
+    while (cap < n) cap *= 2;
+    OrdNode *q = mem_alloc(cap * sizeof *q), *p = mem_alloc(cap * sizeof *p);
+    uint8_t *d = mem_alloc(cap);
+    int     *l = mem_alloc(cap * sizeof *l);
+    if (!q || !p || !d || !l) {
+        mem_free(q, cap * sizeof *q); mem_free(p, cap * sizeof *p);
+        mem_free(d, cap); mem_free(l, cap * sizeof *l);
+        return false;
+    }
+    size_t old = g_ord.cap;
+    if (old) {
+        memcpy(q, g_ord.qty.node, old * sizeof *q);
+        memcpy(p, g_ord.price.node, old * sizeof *p);
+        memcpy(d, (void *)g_ord.dirty, old);
+        memcpy(l, g_ord.dlist, old * sizeof *l);
+    }
+    memset(d + old, 0, cap - old);
+    mem_free(g_ord.qty.node, old * sizeof *q);
+    mem_free(g_ord.price.node, old * sizeof *p);
+    mem_free((void *)g_ord.dirty, old);
+    mem_free(g_ord.dlist, old * sizeof *l);
+    g_ord.qty.node = q; g_ord.price.node = p;
+    g_ord.dirty = (_Atomic uint8_t *)d; g_ord.dlist = l;
+    g_ord.cap = cap;
+    return true;
+}
+
+static const OrdIndex *g_ord_sort; /* for ord_cmp() */
+
+static int ord_cmp(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return ord_less(g_ord_sort, x, y) ? -1 : ord_less(g_ord_sort, y, x);
+}
+
+/* Build ix from scratch: sort, then the treap in one left-to-right pass. */
+static bool ord_build(OrdIndex *ix) {
+    size_t    n = (size_t)g_count;
+    uint32_t *v = malloc((n + 1) * sizeof *v), *stack = malloc((n + 1) * sizeof *stack);
+    if (!v || !stack) { free(v); free(stack); return false; }
+    for (size_t i = 0; i < n; i++) {
+        ix->node[i] = (OrdNode){ ORD_NONE, ORD_NONE, ord_key(ix, (int)i) };
+        v[i] = (uint32_t)i;
+    }
+    g_ord_sort = ix;
+    qsort(v, n, sizeof *v, ord_cmp);
+    size_t top = 0; /* right spine, priorities decreasing */
+    for (size_t k = 0; k < n; k++) {
+        uint32_t x = v[k], last = ORD_NONE;
+        while (top && ord_prio((int)stack[top - 1]) < ord_prio((int)x)) last = stack[--top];
+        ix->node[x].l = last;
+        if (top) ix->node[stack[top - 1]].r = x;
+        stack[top++] = x;
+    }
+    ix->root = top ? stack[0] : ORD_NONE;
+    free(v);
+    free(stack);
+    return true;
+}
+
+/* Item i's quantity or price changed. Safe under the shared gate. */
+static void ord_touch(int i) {
+    if (!g_ord.built) return;
+    if (!atomic_exchange_explicit(&g_ord.dirty[i], 1, memory_order_relaxed))
+        g_ord.dlist[atomic_fetch_add_explicit(&g_ord.nd, 1, memory_order_relaxed)] = i;
+}
+
+/*
+ * Re-file the touched items. Needs the store exclusively. A position
+ * stays listed (and marked) after its item is removed; it is skipped
+ * here if the store has not grown back over it.
+ */
+static void ord_sync(void) {
+    size_t nd = atomic_load_explicit(&g_ord.nd, memory_order_relaxed);
+    for (size_t k = 0; k < nd; k++) {
+        int i = g_ord.dlist[k];
+        atomic_store_explicit(&g_ord.dirty[i], 0, memory_order_relaxed);
+        if (i >= g_count) continue;
+        for (OrdIndex *ix = &g_ord.qty; ix; ix = ix == &g_ord.qty ? &g_ord.price : NULL) {
+            int64_t key = ord_key(ix, i);
+            if (key == ix->node[i].key) continue;
+            ord_erase(ix, (uint32_t)i);
+            ix->node[i] = (OrdNode){ ORD_NONE, ORD_NONE, key };
+            ord_insert(ix, (uint32_t)i);
+        }
+    }
+    atomic_store_explicit(&g_ord.nd, 0, memory_order_relaxed);
+}
+
+/* Item g_count - 1 was just appended. */
+static void ord_note_add(void) {
+    if (!g_ord.built) return;
+    uint32_t i = (uint32_t)g_count - 1;
+    if (!ord_reserve((size_t)g_count)) { ord_free(); return; }
+    g_ord.qty.node[i]   = (OrdNode){ ORD_NONE, ORD_NONE, ord_key(&g_ord.qty, (int)i) };
+    g_ord.price.node[i] = (OrdNode){ ORD_NONE, ORD_NONE, ord_key(&g_ord.price, (int)i) };
+    ord_insert(&g_ord.qty, i);
+    ord_insert(&g_ord.price, i);
+}
+
+/*
+ * Item idx is being removed and item `last` moved into its place. Safe
+ * under the shared gate with both items held (serve_shape()): the
+ * trees are only read by the exclusive reports, and concurrent
+ * ord_touch() calls only list other items.
+ */
+static void ord_note_del(int idx, int last) {
+    if (!g_ord.built) return;
+    for (OrdIndex *ix = &g_ord.qty; ix; ix = ix == &g_ord.qty ? &g_ord.price : NULL) {
+        ord_erase(ix, (uint32_t)idx);
+        if (idx == last) continue;
+        *ord_link(ix, (uint32_t)last) = (uint32_t)idx;
+        ix->node[idx] = ix->node[last];
+    }
+    if (idx != last && atomic_load_explicit(&g_ord.dirty[last], memory_order_relaxed))
+        ord_touch(idx); /* the moved item still needs re-filing */
+}
+
+/* Append the filed items with lo <= key <= hi in subtree t, in order.
+ * Returns false when memory is short. */
+static bool ord_walk(const OrdIndex *ix, uint32_t t, int64_t lo, int64_t hi,
+                     int **v, size_t *n, size_t *cap) {
+    while (t != ORD_NONE) {
+        const OrdNode *nd = &ix->node[t];
+        if (nd->key < lo) { t = nd->r; continue; }
+        if (nd->key > hi) { t = nd->l; continue; }
+        if (!ord_walk(ix, nd->l, lo, hi, v, n, cap)) return false;
+        if (*n == *cap) {
+            size_t nc = *cap ? *cap * 2 : 256;
+            int   *nv = realloc(*v, nc * sizeof *nv);
+            if (!nv) return false;
+            *v = nv; *cap = nc;
+        }
+        (*v)[(*n)++] = (int)t;
+        t = nd->r;
+    }
+    return true;
+}
+
+/*
+ * ord_range
+ *   Positions of the items whose quantity (by_price false) or price in
+ *   cents lies in [lo, hi], ordered by it: *v receives a malloc'd array
+ *   of *n entries (NULL when there are none). Needs the store
+ *   exclusively. Returns false when memory is short.
+ */
+static bool ord_range(bool by_price, int64_t lo, int64_t hi, int **v, size_t *n) {
+    *v = NULL;
+    *n = 0;
+    if (!g_ord.built) {
+        if (!ord_reserve((size_t)g_count) || !ord_build(&g_ord.qty) || !ord_build(&g_ord.price)) {
+            ord_free();
+            return false;
+        }
+        g_ord.built = true;
+    }
+    ord_sync();
+    size_t cap = 0;
+    const OrdIndex *ix = by_price ? &g_ord.price : &g_ord.qty;
+    if (ord_walk(ix, ix->root, lo, hi, v, n, &cap)) return true;
+    free(*v);
+    *v = NULL;
+    *n = 0;
+    return false;
+}
+
+/*
+ * store_append
+ *   Appends a validated, not-yet-present record at the end of the store.
+ *   `slot` is the empty slot index_probe() returned for it after
+ *   index_reserve_for() and store_reserve() succeeded.
+ *   Returns false when the name pool is out of memory.
+ */
+static bool store_append(const char *name, size_t len, uint32_t hash, IndexSlot *slot,
+                         int32_t qty, Money price) {
+    uint32_t handle = name_intern(name, len);
+    if (handle == NAME_NONE) return false;
+    snap_touch_item(g_count); /* as in item_copy() */
+    ITEM_OWN(g_count);
+    ITEM_NAME(g_count)  = handle;
+    ITEM_LEN(g_count)   = (uint32_t)len;
+    ITEM_QTY(g_count)   = qty;
+    ITEM_PRICE(g_count) = price;
+    ITEM_HASH(g_count)  = hash;
+    if (g_seq_next == UINT32_MAX) { seq_renumber(); ord_free(); } /* filed by seq */
+    ITEM_SEQ(g_count)   = g_seq_next++;
+    index_fill(slot, hash, g_count);
+    g_count++;
+    stat_items();
+    totals_add(qty, qty * price);
+    search_note_add(name, len);
+    ord_note_add();
+    return true;
+}
+
+/* Set item idx to (qty, price), keeping the running totals. */
+static void item_set(int idx, int32_t qty, Money price) {
+    totals_add((int64_t)qty - ITEM_QTY(idx), qty * price - ITEM_QTY(idx) * ITEM_PRICE(idx));
+    ITEM_OWN(idx);
+    ITEM_QTY(idx)   = qty;
+    ITEM_PRICE(idx) = price;
+    ord_touch(idx);
+}
+
+/*
+ * store_delete
+ *   Removes the item whose index entry is `slot` in O(1): the last item
+ *   moves into the gap and its index entry is repointed. Store order is
+ *   therefore not insertion order; ITEM_SEQ keeps that (see store_view()).
+ */
+static void store_delete(IndexSlot *slot) {
+    int idx = slot->idx, last = g_count - 1;
+    snap_touch_item(last); /* its fields move to idx, already checked */
+    search_note_del(name_str(ITEM_NAME(idx)), ITEM_LEN(idx));
+    index_remove(slot);
+    totals_add(-(int64_t)ITEM_QTY(idx), -ITEM_QTY(idx) * ITEM_PRICE(idx));
+    g_name_dead += ITEM_LEN(idx) + 1;
+    g_name_live -= ITEM_LEN(idx) + 1;
+    ord_note_del(idx, last);
+    if (idx != last) {
+        index_slot_of(last)->idx = idx;
+        item_copy(idx, last);
+    }
+    g_count--;
+    stat_items();
+    name_pool_compact();
+}
+
+/*
+ * store_put
+ *   Sets `name` to exactly (qty, price), creating it if absent. Does no
+ *   validation and prints nothing but out-of-memory errors: it replays
+ *   changes that were checked when first made. Returns false when full.
+ */
+static bool store_put(const char *name, size_t len, int32_t qty, Money price) {
+    uint32_t hash = name_hash(name, len);
+    if (!index_reserve_for(hash)) return false;
+    IndexSlot *slot = index_probe(name, len, hash);
+    if (slot->idx >= 0) { item_set(slot->idx, qty, price); return true; }
+    return store_reserve((size_t)g_count + 1) &&
+           store_append(name, len, hash, slot, qty, price);
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  File I/O
+ * ══════════════════════════════════════════════════════════════ */
+
+/*
+ * FileView: access to a whole file. Regular files are memory-mapped;
+ * anything that cannot be mapped is read into a heap buffer instead, so
+ * callers always see one contiguous byte range. A copy-on-write view
+ * may be modified in memory without affecting the file.
+ */
+typedef struct {
+    const char *data;   /* file contents (not NUL-terminated) */
+    size_t      len;    /* byte count                         */
+    void       *base;   /* mapping or heap block to release   */
+    bool        mapped; /* base came from the OS mapper        */
+} FileView;
+
+/*
+ * Open `path` as a FileView, read-only or (cow) copy-on-write.
+ * Returns false with errno set on failure.
+ */
+static bool file_view_open(const char *path, FileView *fv, bool cow) {
+    memset(fv, 0, sizeof *fv);
+    fv->data = "";
+#ifdef _WIN32
+    HANDLE fh = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (fh == INVALID_HANDLE_VALUE) {
+        DWORD e = GetLastError();
+        errno = (e == ERROR_FILE_NOT_FOUND || e == ERROR_PATH_NOT_FOUND) ? ENOENT : EACCES;
+        return false;
+    }
+    LARGE_INTEGER sz;
+    if (!GetFileSizeEx(fh, &sz)) { CloseHandle(fh); errno = EIO; return false; }
+    if (sz.QuadPart == 0) { CloseHandle(fh); return true; }
+    HANDLE mh = CreateFileMappingA(fh, NULL, cow ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+    void *base = mh ? MapViewOfFile(mh, cow ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (mh) CloseHandle(mh);
+    CloseHandle(fh);
+    if (!base) { errno = ENOMEM; return false; }
+    fv->base = base; fv->mapped = true;
+    fv->data = base; fv->len = (size_t)sz.QuadPart;
+    return true;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) { close(fd); return true; }
+        int prot = cow ? PROT_READ | PROT_WRITE : PROT_READ;
+        void *base = mmap(NULL, (size_t)st.st_size, prot, MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED) {
+#ifdef POSIX_MADV_SEQUENTIAL
+            if (!cow) posix_madvise(base, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+#endif
+            close(fd);
+            fv->base = base; fv->mapped = true;
+            fv->data = base; fv->len = (size_t)st.st_size;
+            return true;
+        }
+    }
+    /* Not mappable (pipe, special file, ...): slurp it. */
+    size_t cap = 1 << 16, len = 0;
+    char *buf = malloc(cap);
+    for (;;) {
+        if (!buf) { close(fd); errno = ENOMEM; return false; }
+        if (len == cap) {
+            char *nb = realloc(buf, cap * 2);
+            if (!nb) { free(buf); buf = NULL; continue; }
+            buf = nb; cap *= 2;
+        }
+        ssize_t r = read(fd, buf + len, cap - len);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            int e = errno; free(buf); close(fd); errno = e; return false;
+        }
+        if (r == 0) break;
+        len += (size_t)r;
+    }
+    close(fd);
+    fv->base = buf; fv->data = buf; fv->len = len;
+    return true;
+#endif
+}
+
+static void file_view_close(FileView *fv) {
+    if (!fv->base) return;
+#ifdef _WIN32
+    UnmapViewOfFile(fv->base);
+#else
+    if (fv->mapped) munmap(fv->base, fv->len);
+    else            free(fv->base);
+#endif
+    fv->base = NULL;
+}
+
+/*
+ * FileAhead: reads a mapped view ahead of its parser. A helper thread
+ * touches one byte per page from the start, so the page faults (reads,
+ * on network storage often most of a load) happen there while the
+ * caller parses the pages before them, instead of each stalling the
+ * parse in turn.
+ */
+typedef struct {
+    const char *p;
+    size_t      n;
+    atomic_bool stop;
+    Thread      th;
+    TaskArg     arg;
+    bool        started;
+} FileAhead;
+
+static void file_ahead_task(void *ctx, int worker) {
+    (void)worker;
+    FileAhead *a = ctx;
+    volatile char sink = 0;
+    for (size_t at = 0; at < a->n; at += FILE_AHEAD_PAGE) {
+        if ((at & (LOAD_PAR_MIN - 1)) == 0 && atomic_load_explicit(&a->stop, memory_order_relaxed))
+            break;
+        sink = a->p[at];
+    }
+    (void)sink;
+}
+
+/* Start reading `fv` ahead when it is mapped and at least LOAD_PAR_MIN bytes. */
+static void file_ahead_start(FileAhead *a, const FileView *fv) {
+    memset(a, 0, sizeof *a);
+    if (!fv->mapped || fv->len < LOAD_PAR_MIN) return;
+    a->p   = fv->data;
+    a->n   = fv->len;
+    a->arg = (TaskArg){ file_ahead_task, a, 0 };
+    a->started = thread_start(&a->th, &a->arg);
+}
+
+/* Stop the read-ahead; call before the view is closed. */
+static void file_ahead_stop(FileAhead *a) {
+    if (!a->started) return;
+    atomic_store(&a->stop, true);
+    thread_join(a->th);
+    a->started = false;
+}
+
+/*
+ * CSV record scanning. Fields are parsed in place as [begin, end)
+ * spans of the source buffer; nothing is copied until a record is
+ * committed. The rules match the original fgets/strtok/strtol/strtod
+ * loader: fields are split on runs of commas, trimmed, and anything
+ * after the third field is ignored.
+ */
+typedef enum {
+    CSV_BLANK,       /* empty line or comment          */
+    CSV_OK,          /* row holds a valid record        */
+    CSV_MALFORMED,   /* fewer than three fields         */
+    CSV_BAD_NAME,    /* empty name                      */
+    CSV_BAD_QTY,     /* quantity not in 0..INT32_MAX    */
+    CSV_BAD_PRICE    /* price not in 0..1e9             */
+} CsvStatus;
+
+typedef struct {
+    const char *name;     size_t name_len;
+    int32_t     qty;
+    Money       price;
+    const char *bad;      int    bad_len;  /* text quoted by warnings */
+} CsvRow;
+
+static inline bool is_space(char c) { return isspace((unsigned char)c) != 0; }
+
+static void span_trim(const char **b, const char **e) {
+    while (*b < *e && is_space(**b))     (*b)++;
+    while (*e > *b && is_space((*e)[-1])) (*e)--;
+}
+
+/*
+ * Base-10 integer in [0, max], strtol-compatible on whole fields:
+ * optional sign, digits; an empty field reads as 0 as strtol() did.
+ * Commands take at most 1000000 units at a time; a stored stock, which
+ * restocks can take up to INT32_MAX, is read back in full.
+ */
+static bool scan_qty_max(const char *b, const char *e, long max, int32_t *out) {
+    if (b == e) { *out = 0; return true; }
+    bool neg = false;
+    if (*b == '+' || *b == '-') { neg = (*b == '-'); b++; }
+    if (b == e) return false;
+    long v = 0;
+    for (; b < e; b++) {
+        if (*b < '0' || *b > '9') return false;
+        v = v * 10 + (*b - '0');
+        if (v > max) return false;
+    }
+    if (neg && v != 0) return false;
+    *out = (int32_t)v;
+    return true;
+}
+
+static bool scan_qty(const char *b, const char *e, int32_t *out) {
+    return scan_qty_max(b, e, 1000000, out);
+}
+
+/* Decimal price in [0, 1e9], as money_scan() reads it; an empty field is 0. */
+static bool scan_price(const char *b, const char *e, Money *out) {
+    Money v = 0;
+    if (b != e && !money_scan(b, e, &v)) return false;
+    if (v < 0 || v > MONEY_MAX) return false;
+    *out = v;
+    return true;
+}
+
+/*
+ * Scan one line [b, e) (no terminator) into `row`, taking a quantity of
+ * at most `qty_max`: INT32_MAX for stored stock, 1000000 for a command.
+ */
+static CsvStatus csv_scan_line(const char *b, const char *e, long qty_max, CsvRow *row) {
+    span_trim(&b, &e);
+    if (b == e || *b == '#') return CSV_BLANK;
+
+    const char *fb[3], *fe[3];
+    int nf = 0;
+    for (const char *p = b; nf < 3; ) {
+        while (p < e && *p == ',') p++;
+        if (p == e) break;
+        const char *q = memchr(p, ',', (size_t)(e - p));
+        if (!q) q = e;
+        fb[nf] = p; fe[nf] = q; nf++;
+        p = q;
+    }
+    if (nf < 3) { row->bad = b; row->bad_len = (int)(e - b); return CSV_MALFORMED; }
+    for (int f = 0; f < 3; f++) span_trim(&fb[f], &fe[f]);
+
+    row->name = fb[0]; row->name_len = (size_t)(fe[0] - fb[0]);
+    if (row->name_len == 0) return CSV_BAD_NAME;
+    if (!scan_qty_max(fb[1], fe[1], qty_max, &row->qty)) {
+        row->bad = fb[1]; row->bad_len = (int)(fe[1] - fb[1]); return CSV_BAD_QTY;
+    }
+    if (!scan_price(fb[2], fe[2], &row->price)) {
+        row->bad = fb[2]; row->bad_len = (int)(fe[2] - fb[2]); return CSV_BAD_PRICE;
+    }
+    return CSV_OK;
+}
+
+/* Print the per-line warning for a rejected record. */
+static void csv_warn(CsvStatus st, int lineno, const CsvRow *row) {
+    switch (st) {
+        case CSV_MALFORMED:
+            fprintf(stderr, "[WARN] Line %d: malformed record (skipped): %.*s\n",
+                    lineno, row->bad_len, row->bad); break;
+        case CSV_BAD_NAME:
+            fprintf(stderr, "[WARN] Line %d: invalid name length (skipped).\n", lineno); break;
+        case CSV_BAD_QTY:
+            fprintf(stderr, "[WARN] Line %d: invalid quantity '%.*s' (skipped).\n",
+                    lineno, row->bad_len, row->bad); break;
+        case CSV_BAD_PRICE:
+            fprintf(stderr, "[WARN] Line %d: invalid price '%.*s' (skipped).\n",
+                    lineno, row->bad_len, row->bad); break;
+        default: break;
+    }
+}
+
+/*
+ * Empty the store, index and name pool ahead of a (re)load. With
+ * `release` the chunks and index tables are freed too, returning their
+ * bytes to the --mem-limit budget.
+ */
+static void store_clear(bool release) {
+    version_quiesce();
+    g_count = 0;
+    stat_items();
+    g_seq_next = 0;
+    g_total_cents = g_total_units = 0;
+    search_free();
+    ord_free();
+    name_pool_reset();
+    index_clear();
+    atomic_store(&g_lazy.left, 0); /* nothing left to read unchecked */
+    atomic_store(&g_lazy.shard_unchecked, 0);
+    atomic_store(&g_lazy.damaged, false);
+    if (!release) return;
+    for (size_t c = 0; c < g_chunk_cnt; c++) mem_free(g_chunks[c], sizeof **g_chunks);
+    mem_free(g_chunks, g_chunk_dir * sizeof *g_chunks);
+    mem_free(g_chunk_epoch, g_chunk_dir * sizeof *g_chunk_epoch);
+    g_chunks = NULL; g_chunk_epoch = NULL; g_chunk_cnt = g_chunk_dir = 0;
+    for (int sh = 0; sh < INDEX_SHARDS; sh++) {
+        mem_free(g_shards[sh].tab, g_shards[sh].cap * sizeof *g_shards[sh].tab);
+        stat_slots(0 - g_shards[sh].cap);
+        g_shards[sh] = (IndexShard){ NULL, 0, 0 };
+    }
+}
+
+/*
+ * load_serial
+ *   Loads [p, end) on the calling thread. Hitting the memory limit keeps
+ *   the records that fit so far and ignores the rest.
+ */
+static void load_serial(const char *p, const char *end) {
+    /* Size the index once for the worst case (every line a record). */
+    size_t lines = 1;
+    for (const char *q = p; (q = memchr(q, '\n', (size_t)(end - q))) != NULL; q++) lines++;
+    index_presize(lines);
+
+    int  lineno = 0;
+    bool full   = false;
+    while (p < end && !full) {
+        /*
+         * Scan a batch of lines first and prefetch the home slot of each
+         * record, so the index cache misses overlap instead of being
+         * taken one at a time; then commit the batch in line order.
+         */
+        CsvRow    row[LOAD_BATCH];
+        CsvStatus st[LOAD_BATCH];
+        int       line[LOAD_BATCH];
+        uint32_t  hash[LOAD_BATCH];
+        int n = 0;
+        while (p < end && n < LOAD_BATCH) {
+            const char *eol = memchr(p, '\n', (size_t)(end - p));
+            if (!eol) eol = end;
+            lineno++;
+            st[n] = csv_scan_line(p, eol, INT32_MAX, &row[n]);
+            p = eol + (eol < end);
+            if (st[n] == CSV_BLANK) continue;
+            if (st[n] == CSV_OK) {
+                hash[n] = name_hash(row[n].name, row[n].name_len);
+                PREFETCH(index_home(hash[n]));
+            }
+            line[n++] = lineno;
+        }
+
+        for (int k = 0; k < n; k++) {
+            if (st[k] != CSV_OK) { csv_warn(st[k], line[k], &row[k]); continue; }
+
+            IndexShard *sh = index_shard(hash[k]);
+            if (!store_reserve((size_t)g_count + 1) || !shard_reserve(sh, sh->used + 1)) {
+                full = true; break;
+            }
+
+            /* Skip duplicates */
+            IndexSlot *slot = index_probe(row[k].name, row[k].name_len, hash[k]);
+            if (slot->idx >= 0) {
+                fprintf(stderr, "[WARN] Line %d: duplicate name '%.*s' (skipped).\n",
+                        line[k], (int)row[k].name_len, row[k].name);
+                continue;
+            }
+
+            /* Commit record */
+            if (!store_append(row[k].name, row[k].name_len, hash[k], slot,
+                              row[k].qty, row[k].price)) {
+                full = true; break;
+            }
+        }
+    }
+    if (full)
+        fprintf(stderr, "[WARN] Memory limit (%zu bytes) reached; remaining lines ignored.\n",
+                g_mem_limit);
+}
+
+/* ─── Parallel load ───────────────────────────────────────────── */
+/*
+ * The file is cut at newline boundaries into one part per worker and
+ * loaded in phases, each a parallel_run():
+ *   scan   – parse and hash the part's lines into thread-local records,
+ *            bucketed by the index shard group that owns their hash;
+ *   dedup  – each worker owns the shards s with s % nparts == w and
+ *            inserts its records part by part, i.e. in file order, so
+ *            the first occurrence wins. Entries temporarily hold the
+ *            record's global ordinal instead of a store position;
+ *   rank   – number each part's surviving records;
+ *   fill   – copy survivors to their final store positions, intern their
+ *            names through a per-worker cursor, and rewrite the owned
+ *            shards' ordinals into positions.
+ * Warnings are then printed in line order from the saved records, with
+ * per-part line numbers offset by the line counts of earlier parts.
+ */
+typedef struct {
+    const char *name;
+    uint32_t    name_len;
+    uint32_t    hash;
+    Money       price;
+    int32_t     qty;
+    int32_t     line;   /* line number within the part          */
+    int32_t     pos;    /* survivor rank in the part, -1 = duplicate */
+} LoadRec;
+
+typedef struct {
+    CsvStatus st;
+    int32_t   line;
+    CsvRow    row;
+} LoadBad;
+
+typedef struct {
+    const char *begin, *end;
+    int32_t     lines;
+    LoadRec    *rec;  size_t nrec, caprec;
+    LoadBad    *bad;  size_t nbad, capbad;
+    uint32_t   *grp[MAX_LOAD_THREADS];   /* rec indices per shard group */
+    size_t      ngrp[MAX_LOAD_THREADS], capgrp[MAX_LOAD_THREADS];
+    int32_t     first_ord;  /* global ordinal of rec[0]              */
+    int32_t     first_pos;  /* store position of the first survivor  */
+    int32_t     survivors;
+    int64_t     units, cents;
+    size_t      name_bytes;
+    bool        failed;     /* a worker ran out of memory            */
+} LoadPart;
+
+typedef struct {
+    LoadPart *part;
+    int       nparts;
+} LoadJob;
+
+static void load_task_scan(void *ctx, int w) {
+    LoadJob  *job = ctx;
+    LoadPart *pt  = &job->part[w];
+    const char *p = pt->begin, *end = pt->end;
+    int lineno = 0;
+    if (!vec_reserve(&pt->rec, &pt->caprec, (size_t)(end - p) / 24 + 1, sizeof *pt->rec))
+        pt->failed = true;
+    while (p < end && !pt->failed) {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (!eol) eol = end;
+        lineno++;
+        CsvRow row;
+        CsvStatus st = csv_scan_line(p, eol, INT32_MAX, &row);
+        p = eol + (eol < end);
+        if (st == CSV_BLANK) continue;
+        if (st != CSV_OK) {
+            if (!vec_reserve(&pt->bad, &pt->capbad, pt->nbad + 1, sizeof *pt->bad)) { pt->failed = true; break; }
+            pt->bad[pt->nbad++] = (LoadBad){ st, lineno, row };
+            continue;
+        }
+        if (pt->nrec > INT32_MAX - 1 ||
+            !vec_reserve(&pt->rec, &pt->caprec, pt->nrec + 1, sizeof *pt->rec)) { pt->failed = true; break; }
+        uint32_t hash = name_hash(row.name, row.name_len);
+        int g = (int)(hash >> (32 - INDEX_SHARD_BITS)) % job->nparts;
+        if (!vec_reserve(&pt->grp[g], &pt->capgrp[g], pt->ngrp[g] + 1, sizeof *pt->grp[g])) { pt->failed = true; break; }
+        pt->grp[g][pt->ngrp[g]++] = (uint32_t)pt->nrec;
+        pt->rec[pt->nrec++] = (LoadRec){ row.name, (uint32_t)row.name_len, hash, row.price,
+                                         row.qty, lineno, 0 };
+    }
+    pt->lines = lineno;
+}
+
+/* Part holding the record with global ordinal `ord`. */
+static LoadPart *load_part_of(LoadJob *job, int32_t ord) {
+    int lo = 0, hi = job->nparts - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (job->part[mid].first_ord <= ord) lo = mid; else hi = mid - 1;
+    }
+    return &job->part[lo];
+}
+
+static LoadRec *load_rec(LoadJob *job, int32_t ord) {
+    LoadPart *pt = load_part_of(job, ord);
+    return &pt->rec[ord - pt->first_ord];
+}
+
+static void load_task_dedup(void *ctx, int w) {
+    LoadJob *job = ctx;
+    for (int c = 0; c < job->nparts; c++) {
+        LoadPart *pt = &job->part[c];
+        for (size_t k = 0; k < pt->ngrp[w]; k++) {
+            LoadRec    *r  = &pt->rec[pt->grp[w][k]];
+            IndexShard *sh = index_shard(r->hash);
+            if (!shard_reserve(sh, sh->used + 1)) { job->part[w].failed = true; return; }
+            size_t mask = sh->cap - 1, i = r->hash & mask;
+            for (; sh->tab[i].idx >= 0; i = (i + 1) & mask) {
+                if (sh->tab[i].hash != r->hash) continue;
+                const LoadRec *o = load_rec(job, sh->tab[i].idx);
+                if (o->name_len == r->name_len &&
+                    strncasecmp(o->name, r->name, r->name_len) == 0)
+                    break;
+            }
+            if (sh->tab[i].idx >= 0) { r->pos = -1; continue; }
+            sh->tab[i].hash = r->hash;
+            sh->tab[i].idx  = pt->first_ord + (int32_t)pt->grp[w][k];
+            sh->used++;
+        }
+    }
+}
+
+static void load_task_rank(void *ctx, int w) {
+    LoadPart *pt = &((LoadJob *)ctx)->part[w];
+    int32_t rank = 0;
+    for (size_t j = 0; j < pt->nrec; j++) {
+        LoadRec *r = &pt->rec[j];
+        if (r->pos < 0) continue;
+        r->pos  = rank++;
+        pt->units += r->qty;
+        pt->cents += r->qty * r->price;
+        pt->name_bytes += r->name_len + 1;
+    }
+    pt->survivors = rank;
+}
+
+static void load_task_fill(void *ctx, int w) {
+    LoadJob  *job = ctx;
+    LoadPart *pt  = &job->part[w];
+    NameCursor cur = { 0, 0, 0 };
+    for (size_t j = 0; j < pt->nrec; j++) {
+        const LoadRec *r = &pt->rec[j];
+        if (r->pos < 0) continue;
+        int i = pt->first_pos + r->pos;
+        uint32_t h = name_intern_at(&cur, r->name, r->name_len);
+        if (h == NAME_NONE) { pt->failed = true; break; }
+        ITEM_NAME(i)  = h;
+        ITEM_LEN(i)   = r->name_len;
+        ITEM_QTY(i)   = r->qty;
+        ITEM_PRICE(i) = r->price;
+        ITEM_HASH(i)  = r->hash;
+        ITEM_SEQ(i)   = (uint32_t)i;
+    }
+    for (int s = w; s < INDEX_SHARDS; s += job->nparts) {
+        IndexShard *sh = &g_shards[s];
+        for (size_t i = 0; i < sh->cap; i++) {
+            if (sh->tab[i].idx < 0) continue;
+            int32_t ord = sh->tab[i].idx;
+            const LoadPart *op = load_part_of(job, ord);
+            sh->tab[i].idx = op->first_pos + op->rec[ord - op->first_ord].pos;
+        }
+    }
+}
+
+/* Print a part's warnings in line order. */
+static void load_part_warn(const LoadPart *pt, int line_base) {
+    size_t b = 0;
+    for (size_t j = 0; j <= pt->nrec; j++) {
+        int32_t dup_line = j < pt->nrec ? pt->rec[j].line : INT32_MAX;
+        for (; b < pt->nbad && pt->bad[b].line < dup_line; b++)
+            csv_warn(pt->bad[b].st, line_base + pt->bad[b].line, &pt->bad[b].row);
+        if (j < pt->nrec && pt->rec[j].pos < 0)
+            fprintf(stderr, "[WARN] Line %d: duplicate name '%.*s' (skipped).\n",
+                    line_base + pt->rec[j].line, (int)pt->rec[j].name_len, pt->rec[j].name);
+    }
+}
+
+/*
+ * load_parallel
+ *   Loads [begin, end) with n worker threads. Returns false, leaving the
+ *   store in an undefined state, if any worker runs out of memory; the
+ *   caller then clears the store and falls back to load_serial(), which
+ *   knows how to stop cleanly at the memory limit.
+ */
+static bool load_parallel(const char *begin, const char *end, int n) {
+    LoadJob job = { calloc((size_t)n, sizeof(LoadPart)), n };
+    if (!job.part) return false;
+
+    const char *cut = begin;
+    for (int w = 0; w < n; w++) {
+        job.part[w].begin = cut;
+        if (w == n - 1) {
+            cut = end;
+        } else {
+            const char *target = begin + (size_t)(end - begin) / (size_t)n * (size_t)(w + 1);
+            if (target < cut) target = cut;
+            const char *nl = memchr(target, '\n', (size_t)(end - target));
+            cut = nl ? nl + 1 : end;
+        }
+        job.part[w].end = cut;
+    }
+
+    bool ok = true;
+    parallel_run(n, load_task_scan, &job);
+    int64_t nrec = 0;
+    for (int w = 0; w < n; w++) {
+        ok = ok && !job.part[w].failed;
+        job.part[w].first_ord = (int32_t)nrec;
+        nrec += (int64_t)job.part[w].nrec;
+    }
+    ok = ok && nrec <= INT32_MAX && index_presize((size_t)nrec);
+
+    if (ok) {
+        parallel_run(n, load_task_dedup, &job);
+        for (int w = 0; w < n; w++) ok = ok && !job.part[w].failed;
+    }
+    if (ok) {
+        parallel_run(n, load_task_rank, &job);
+        int32_t total = 0;
+        for (int w = 0; w < n; w++) { job.part[w].first_pos = total; total += job.part[w].survivors; }
+        ok = store_reserve((size_t)total);
+        if (ok) {
+            parallel_run(n, load_task_fill, &job);
+            for (int w = 0; w < n; w++) ok = ok && !job.part[w].failed;
+        }
+        if (ok) {
+            int line_base = 0;
+            for (int w = 0; w < n; w++) {
+                LoadPart *pt = &job.part[w];
+                load_part_warn(pt, line_base);
+                line_base     += pt->lines;
+                totals_add(pt->units, pt->cents);
+                g_name_live   += pt->name_bytes;
+            }
+            g_count = total;
+            g_seq_next = (uint32_t)total;
+            g_name_cur.end = 0; /* later names start a fresh block */
+        }
+    }
+
+    for (int w = 0; w < n; w++) {
+        free(job.part[w].rec);
+        free(job.part[w].bad);
+        for (int g = 0; g < n; g++) free(job.part[w].grp[g]);
+    }
+    free(job.part);
+    return ok;
+}
+
+/*
+ * load_inventory
+ *   Reads CSV rows from INVENTORY_FILE into the item store. The file is
+ *   mapped and scanned in place while a FileAhead pages it in; with
+ *   --load-threads above 1, files of LOAD_PAR_MIN bytes or more are
+ *   parsed by several threads.
+ *   A missing file is treated as an empty inventory (not an error).
+ *   Returns true on success.
+ */
+static bool load_inventory(void) {
+    uint64_t t0 = stat_begin();
+    FileView fv;
+    if (!file_view_open(INVENTORY_FILE, &fv, false)) {
+        if (errno == ENOENT) {
+            printf("[INFO] '%s' not found – starting with empty inventory.\n",
+                   INVENTORY_FILE);
+            return true;
+        }
+        fprintf(stderr, "[ERROR] Cannot open '%s': %s\n",
+                INVENTORY_FILE, strerror(errno));
+        return false;
+    }
+
+    int threads = g_load_threads > 0 ? g_load_threads : cpu_count();
+    if (threads > MAX_LOAD_THREADS) threads = MAX_LOAD_THREADS;
+    if (fv.len < LOAD_PAR_MIN) threads = 1;
+
+    FileAhead ahead;
+    file_ahead_start(&ahead, &fv);
+    store_clear(false);
+    if (threads <= 1 || !load_parallel(fv.data, fv.data + fv.len, threads)) {
+        store_clear(threads > 1);
+        load_serial(fv.data, fv.data + fv.len);
+    }
+    file_ahead_stop(&ahead);
+
+    file_view_close(&fv);
+    stat_items();
+    totals_check("load");
+    stat_end(STAT_LOAD, t0);
+    printf("[INFO] Loaded %d item(s) from '%s'.\n", g_count, INVENTORY_FILE);
+    return true;
+}
+
+/*
+ * SysFile: an unbuffered OS file handle, for the writers below that
+ * manage their own buffering and need explicit syncs.
+ */
+#ifdef _WIN32
+typedef HANDLE SysFile;
+#define SYS_FILE_NONE INVALID_HANDLE_VALUE
+#else
+typedef int SysFile;
+#define SYS_FILE_NONE (-1)
+#endif
+
+/*
+ * Open `path` for writing: truncated (append = false) or positioned at
+ * its end and created if missing (append = true). Returns SYS_FILE_NONE
+ * with errno set on failure.
+ */
+static SysFile sys_open_write(const char *path, bool append) {
+#ifdef _WIN32
+    HANDLE h = CreateFileA(path, GENERIC_WRITE,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+                           append ? OPEN_ALWAYS : CREATE_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (h == INVALID_HANDLE_VALUE) { errno = EACCES; return h; }
+    LARGE_INTEGER zero = { 0 };
+    if (append) SetFilePointerEx(h, zero, NULL, FILE_END);
+    return h;
+#else
+    return open(path, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0666);
+#endif
+}
+
+static bool sys_write_all(SysFile f, const void *data, size_t n) {
+    const char *p = data;
+    while (n > 0) {
+#ifdef _WIN32
+        DWORD w = 0, part = n > (1u << 30) ? (1u << 30) : (DWORD)n;
+        if (!WriteFile(f, p, part, &w, NULL) || w == 0) return false;
+#else
+        ssize_t w = write(f, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+#endif
+        p += w; n -= (size_t)w;
+    }
+    return true;
+}
+
+/* Write n bytes at offset `at` (the file position afterwards is unspecified). */
+static bool sys_write_at(SysFile f, uint64_t at, const void *data, size_t n) {
+#ifdef _WIN32
+    const char *p = data;
+    while (n > 0) {
+        OVERLAPPED ov;
+        memset(&ov, 0, sizeof ov);
+        ov.Offset     = (DWORD)at;
+        ov.OffsetHigh = (DWORD)(at >> 32);
+        DWORD w = 0, part = n > (1u << 30) ? (1u << 30) : (DWORD)n;
+        if (!WriteFile(f, p, part, &w, &ov) || w == 0) return false;
+        p += w; n -= w; at += w;
+    }
+    return true;
+#else
+    const char *p = data;
+    while (n > 0) {
+        ssize_t w = pwrite(f, p, n, (off_t)at);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w; n -= (size_t)w; at += (uint64_t)w;
+    }
+    return true;
+#endif
+}
+
+/* Cut the file to `len` bytes. */
+static bool sys_truncate(SysFile f, uint64_t len) {
+#ifdef _WIN32
+    LARGE_INTEGER pos; pos.QuadPart = (LONGLONG)len;
+    return SetFilePointerEx(f, pos, NULL, FILE_BEGIN) && SetEndOfFile(f);
+#else
+    return ftruncate(f, (off_t)len) == 0;
+#endif
+}
+
+static bool sys_sync(SysFile f) {
+#ifdef _WIN32
+    return FlushFileBuffers(f) != 0;
+#else
+    return fsync(f) == 0;
+#endif
+}
+
+static bool sys_close(SysFile f) {
+#ifdef _WIN32
+    return CloseHandle(f) != 0;
+#else
+    return close(f) == 0;
+#endif
+}
+
+/* Atomically rename `tmp` over `path` and make the rename durable. */
+static bool sys_replace(const char *tmp, const char *path) {
+#ifdef _WIN32
+    return MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    if (rename(tmp, path) != 0) return false;
+    int dfd = open(".", O_RDONLY);
+    if (dfd >= 0) { fsync(dfd); close(dfd); }
+    return true;
+#endif
+}
+
+/*
+ * AfileWriter: the background half of an AtomicFile. Once a file
+ * outgrows its first SAVE_BUF buffer, full buffers are handed to a
+ * writer thread and formatting carries on in a second buffer, so the
+ * caller only waits for the disk when it gets a whole buffer ahead.
+ * Smaller files are written on the caller's thread.
+ */
+typedef struct {
+    Mutex       lock;
+    Cond        cv;
+    const char *p;      /* buffer being written, while busy */
+    size_t      n;
+    bool        busy;
+    bool        stop;
+    bool        err;    /* a write failed                   */
+    SysFile     fd;
+    char       *spare;  /* the buffer not being filled      */
+    Thread      th;
+    TaskArg     arg;
+} AfileWriter;
+
+/*
+ * AtomicFile: a save that either fully replaces `path` or leaves it
+ * untouched. Output goes to `tmp` through SAVE_BUF buffers with plain
+ * write() calls; afile_commit() flushes, fsyncs and renames it over
+ * `path`, so a crash at any point leaves the old or the new file.
+ */
+typedef struct {
+    const char  *path, *tmp;
+    SysFile      fd;
+    char        *buf;
+    size_t       len;  /* buffered bytes                  */
+    uint64_t     off;  /* bytes written, buffered included */
+    bool         err;
+    AfileWriter *w;    /* started by the first full buffer */
+} AtomicFile;
+
+static bool afile_open(AtomicFile *f, const char *path, const char *tmp) {
+    memset(f, 0, sizeof *f);
+    f->path = path; f->tmp = tmp;
+    f->buf = malloc(SAVE_BUF);
+    if (!f->buf) { errno = ENOMEM; return false; }
+    f->fd = sys_open_write(tmp, false);
+    if (f->fd == SYS_FILE_NONE) { int e = errno; free(f->buf); errno = e; return false; }
+    return true;
+}
+
+static void afile_writer(void *ctx, int worker) {
+    (void)worker;
+    AfileWriter *w = ctx;
+    mutex_lock(&w->lock);
+    for (;;) {
+        if (!w->busy) {
+            if (w->stop) break;
+            cond_wait_ms(&w->cv, &w->lock, -1);
+            continue;
+        }
+        const char *p = w->p;
+        size_t      n = w->n;
+        mutex_unlock(&w->lock);
+        bool ok = w->err || sys_write_all(w->fd, p, n);
+        mutex_lock(&w->lock);
+        if (!ok) w->err = true;
+        w->busy = false;
+        cond_broadcast(&w->cv);
+    }
+    mutex_unlock(&w->lock);
+}
+
+/* Wait until the writer has written everything handed to it. */
+static void afile_wait(AtomicFile *f) {
+    if (!f->w) return;
+    mutex_lock(&f->w->lock);
+    while (f->w->busy) cond_wait_ms(&f->w->cv, &f->w->lock, -1);
+    if (f->w->err) f->err = true;
+    mutex_unlock(&f->w->lock);
+}
+
+/* Start the writer thread; false (leaving f to write synchronously) if it cannot. */
+static bool afile_start_writer(AtomicFile *f) {
+    AfileWriter *w = calloc(1, sizeof *w);
+    if (!w || !(w->spare = malloc(SAVE_BUF))) { free(w); return false; }
+    mutex_init(&w->lock);
+    cond_init(&w->cv);
+    w->fd  = f->fd;
+    w->arg = (TaskArg){ afile_writer, w, 0 };
+    if (!thread_start(&w->th, &w->arg)) { free(w->spare); free(w); return false; }
+    f->w = w;
+    return true;
+}
+
+static void afile_stop_writer(AtomicFile *f) {
+    if (!f->w) return;
+    mutex_lock(&f->w->lock);
+    f->w->stop = true;
+    cond_broadcast(&f->w->cv);
+    mutex_unlock(&f->w->lock);
+    thread_join(f->w->th);
+    if (f->w->err) f->err = true;
+    free(f->w->spare);
+    free(f->w);
+    f->w = NULL;
+}
+
+/* Write out the buffer: hand it to the writer (full = more output follows) or write it here. */
+static void afile_hand(AtomicFile *f, bool full) {
+    if (!f->len) return;
+    if (f->w || (full && !f->err && afile_start_writer(f))) {
+        afile_wait(f);
+        AfileWriter *w = f->w;
+        mutex_lock(&w->lock);
+        w->p    = f->buf;
+        w->n    = f->len;
+        w->busy = true;
+        cond_broadcast(&w->cv);
+        mutex_unlock(&w->lock);
+        char *next = w->spare; /* free: the writer finished with it above */
+        w->spare = f->buf;
+        f->buf   = next;
+    } else if (!f->err) {
+        f->err = !sys_write_all(f->fd, f->buf, f->len);
+    }
+    f->len = 0;
+}
+
+/* Write out everything buffered and wait for it. */
+static void afile_flush(AtomicFile *f) {
+    afile_hand(f, false);
+    afile_wait(f);
+}
+
+static void afile_spill(AtomicFile *f, const char *p, size_t n) {
+    while (n > 0) {
+        size_t k = SAVE_BUF - f->len < n ? SAVE_BUF - f->len : n;
+        memcpy(f->buf + f->len, p, k);
+        f->len += k;
+        p += k; n -= k;
+        if (f->len == SAVE_BUF) afile_hand(f, true);
+    }
+}
+
+static inline void afile_write(AtomicFile *f, const void *p, size_t n) {
+    f->off += n;
+    if (f->len + n <= SAVE_BUF) {
+        memcpy(f->buf + f->len, p, n);
+        f->len += n;
+        return;
+    }
+    afile_spill(f, p, n);
+}
+
+/* Overwrite n already-written bytes at `at` (e.g. a header); write nothing after. */
+static void afile_patch(AtomicFile *f, uint64_t at, const void *p, size_t n) {
+    afile_flush(f);
+    if (!f->err) f->err = !sys_write_at(f->fd, at, p, n);
+}
+
+/* Give up on the file: close and remove `tmp`, leaving `path` unchanged. */
+static void afile_abort(AtomicFile *f) {
+    afile_stop_writer(f);
+    free(f->buf);
+    f->buf = NULL;
+    sys_close(f->fd);
+    f->fd = SYS_FILE_NONE;
+    remove(f->tmp);
+}
+
+/*
+ * afile_commit
+ *   Flushes and syncs the temporary file, then renames it over `path`.
+ *   Prints and returns false on error, in which case `path` is unchanged.
+ */
+static bool afile_commit(AtomicFile *f) {
+    afile_flush(f);
+    afile_stop_writer(f);
+    free(f->buf);
+    f->buf = NULL;
+    bool ok = !f->err && sys_sync(f->fd);
+    ok = sys_close(f->fd) && ok;
+    f->fd = SYS_FILE_NONE;
+    ok = ok && sys_replace(f->tmp, f->path);
+    if (!ok) {
+        fprintf(stderr, "[ERROR] Failed writing '%s'.\n", f->path);
+        remove(f->tmp);
+    }
+    return ok;
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Listing
+ *    list_select() picks the items a ListQuery asks for: filtered by
+ *    quantity, price and name, sorted, and paged by offset/limit.
+ *    It reads a StoreImage: the live store, whose quantity and price
+ *    order come straight from the ordered indexes, or a pinned version
+ *    (see store_pin()), which other threads may keep changing. Other
+ *    orders sort only the matching items, and with a limit keep just
+ *    the first offset + limit of them in a heap.
+ *    list_begin()/list_rows()/list_end() then stream those items as a
+ *    table, CSV or JSON through a ListSink, which formats into memory
+ *    and hands the text on in SAVE_BUF pieces: to stdout for the menu,
+ *    to an AtomicFile for export_csv() and the export command.
+ * ══════════════════════════════════════════════════════════════ */
+
+/* Text formatted in memory (batch replies, listings). */
+typedef struct {
+    char  *buf;
+    size_t len, cap;
+    bool   lost; /* something was dropped: out of memory */
+} OutBuf;
+
+static bool out_reserve(OutBuf *o, size_t n) {
+    if (o->len + n < o->cap) return true;
+    size_t cap = o->cap ? o->cap * 2 : 4096;
+    while (cap <= o->len + n) cap *= 2;
+    char *nb = realloc(o->buf, cap);
+    if (!nb) { o->lost = true; return false; }
+    o->buf = nb; o->cap = cap;
+    return true;
+}
+
+static void out_write(OutBuf *o, const void *p, size_t n) {
+    if (!out_reserve(o, n)) return;
+    memcpy(o->buf + o->len, p, n);
+    o->len += n;
+}
+
+static void out_printf(OutBuf *o, const char *fmt, ...) {
+    for (size_t room = 64; ; ) {
+        if (!out_reserve(o, room)) return;
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(o->buf + o->len, o->cap - o->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if ((size_t)n < o->cap - o->len) { o->len += (size_t)n; return; }
+        room = (size_t)n + 1;
+    }
+}
+
+typedef enum {
+    SORT_INSERTION, SORT_NAME, SORT_STORE, /* as ViewOrder */
+    SORT_QTY, SORT_PRICE, SORT_VALUE
+} ListSort;
+
+
+typedef struct {
+    ListSort    sort;
+    bool        desc;
+    size_t      offset, limit;       /* limit 0: all                 */
+    int64_t     qty_lo, qty_hi;      /* inclusive                    */
+    int64_t     cents_lo, cents_hi;
+    const char *name;  size_t name_len; /* contained, ignoring case */
+} ListQuery;
+
+static void list_query_init(ListQuery *q, ListSort sort) {
+    memset(q, 0, sizeof *q);
+    q->sort   = sort;
+    q->qty_lo = q->cents_lo = INT64_MIN;
+    q->qty_hi = q->cents_hi = INT64_MAX;
+}
+
+static bool contains_ci(const char *s, size_t n, const char *q, size_t m) {
+    for (size_t i = 0; i + m <= n; i++) {
+        size_t j = 0;
+        while (j < m && tolower((unsigned char)s[i + j]) == tolower((unsigned char)q[j])) j++;
+        if (j == m) return true;
+    }
+    return false;
+}
+
+static bool list_match(const ListQuery *q, const StoreImage *im, int i) {
+    int64_t qty = IMG_COL(im, qty, i), cents = IMG_COL(im, price, i);
+    return qty >= q->qty_lo && qty <= q->qty_hi && cents >= q->cents_lo && cents <= q->cents_hi &&
+           (!q->name_len ||
+            contains_ci(img_name(im, i), IMG_COL(im, name_len, i), q->name, q->name_len));
+}
+
+static _Thread_local struct {
+    const ListQuery  *q;
+    const StoreImage *im;
+} t_list; /* for list_cmp() */
+
+/* Sort key of item i under the current list_cmp() order (not SORT_NAME). */
+static int64_t list_key(int i) {
+    const StoreImage *im = t_list.im;
+    switch (t_list.q->sort) {
+        case SORT_QTY:   return IMG_COL(im, qty, i);
+        case SORT_PRICE: return IMG_COL(im, price, i);
+        default:         return IMG_COL(im, qty, i) * IMG_COL(im, price, i);
+    }
+}
+
+/* Name, quantity, price or value order, ties in insertion order; reversed for desc. */
+static int list_cmp(const void *a, const void *b) {
+    const StoreImage *im = t_list.im;
+    int x = *(const int *)a, y = *(const int *)b, c;
+    if (t_list.q->sort == SORT_NAME) {
+        c = strcasecmp(img_name(im, x), img_name(im, y));
+    } else {
+        int64_t vx = list_key(x), vy = list_key(y);
+        c = (vx > vy) - (vx < vy);
+    }
+    if (!c) {
+        uint32_t sx = IMG_COL(im, seq, x), sy = IMG_COL(im, seq, y);
+        c = (sx > sy) - (sx < sy);
+    }
+    return t_list.q->desc ? -c : c;
+}
+
+/* Restore the heap order of v[0, k) (last-ordered item on top) below `at`. */
+static void list_sift(int *v, size_t k, size_t at) {
+    for (size_t c; (c = 2 * at + 1) < k; at = c) {
+        if (c + 1 < k && list_cmp(&v[c], &v[c + 1]) < 0) c++;
+        if (list_cmp(&v[at], &v[c]) >= 0) break;
+        int t = v[at]; v[at] = v[c]; v[c] = t;
+    }
+}
+
+/* Leave the first k of v[0, n) under list_cmp() in v[0, k), sorted. */
+static void list_top(int *v, size_t n, size_t k) {
+    for (size_t i = k / 2; i-- > 0; ) list_sift(v, k, i);
+    for (size_t i = k; i < n; i++)
+        if (k && list_cmp(&v[i], &v[0]) < 0) { v[0] = v[i]; list_sift(v, k, 0); }
+    qsort(v, k, sizeof *v, list_cmp);
+}
+
+/*
+ * list_select
+ *   Positions in image im of the page of items `q` selects, in order:
+ *   *v receives a malloc'd array of *n entries, *matched the count
+ *   before paging. A live image needs the store exclusively (quantity
+ *   and price order use the ordered indexes). Returns false when memory
+ *   is short.
+ */
+static bool list_select(const ListQuery *q, const StoreImage *im, int **out, size_t *n,
+                        size_t *matched) {
+    int   *v = NULL;
+    size_t nv = 0;
+    bool   ordered = (q->sort == SORT_QTY || q->sort == SORT_PRICE) && !im->pinned;
+    *out = NULL; *n = *matched = 0;
+    if (ordered) {
+        bool by_price = q->sort == SORT_PRICE;
+        if (!ord_range(by_price, by_price ? q->cents_lo : q->qty_lo,
+                       by_price ? q->cents_hi : q->qty_hi, &v, &nv))
+            return false;
+    } else {
+        int *view = q->sort == SORT_INSERTION ? store_view(im, ORDER_INSERTION) : NULL;
+        if (im->count && !(v = malloc((size_t)im->count * sizeof *v))) { free(view); return false; }
+        for (int k = 0; k < im->count; k++) v[k] = view ? view[k] : k;
+        nv = (size_t)im->count;
+        free(view);
+    }
+    size_t m = 0; /* filter in place */
+    for (size_t k = 0; k < nv; k++)
+        if (list_match(q, im, v[k])) v[m++] = v[k];
+
+    size_t first = q->offset < m ? q->offset : m;
+    size_t count = q->limit && q->limit < m - first ? q->limit : m - first;
+    if (q->sort == SORT_NAME || q->sort == SORT_VALUE ||
+        (!ordered && (q->sort == SORT_QTY || q->sort == SORT_PRICE))) {
+        t_list.q  = q;
+        t_list.im = im;
+        if (first + count < m) list_top(v, m, first + count);
+        else                   qsort(v, m, sizeof *v, list_cmp);
+    } else if (q->desc) {
+        for (size_t a = 0, b = m; a + 1 < b; a++, b--) { int t = v[a]; v[a] = v[b - 1]; v[b - 1] = t; }
+    }
+    if (first) memmove(v, v + first, count * sizeof *v);
+    *out = v; *n = count; *matched = m;
+    return true;
+}
+
+typedef enum { LIST_TABLE, LIST_CSV, LIST_JSON } ListFormat;
+
+/* Rows are formatted into `out` and passed to flush(dst, ...) in pieces. */
+typedef struct {
+    ListFormat fmt;
+    OutBuf     out;
+    void     (*flush)(void *dst, const char *p, size_t n);
+    void      *dst;
+    size_t     rows;
+    Money      cents;  /* value of the rows written */
+} ListSink;
+
+static void sink_stdout(void *dst, const char *p, size_t n) { fwrite(p, 1, n, dst); }
+static void sink_afile(void *dst, const char *p, size_t n)  { afile_write(dst, p, n); }
+
+static void list_flush(ListSink *s) {
+    if (s->out.len) s->flush(s->dst, s->out.buf, s->out.len);
+    s->out.len = 0;
+}
+
+static const char list_sep[] =
+    "  ─────────────────────────────────────────────────────────────────\n";
+
+static void list_begin(ListSink *s) {
+    static const char header[] = "# Retail Inventory – format: name,quantity,price\n";
+    switch (s->fmt) {
+        case LIST_TABLE:
+            out_printf(&s->out, "\n  %-30s %8s %10s %14s\n%s", "Name", "Qty", "Price ($)",
+                       "Value ($)", list_sep);
+            break;
+        case LIST_CSV:  out_write(&s->out, header, sizeof header - 1); break;
+        case LIST_JSON: out_write(&s->out, "[", 1);                   break;
+    }
+}
+
+static void list_json_string(OutBuf *o, const char *p, size_t n) {
+    out_write(o, "\"", 1);
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)p[i];
+        if (c == '"' || c == '\\') { char e[2] = { '\\', (char)c }; out_write(o, e, 2); }
+        else if (c < 0x20)         out_printf(o, "\\u%04x", c);
+        else                       out_write(o, &p[i], 1);
+    }
+    out_write(o, "\"", 1);
+}
+
+static void list_rows(ListSink *s, const StoreImage *im, const int *v, size_t n) {
+    for (size_t k = 0; k < n; k++) {
+        int         i     = v[k];
+        int32_t     q     = IMG_COL(im, qty, i);
+        Money       price = IMG_COL(im, price, i);
+        const char *name  = img_name(im, i);
+        char        pb[MONEY_BUF], vb[MONEY_BUF];
+        s->cents += q * price;
+        switch (s->fmt) {
+            case LIST_TABLE:
+                out_printf(&s->out, "  %-30s %8d %10s %14s\n", name, q, money_str(pb, price),
+                           money_str(vb, q * price));
+                break;
+            case LIST_CSV: {
+                char tail[64], *e = tail + sizeof tail;
+                *--e = '\n';
+                e = money_put(e, price);
+                *--e = ',';
+                e = fmt_u64(e, q < 0 ? (uint64_t)-(int64_t)q : (uint64_t)q);
+                if (q < 0) *--e = '-';
+                *--e = ',';
+                out_write(&s->out, name, IMG_COL(im, name_len, i));
+                out_write(&s->out, e, (size_t)(tail + sizeof tail - e));
+                break;
+            }
+            case LIST_JSON:
+                out_write(&s->out, s->rows ? ",\n  {\"name\": " : "\n  {\"name\": ",
+                          s->rows ? 13 : 12);
+                list_json_string(&s->out, name, IMG_COL(im, name_len, i));
+                out_printf(&s->out, ", \"qty\": %d, \"price\": %s}", q, money_str(pb, price));
+                break;
+        }
+        s->rows++;
+        if (s->out.len >= SAVE_BUF) list_flush(s);
+    }
+}
+
+static void list_end(ListSink *s) {
+    char tb[MONEY_BUF];
+    switch (s->fmt) {
+        case LIST_TABLE:
+            out_printf(&s->out, "%s  %-30s %8s %10s %14s\n\n", list_sep, "TOTAL", "", "",
+                       money_str(tb, s->cents));
+            break;
+        case LIST_CSV:  break;
+        case LIST_JSON: out_write(&s->out, s->rows ? "\n]\n" : "]\n", s->rows ? 3 : 2); break;
+    }
+    list_flush(s);
+    free(s->out.buf);
+    s->out.buf = NULL;
+    s->out.cap = 0;
+}
+
+/*
+ * list_export
+ *   Writes the items of image im that `q` selects to `path` (via `tmp`,
+ *   atomically) as CSV or JSON. *n receives the row count. Prints and
+ *   returns false on error, leaving `path` unchanged.
+ */
+static bool list_export(const char *path, const char *tmp, ListFormat fmt, const ListQuery *q,
+                        const StoreImage *im, size_t *n) {
+    int   *v;
+    size_t matched;
+    *n = 0;
+    if (!list_select(q, im, &v, n, &matched)) {
+        fprintf(stderr, "[ERROR] Out of memory writing '%s'.\n", path);
+        return false;
+    }
+    AtomicFile f;
+    if (!afile_open(&f, path, tmp)) {
+        fprintf(stderr, "[ERROR] Cannot write '%s': %s\n", tmp, strerror(errno));
+        free(v);
+        return false;
+    }
+    ListSink s = { .fmt = fmt, .flush = sink_afile, .dst = &f };
+    list_begin(&s);
+    list_rows(&s, im, v, *n);
+    bool lost = s.out.lost;
+    list_end(&s);
+    free(v);
+    if (lost) f.err = true;
+    return afile_commit(&f);
+}
+
+/*
+ * export_csv
+ *   Replaces INVENTORY_FILE with image im, in the --order order.
+ *   Returns true on success.
+ */
+static bool export_csv(const StoreImage *im) {
+    ListQuery q;
+    size_t    n;
+    list_query_init(&q, (ListSort)g_order);
+    if (!list_export(INVENTORY_FILE, INVENTORY_TMP, LIST_CSV, &q, im, &n)) return false;
+    printf("[INFO] %zu item(s) saved to '%s'.\n", n, INVENTORY_FILE);
+    return true;
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Binary snapshot
+ *    SNAPSHOT_FILE holds the store in its in-memory layout, so startup
+ *    maps it copy-on-write and adopts the chunks, index shards and name
+ *    blocks in place instead of parsing rows. Layout:
+ *
+ *      SnapHeader
+ *      SnapShard[INDEX_SHARDS]     index table offsets
+ *      SnapBlock[name_blocks]      name block offsets
+ *      index tables                (8-byte aligned)
+ *      name blocks                 live names only, packed in item order
+ *      item chunks                 ItemChunk images, page aligned
+ *
+ *    The images depend on this build's struct layout and byte order,
+ *    which the header records; a snapshot from a different build is
+ *    ignored and INVENTORY_FILE is imported instead. The CSV remains
+ *    the interchange format: if it changed since the snapshot was
+ *    written (size or mtime differ) it wins.
+ * ══════════════════════════════════════════════════════════════ */
+
+#define SNAP_MAGIC      "INVSNAP"   /* 8 bytes with the terminator */
+#define SNAP_VERSION    4
+#define SNAP_BYTE_ORDER 0x01020304u
+#define SNAP_PAGE       4096
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t byte_order;  /* SNAP_BYTE_ORDER as stored by the writer */
+    uint32_t chunk_items; /* ITEM_CHUNK                              */
+    uint32_t chunk_bytes; /* sizeof(ItemChunk)                       */
+    uint32_t shards;      /* INDEX_SHARDS                            */
+    uint32_t name_blocks;
+    uint32_t money_digits; /* MONEY_DIGITS                           */
+    uint32_t pad;
+    uint64_t count;
+    uint64_t name_bytes;  /* live name bytes, terminators included   */
+    int64_t  total_cents;
+    int64_t  total_units;
+    int64_t  csv_size;    /* INVENTORY_FILE when written; -1 = none  */
+    int64_t  csv_mtime;
+    uint64_t lsn;         /* last write-ahead log record included    */
+    uint64_t seq_next;    /* g_seq_next                              */
+    uint64_t file_size;
+    uint64_t payload_sum; /* checksum of every byte after the header */
+    uint64_t header_sum;  /* checksum of the fields above            */
+} SnapHeader;
+
+typedef struct { uint64_t off, cap, used; } SnapShard;
+typedef struct { uint64_t off, size; } SnapBlock;
+
+/*
+ * Snapshot checksum: four independent multiply/xorshift lanes over
+ * 8-byte words, so validating a large file runs near memory speed.
+ */
+typedef struct {
+    uint64_t      lane[4];
+    unsigned char tail[32];
+    size_t        fill;
+    uint64_t      total;
+} SnapSum;
+
+static void snap_sum_init(SnapSum *s) {
+    static const uint64_t seed[4] = { 0x9E3779B97F4A7C15u, 0xC2B2AE3D27D4EB4Fu,
+                                      0x165667B19E3779F9u, 0x27D4EB2F165667C5u };
+    memcpy(s->lane, seed, sizeof seed);
+    s->fill = 0; s->total = 0;
+}
+
+static inline void snap_sum_block(uint64_t lane[4], const unsigned char *p) {
+    for (int l = 0; l < 4; l++) {
+        uint64_t w;
+        memcpy(&w, p + 8 * l, 8);
+        lane[l] = (lane[l] ^ w) * 0x100000001B3u;
+        lane[l] ^= lane[l] >> 29;
+    }
+}
+
+static void snap_sum_add(SnapSum *s, const void *data, size_t n) {
+    const unsigned char *p = data;
+    s->total += n;
+    if (s->fill) {
+        size_t k = 32 - s->fill < n ? 32 - s->fill : n;
+        memcpy(s->tail + s->fill, p, k);
+        s->fill += k; p += k; n -= k;
+        if (s->fill < 32) return;
+        snap_sum_block(s->lane, s->tail);
+        s->fill = 0;
+    }
+    for (; n >= 32; p += 32, n -= 32) snap_sum_block(s->lane, p);
+    memcpy(s->tail, p, n);
+    s->fill = n;
+}
+
+static uint64_t snap_sum_final(SnapSum *s) {
+    if (s->fill) {
+        memset(s->tail + s->fill, 0, 32 - s->fill);
+        snap_sum_block(s->lane, s->tail);
+    }
+    uint64_t h = s->total;
+    for (int l = 0; l < 4; l++) {
+        h = (h ^ s->lane[l]) * 0x100000001B3u;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+static uint64_t snap_checksum(const void *p, size_t n) {
+    SnapSum s;
+    snap_sum_init(&s);
+    snap_sum_add(&s, p, n);
+    return snap_sum_final(&s);
+}
+
+static uint64_t snap_header_sum(const SnapHeader *h) {
+    return snap_checksum(h, offsetof(SnapHeader, header_sum));
+}
+
+/* Size and mtime of INVENTORY_FILE, or -1/-1 if it does not exist. */
+static void csv_stamp(int64_t *size, int64_t *mtime) {
+    struct stat st;
+    if (stat(INVENTORY_FILE, &st) != 0) { *size = *mtime = -1; return; }
+    *size  = (int64_t)st.st_size;
+    *mtime = (int64_t)st.st_mtime;
+}
+
+static inline uint64_t align_up(uint64_t v, uint64_t a) {
+    return (v + a - 1) / a * a;
+}
+
+/* Snapshot writer: an AtomicFile that checksums the payload as it goes. */
+typedef struct {
+    AtomicFile f;
+    SnapSum    sum;
+} SnapOut;
+
+static void snap_put(SnapOut *o, const void *p, size_t n) {
+    afile_write(&o->f, p, n);
+    snap_sum_add(&o->sum, p, n);
+}
+
+static void snap_pad(SnapOut *o, uint64_t to) {
+    static const char zero[64];
+    while (o->f.off < to) {
+        uint64_t n = to - o->f.off;
+        snap_put(o, zero, n < sizeof zero ? (size_t)n : sizeof zero);
+    }
+}
+
+static FileView g_snap;        /* the adopted snapshot mapping, if any      */
+
+/* Unmap the adopted snapshot; the store must no longer use it (store_clear()). */
+static void snapshot_release(void) {
+    if (!g_snap.base) return;
+    atomic_fetch_sub(&g_mem_used, g_snap_charge);
+    file_view_close(&g_snap);
+    g_snap_lo = g_snap_hi = 0;
+    g_snap_charge = 0;
+    mem_free(g_lazy.chunk, g_lazy.nchunks);
+    g_lazy.chunk   = NULL;
+    g_lazy.nchunks = 0;
+    atomic_store(&g_lazy.shard_dirty, 0);
+}
+
+#ifdef _WIN32
+/*
+ * Copy everything still borrowed from the snapshot mapping to the heap
+ * and unmap it. Windows will not replace a file that is mapped, so this
+ * runs before a new snapshot is renamed over the old one.
+ */
+static bool snapshot_detach(void) {
+    if (!g_snap.base) return true;
+    version_quiesce(); /* pinned images may point into the mapping */
+    if (!snap_touch_all()) return false; /* the copies are not checked again */
+    atomic_fetch_sub(&g_mem_used, g_snap_charge);
+    bool ok = true;
+#define SNAP_DETACH(ptr, bytes) do {                                         \
+        if (ok && (uintptr_t)(ptr) >= g_snap_lo && (uintptr_t)(ptr) < g_snap_hi) { \
+            void *copy_ = mem_alloc(bytes);                                  \
+            if (copy_) { memcpy(copy_, (ptr), (bytes)); (ptr) = copy_; }     \
+            else ok = false;                                                 \
+        }                                                                    \
+    } while (0)
+    for (size_t c = 0; c < g_chunk_cnt; c++) SNAP_DETACH(g_chunks[c], sizeof **g_chunks);
+    for (uint32_t b = 0; b < g_name_nblocks; b++) SNAP_DETACH(g_name_blocks[b], g_name_block_sz[b]);
+    for (int s = 0; s < INDEX_SHARDS; s++)
+        SNAP_DETACH(g_shards[s].tab, g_shards[s].cap * sizeof *g_shards[s].tab);
+#undef SNAP_DETACH
+    if (!ok) {
+        atomic_fetch_add(&g_mem_used, g_snap_charge);
+        fprintf(stderr, "[ERROR] Out of memory releasing '%s'.\n", SNAPSHOT_FILE);
+        return false;
+    }
+    file_view_close(&g_snap);
+    g_snap_lo = g_snap_hi = 0;
+    g_snap_charge = 0;
+    mem_free(g_lazy.chunk, g_lazy.nchunks);
+    g_lazy.chunk   = NULL;
+    g_lazy.nchunks = 0;
+    atomic_store(&g_lazy.shard_dirty, 0);
+    return true;
+}
+#endif
+
+/* ─── Compressed snapshot ─────────────────────────────────────── */
+/*
+ * With --snapshot-compress, saves write the columns encoded instead of
+ * the mapped layout: the file is several times smaller (less to read
+ * from slow storage, less to send a follower), but loading it decodes
+ * and rebuilds the store and index rather than mapping them. Items are
+ * written in name order (store order is internal, so it is not kept):
+ *
+ *      SnapHeader              magic SNAPZ_MAGIC; chunk fields unused
+ *      names                   per item: varint shared-prefix length,
+ *                              varint suffix length, suffix bytes
+ *      quantities              SNAPZ_BLOCK-value blocks, frame of reference
+ *      price dictionary        varint count, ascending varint deltas
+ *      price codes             blocks of dictionary indexes
+ *      insertion sequence      blocks of ITEM_SEQ
+ *      SnapZTable              section offsets
+ *
+ * A block is a varint base (its minimum), one byte of bit width w, and
+ * the values less the base packed w bits each, little-endian. The
+ * payload checksum covers everything after the header, as before.
+ */
+#define SNAPZ_MAGIC "INVSNPZ" /* 8 bytes with the terminator */
+#define SNAPZ_BLOCK 128       /* values per packed block      */
+
+typedef struct {
+    uint64_t names, qty, dict, price, seq; /* section offsets */
+    uint64_t ndict;
+} SnapZTable;
+
+static void snapz_varint(SnapOut *o, uint64_t v) {
+    unsigned char b[10];
+    int n = 0;
+    while (v >= 0x80) { b[n++] = (unsigned char)(v | 0x80); v >>= 7; }
+    b[n++] = (unsigned char)v;
+    snap_put(o, b, (size_t)n);
+}
+
+/* Write n (<= SNAPZ_BLOCK) values as one block. */
+static void snapz_pack(SnapOut *o, const uint32_t *v, size_t n) {
+    uint32_t lo = UINT32_MAX, hi = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (v[i] < lo) lo = v[i];
+        if (v[i] > hi) hi = v[i];
+    }
+    unsigned w = 0;
+    while (w < 32 && (uint64_t)(hi - lo) >> w) w++;
+    unsigned char out[SNAPZ_BLOCK * 4 + 8];
+    memset(out, 0, sizeof out);
+    for (size_t i = 0; i < n && w; i++) {
+        uint64_t bit = (uint64_t)i * w, x = (uint64_t)(v[i] - lo) << (bit & 7), cur;
+        memcpy(&cur, out + (bit >> 3), 8);
+        cur |= x;
+        memcpy(out + (bit >> 3), &cur, 8);
+    }
+    snapz_varint(o, lo);
+    unsigned char wb = (unsigned char)w;
+    snap_put(o, &wb, 1);
+    snap_put(o, out, (n * w + 7) / 8);
+}
+
+static int snapz_money_cmp(const void *a, const void *b) {
+    Money x = *(const Money *)a, y = *(const Money *)b;
+    return (x > y) - (x < y);
+}
+
+/* snapshot_write() in the compressed format. */
+static bool snapz_write(const StoreImage *im, const char *path, const char *tmp,
+                        bool announce) {
+    size_t    n    = (size_t)im->count;
+    int      *v    = store_view(im, ORDER_NAME); /* NULL: store order, which also works */
+    Money    *dict = malloc((n + 1) * sizeof *dict);
+    uint32_t *col  = malloc(SNAPZ_BLOCK * sizeof *col);
+    SnapOut   o;
+    if (!dict || !col) {
+        fprintf(stderr, "[ERROR] Out of memory writing '%s'.\n", path);
+        free(v); free(dict); free(col);
+        return false;
+    }
+    if (!afile_open(&o.f, path, tmp)) {
+        fprintf(stderr, "[ERROR] Cannot write '%s': %s\n", tmp, strerror(errno));
+        free(v); free(dict); free(col);
+        return false;
+    }
+#define AT(i) (v ? v[i] : (int)(i))
+
+    SnapHeader hdr;
+    memset(&hdr, 0, sizeof hdr);
+    memcpy(hdr.magic, SNAPZ_MAGIC, sizeof hdr.magic);
+    hdr.version      = SNAP_VERSION;
+    hdr.byte_order   = SNAP_BYTE_ORDER;
+    hdr.money_digits = MONEY_DIGITS;
+    hdr.count        = (uint64_t)n;
+    hdr.total_cents  = im->total_cents;
+    hdr.total_units  = im->total_units;
+    hdr.lsn          = im->lsn;
+    hdr.seq_next     = im->seq_next;
+    csv_stamp(&hdr.csv_size, &hdr.csv_mtime);
+    afile_write(&o.f, &hdr, sizeof hdr);
+    snap_sum_init(&o.sum);
+
+    SnapZTable t;
+    t.names = o.f.off;
+    const char *prev = "";
+    size_t      plen = 0;
+    for (size_t i = 0; i < n && !o.f.err; i++) {
+        const char *s   = img_name(im, AT(i));
+        size_t      len = IMG_COL(im, name_len, AT(i)), k = 0;
+        while (k < len && k < plen && s[k] == prev[k]) k++;
+        snapz_varint(&o, k);
+        snapz_varint(&o, len - k);
+        snap_put(&o, s + k, len - k);
+        hdr.name_bytes += len + 1;
+        prev = s; plen = len;
+    }
+
+    t.qty = o.f.off;
+    for (size_t b = 0; b < n && !o.f.err; b += SNAPZ_BLOCK) {
+        size_t m = n - b < SNAPZ_BLOCK ? n - b : SNAPZ_BLOCK;
+        for (size_t i = 0; i < m; i++) /* biased, so signed order is kept */
+            col[i] = (uint32_t)IMG_COL(im, qty, AT(b + i)) ^ 0x80000000u;
+        snapz_pack(&o, col, m);
+    }
+
+    size_t nd = 0;
+    for (size_t i = 0; i < n; i++) dict[i] = IMG_COL(im, price, i);
+    qsort(dict, n, sizeof *dict, snapz_money_cmp);
+    for (size_t i = 0; i < n; i++)
+        if (nd == 0 || dict[i] != dict[nd - 1]) dict[nd++] = dict[i];
+    t.dict  = o.f.off;
+    t.ndict = nd;
+    for (size_t d = 0; d < nd; d++) snapz_varint(&o, (uint64_t)(dict[d] - (d ? dict[d - 1] : 0)));
+
+    t.price = o.f.off;
+    for (size_t b = 0; b < n && !o.f.err; b += SNAPZ_BLOCK) {
+        size_t m = n - b < SNAPZ_BLOCK ? n - b : SNAPZ_BLOCK;
+        for (size_t i = 0; i < m; i++) {
+            Money  p  = IMG_COL(im, price, AT(b + i));
+            size_t lo = 0, hi = nd - 1;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (dict[mid] < p) lo = mid + 1; else hi = mid;
+            }
+            col[i] = (uint32_t)lo;
+        }
+        snapz_pack(&o, col, m);
+    }
+
+    t.seq = o.f.off;
+    for (size_t b = 0; b < n && !o.f.err; b += SNAPZ_BLOCK) {
+        size_t m = n - b < SNAPZ_BLOCK ? n - b : SNAPZ_BLOCK;
+        for (size_t i = 0; i < m; i++) col[i] = IMG_COL(im, seq, AT(b + i));
+        snapz_pack(&o, col, m);
+    }
+    snap_put(&o, &t, sizeof t);
+#undef AT
+    free(v); free(dict); free(col);
+
+    hdr.file_size   = o.f.off;
+    hdr.payload_sum = snap_sum_final(&o.sum);
+    hdr.header_sum  = snap_header_sum(&hdr);
+    afile_patch(&o.f, 0, &hdr, sizeof hdr);
+    if (!afile_commit(&o.f)) return false;
+    if (announce)
+        printf("[INFO] %zu item(s) saved to '%s' (compressed, %llu bytes).\n", n, path,
+               (unsigned long long)hdr.file_size);
+    return true;
+}
+
+/* Decoding cursor over one section; p = NULL once it overran `end`. */
+typedef struct { const unsigned char *p, *end; } SnapZIn;
+
+static uint64_t snapz_get_varint(SnapZIn *in) {
+    uint64_t v = 0;
+    for (int shift = 0; in->p && shift < 64; shift += 7) {
+        if (in->p == in->end) break;
+        unsigned char b = *in->p++;
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return v;
+    }
+    in->p = NULL;
+    return 0;
+}
+
+/* Read one block of n values (see snapz_pack()). */
+static void snapz_unpack(SnapZIn *in, uint32_t *out, size_t n) {
+    uint64_t lo = snapz_get_varint(in);
+    if (!in->p || in->p == in->end || *in->p > 32 || lo > UINT32_MAX) { in->p = NULL; return; }
+    unsigned w     = *in->p++;
+    size_t   bytes = (n * w + 7) / 8;
+    if ((size_t)(in->end - in->p) < bytes) { in->p = NULL; return; }
+    if (w == 0) {
+        for (size_t i = 0; i < n; i++) out[i] = (uint32_t)lo;
+    } else if ((size_t)(in->end - in->p) >= bytes + 8) {
+        /* One unaligned 64-bit load per value, no branches. */
+        uint64_t mask = ((uint64_t)1 << w) - 1;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t bit = (uint64_t)i * w, word;
+            memcpy(&word, in->p + (bit >> 3), 8);
+            out[i] = (uint32_t)(lo + ((word >> (bit & 7)) & mask));
+        }
+    } else {
+        uint64_t mask = ((uint64_t)1 << w) - 1;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t bit = (uint64_t)i * w, word = 0;
+            size_t   at  = (size_t)(bit >> 3);
+            memcpy(&word, in->p + at, bytes - at < 8 ? bytes - at : 8);
+            out[i] = (uint32_t)(lo + ((word >> (bit & 7)) & mask));
+        }
+    }
+    in->p += bytes;
+}
+
+static bool snapz_is(const FileView *fv) {
+    return fv->len >= sizeof(SnapHeader) && memcmp(fv->data, SNAPZ_MAGIC, 8) == 0;
+}
+
+/* Why a compressed snapshot cannot be decoded, or NULL if it can. */
+static const char *snapz_check(const FileView *fv) {
+    const SnapHeader *h = (const SnapHeader *)fv->data;
+    if (h->version != SNAP_VERSION || h->byte_order != SNAP_BYTE_ORDER ||
+        h->money_digits != MONEY_DIGITS)
+        return "written by a different build";
+    if (h->header_sum != snap_header_sum(h) || h->file_size != fv->len ||
+        h->count > INT_MAX || fv->len < sizeof *h + sizeof(SnapZTable))
+        return "damaged header";
+    if (snap_checksum(fv->data + sizeof *h, fv->len - sizeof *h) != h->payload_sum)
+        return "checksum mismatch";
+    SnapZTable t;
+    memcpy(&t, fv->data + fv->len - sizeof t, sizeof t);
+    if (t.names != sizeof *h || t.names > t.qty || t.qty > t.dict || t.dict > t.price ||
+        t.price > t.seq || t.seq > fv->len - sizeof t || t.ndict > h->count ||
+        (h->count && !t.ndict))
+        return "bad section table";
+    return NULL;
+}
+
+/*
+ * snapz_decode
+ *   Rebuilds the store from the checked compressed snapshot `fv`, SNAPZ_BLOCK
+ *   items at a time, prefetching each block's index slots before
+ *   inserting it. Returns false, with the store cleared, when the file
+ *   is inconsistent (errno = EINVAL) or does not fit (errno = ENOMEM).
+ */
+static bool snapz_decode(const FileView *fv, uint64_t *lsn) {
+    const SnapHeader *h = (const SnapHeader *)fv->data;
+    const unsigned char *base = (const unsigned char *)fv->data;
+    SnapZTable t;
+    memcpy(&t, fv->data + fv->len - sizeof t, sizeof t);
+    size_t n = (size_t)h->count;
+
+    Money    *dict  = malloc((t.ndict + 1) * sizeof *dict);
+    uint32_t *col   = malloc(3 * SNAPZ_BLOCK * sizeof *col);
+    size_t   *off   = malloc((SNAPZ_BLOCK + 1) * sizeof *off);
+    uint32_t *hash  = malloc(SNAPZ_BLOCK * sizeof *hash);
+    char     *names = NULL;
+    size_t    ncap  = 0;
+    bool ok = dict && col && off && hash;
+    errno = ENOMEM;
+
+    SnapZIn d = { base + t.dict, base + t.price };
+    for (size_t i = 0; ok && i < t.ndict; i++) {
+        uint64_t delta = snapz_get_varint(&d);
+        dict[i] = (Money)delta + (i ? dict[i - 1] : 0);
+        if (!d.p || delta > (uint64_t)MONEY_MAX || dict[i] > MONEY_MAX) { ok = false; errno = EINVAL; }
+    }
+
+    store_clear(true);
+    snapshot_release();
+    if (ok) index_presize(n);
+
+    SnapZIn nm = { base + t.names, base + t.qty }, qt = { base + t.qty, base + t.dict },
+            pr = { base + t.price, base + t.seq }, sq = { base + t.seq, base + fv->len - sizeof t };
+    size_t plen = 0; /* previous name: the last one decoded, kept at names[0..plen) */
+    for (size_t b = 0; ok && b < n; b += SNAPZ_BLOCK) {
+        size_t m = n - b < SNAPZ_BLOCK ? n - b : SNAPZ_BLOCK;
+        uint32_t *qty = col, *code = col + SNAPZ_BLOCK, *seq = col + 2 * SNAPZ_BLOCK;
+        snapz_unpack(&qt, qty, m);
+        snapz_unpack(&pr, code, m);
+        snapz_unpack(&sq, seq, m);
+        if (!qt.p || !pr.p || !sq.p) { ok = false; errno = EINVAL; break; }
+
+        /* names[0..plen) carries the previous block's last name. */
+        size_t top = plen, prev = 0;
+        for (size_t i = 0; ok && i < m; i++) {
+            uint64_t k = snapz_get_varint(&nm), rest = snapz_get_varint(&nm);
+            if (!nm.p || k > plen || rest > (size_t)(nm.end - nm.p) || k + rest == 0 ||
+                k + rest > UINT32_MAX - 1) { ok = false; errno = EINVAL; break; }
+            if (!vec_reserve(&names, &ncap, top + k + rest, 1)) { ok = false; break; }
+            memmove(names + top, names + prev, k);
+            memcpy(names + top + k, nm.p, rest);
+            nm.p += rest;
+            off[i] = prev = top;
+            plen   = k + rest;
+            top   += plen;
+            hash[i] = name_hash(names + off[i], plen);
+            PREFETCH(index_home(hash[i]));
+        }
+        off[m] = top;
+
+        for (size_t i = 0; ok && i < m; i++) {
+            const char *s   = names + off[i];
+            size_t      len = off[i + 1] - off[i];
+            IndexShard *sh  = index_shard(hash[i]);
+            if (code[i] >= t.ndict) { ok = false; errno = EINVAL; break; }
+            if (!store_reserve((size_t)g_count + 1) || !shard_reserve(sh, sh->used + 1)) {
+                ok = false; errno = ENOMEM; break;
+            }
+            IndexSlot *slot = index_probe(s, len, hash[i]);
+            if (slot->idx >= 0) { ok = false; errno = EINVAL; break; } /* duplicate */
+            if (!store_append(s, len, hash[i], slot, (int32_t)(qty[i] ^ 0x80000000u), dict[code[i]])) {
+                ok = false; errno = ENOMEM; break;
+            }
+            ITEM_SEQ(g_count - 1) = seq[i];
+        }
+        /* Keep the last name at the front for the next block. */
+        if (ok) {
+            prev = off[m - 1];
+            memmove(names, names + prev, plen);
+        }
+    }
+    if (ok && (g_total_cents != h->total_cents || g_total_units != h->total_units)) {
+        ok = false;
+        errno = EINVAL;
+    }
+    int e = errno;
+    free(dict); free(col); free(off); free(hash); free(names);
+    if (!ok) { store_clear(true); errno = e; return false; }
+    g_seq_next = (uint32_t)h->seq_next;
+    *lsn       = h->lsn;
+    totals_check("snapshot load");
+    return true;
+}
+
+/*
+ * snapshot_write
+ *   Writes `im` over `path` through an AtomicFile (via `tmp`), so a
+ *   mapping of the previous snapshot stays valid and a failed save
+ *   leaves it untouched. Names are repacked on the way out, dropping
+ *   the space of removed items. On Windows the caller must
+ *   snapshot_detach() first when `path` is the adopted snapshot.
+ *   With --snapshot-compress it writes the compressed format instead
+ *   (snapz_write()). Returns true on success.
+ */
+static bool snapshot_write(const StoreImage *im, const char *path, const char *tmp,
+                           bool announce) {
+    if (g_snap_compress) return snapz_write(im, path, tmp, announce);
+    int    count   = im->count;
+    size_t nchunks = im->nchunks;
+
+    /* Pass 1: assign packed name handles. */
+    uint32_t  *handle = malloc(((size_t)count + 1) * sizeof *handle);
+    SnapBlock *blk    = malloc(NAME_MAX_BLOCKS * sizeof *blk);
+    ItemChunk *img    = malloc(sizeof *img);
+    bool ok = handle && blk && img;
+    uint32_t nb = 0;
+    uint64_t top = 0, end = 0, name_bytes = 0;
+    for (int i = 0; ok && i < count; i++) {
+        uint64_t need = (uint64_t)IMG_COL(im, name_len, i) + 1;
+        if (top + need > end) {
+            if (nb) blk[nb - 1].size = top;
+            if (nb == NAME_MAX_BLOCKS) { ok = false; break; }
+            nb++; top = 0;
+            end = need > NAME_BLOCK ? need : NAME_BLOCK;
+        }
+        handle[i] = ((nb - 1) << NAME_BLOCK_SHIFT) | (uint32_t)top;
+        top += need;
+        name_bytes += need;
+    }
+    if (nb) blk[nb - 1].size = top;
+    if (!ok) {
+        fprintf(stderr, "[ERROR] Out of memory writing '%s'.\n", path);
+        free(handle); free(blk); free(img);
+        return false;
+    }
+
+    /* Lay out the file. */
+    SnapHeader hdr;
+    memset(&hdr, 0, sizeof hdr);
+    memcpy(hdr.magic, SNAP_MAGIC, sizeof hdr.magic);
+    hdr.version     = SNAP_VERSION;
+    hdr.byte_order  = SNAP_BYTE_ORDER;
+    hdr.chunk_items = ITEM_CHUNK;
+    hdr.chunk_bytes = sizeof(ItemChunk);
+    hdr.shards      = INDEX_SHARDS;
+    hdr.name_blocks = nb;
+    hdr.money_digits = MONEY_DIGITS;
+    hdr.count       = (uint64_t)count;
+    hdr.name_bytes  = name_bytes;
+    hdr.total_cents = im->total_cents;
+    hdr.total_units = im->total_units;
+    hdr.lsn         = im->lsn;
+    hdr.seq_next    = im->seq_next;
+    csv_stamp(&hdr.csv_size, &hdr.csv_mtime);
+
+    SnapShard shard[INDEX_SHARDS];
+    uint64_t off = sizeof hdr + sizeof shard + (uint64_t)nb * sizeof *blk;
+    off = align_up(off, 64);
+    for (int s = 0; s < INDEX_SHARDS; s++) {
+        shard[s].off  = off;
+        shard[s].cap  = im->shards[s].tab ? im->shards[s].cap : 0;
+        shard[s].used = im->shards[s].used;
+        off += shard[s].cap * sizeof(IndexSlot);
+    }
+    off = align_up(off, 64);
+    for (uint32_t b = 0; b < nb; b++) { blk[b].off = off; off += blk[b].size; }
+    uint64_t chunk_off = align_up(off, SNAP_PAGE);
+    hdr.file_size = chunk_off + nchunks * sizeof(ItemChunk);
+
+    /* Pass 2: write it; the header is patched in once the sum is known. */
+    SnapOut o;
+    if (!afile_open(&o.f, path, tmp)) {
+        fprintf(stderr, "[ERROR] Cannot write '%s': %s\n", tmp, strerror(errno));
+        free(handle); free(blk); free(img);
+        return false;
+    }
+    afile_write(&o.f, &hdr, sizeof hdr);
+    snap_sum_init(&o.sum);
+
+    snap_put(&o, shard, sizeof shard);
+    snap_put(&o, blk, (size_t)nb * sizeof *blk);
+    for (int s = 0; s < INDEX_SHARDS; s++) {
+        snap_pad(&o, shard[s].off);
+        snap_put(&o, im->shards[s].tab, (size_t)shard[s].cap * sizeof(IndexSlot));
+    }
+    if (nb) snap_pad(&o, blk[0].off);
+    for (int i = 0; i < count && !o.f.err; i++)
+        snap_put(&o, img_name(im, i), (size_t)IMG_COL(im, name_len, i) + 1);
+    snap_pad(&o, chunk_off);
+    for (size_t c = 0; c < nchunks && !o.f.err; c++) {
+        size_t base = c * ITEM_CHUNK;
+        size_t n = (size_t)count - base < ITEM_CHUNK ? (size_t)count - base : ITEM_CHUNK;
+        memcpy(img, im->chunks[c], sizeof *img);
+        memcpy(img->name, handle + base, n * sizeof *handle);
+        if (n < ITEM_CHUNK) {
+            size_t rest = ITEM_CHUNK - n;
+            memset(img->price + n, 0, rest * sizeof *img->price);
+            memset(img->qty + n, 0, rest * sizeof *img->qty);
+            memset(img->name + n, 0, rest * sizeof *img->name);
+            memset(img->name_len + n, 0, rest * sizeof *img->name_len);
+            memset(img->hash + n, 0, rest * sizeof *img->hash);
+            memset(img->seq + n, 0, rest * sizeof *img->seq);
+        }
+        snap_put(&o, img, sizeof *img);
+    }
+    free(handle); free(blk); free(img);
+
+    hdr.payload_sum = snap_sum_final(&o.sum);
+    hdr.header_sum  = snap_header_sum(&hdr);
+    afile_patch(&o.f, 0, &hdr, sizeof hdr);
+    if (!afile_commit(&o.f)) return false;
+    if (announce) printf("[INFO] %d item(s) saved to '%s'.\n", count, path);
+    return true;
+}
+
+/* snapshot_write() to SNAPSHOT_FILE. */
+static bool snapshot_save(const StoreImage *im, bool announce) {
+    return snapshot_write(im, SNAPSHOT_FILE, SNAPSHOT_TMP, announce);
+}
+
+/*
+ * Why a mapped snapshot cannot be adopted, or NULL if it can. Unless
+ * `payload`, the payload checksum is skipped: it is the one check that
+ * reads the whole file (see --lazy-load), so snapshot_adopt() defers
+ * the rest to first use. A compressed one is decoded in full anyway,
+ * so its checksum is always checked.
+ */
+static const char *snapshot_check(const FileView *fv, bool payload) {
+    const SnapHeader *h = (const SnapHeader *)fv->data;
+    if (snapz_is(fv)) return snapz_check(fv);
+    if (fv->len < sizeof *h || memcmp(h->magic, SNAP_MAGIC, sizeof h->magic) != 0)
+        return "not a snapshot";
+    if (h->version != SNAP_VERSION || h->byte_order != SNAP_BYTE_ORDER ||
+        h->chunk_items != ITEM_CHUNK || h->chunk_bytes != sizeof(ItemChunk) ||
+        h->shards != INDEX_SHARDS || h->money_digits != MONEY_DIGITS)
+        return "written by a different build";
+    if (h->header_sum != snap_header_sum(h) || h->file_size != fv->len)
+        return "damaged header";
+    if (h->count > INT_MAX || h->name_blocks > NAME_MAX_BLOCKS)
+        return "damaged header";
+
+    uint64_t tables = sizeof *h + INDEX_SHARDS * sizeof(SnapShard)
+                    + (uint64_t)h->name_blocks * sizeof(SnapBlock);
+    if (tables > fv->len) return "truncated";
+    if (payload && snap_checksum(fv->data + sizeof *h, fv->len - sizeof *h) != h->payload_sum)
+        return "checksum mismatch";
+
+    /*
+     * The offsets must be self-consistent. Under the checksum so is what
+     * they point at; without it the tables are only bounded here, and
+     * their contents are checked as they are first used (snap_check()).
+     */
+    const SnapShard *sh = (const SnapShard *)(fv->data + sizeof *h);
+    const SnapBlock *bl = (const SnapBlock *)(sh + INDEX_SHARDS);
+    uint64_t used = 0;
+    for (int s = 0; s < INDEX_SHARDS; s++) {
+        if (sh[s].cap & (sh[s].cap - 1)) return "bad index table";
+        if (sh[s].off % sizeof(IndexSlot) || sh[s].off > fv->len ||
+            sh[s].cap > (fv->len - sh[s].off) / sizeof(IndexSlot) || sh[s].used * 2 > sh[s].cap)
+            return "bad index table";
+        used += sh[s].used;
+    }
+    if (used != h->count) return "bad index table";
+    for (uint32_t b = 0; b < h->name_blocks; b++)
+        if (bl[b].off > fv->len || bl[b].size > fv->len - bl[b].off)
+            return "bad name block";
+    uint64_t nchunks = (h->count + ITEM_CHUNK - 1) / ITEM_CHUNK;
+    if (fv->len < nchunks * sizeof(ItemChunk) ||
+        (fv->len - nchunks * sizeof(ItemChunk)) % SNAP_PAGE)
+        return "bad chunk area";
+    return NULL;
+}
+
+/*
+ * snapshot_adopt
+ *   Makes the checked snapshot mapping `fv` the item store, replacing
+ *   any snapshot adopted before (a follower's resync). The mapping is
+ *   charged to --mem-limit as a whole for as long as it is held. With
+ *   --lazy-load its clean pages are not, being the OS's cache, read on
+ *   first use and reclaimed under pressure: a section is charged once
+ *   written, and checked once first read (see "Deferred snapshot
+ *   checks"). *lsn is set to the last logged change it includes.
+ *   Returns false with errno = ENOMEM, leaving the store and `fv`
+ *   untouched, when it does not fit.
+ */
+static bool snapshot_adopt(FileView *fv, uint64_t *lsn) {
+    const SnapHeader *h = (const SnapHeader *)fv->data;
+    size_t charge = g_lazy_load ? 0 : fv->len;
+    size_t used = atomic_fetch_add(&g_mem_used, charge) + charge;
+    size_t nchunks = ((size_t)h->count + ITEM_CHUNK - 1) / ITEM_CHUNK;
+    size_t dir = 16;
+    while (dir < nchunks) dir *= 2;
+    ItemChunk    **chunks = NULL;
+    uint64_t      *epochs = NULL;
+    atomic_uchar  *lazy   = NULL;
+    if ((g_mem_limit && used > g_mem_limit) || !(chunks = mem_alloc(dir * sizeof *chunks)) ||
+        !(epochs = mem_alloc(dir * sizeof *epochs)) ||
+        (g_lazy_load && nchunks && !(lazy = mem_alloc(nchunks)))) {
+        mem_free(chunks, dir * sizeof *chunks);
+        mem_free(epochs, dir * sizeof *epochs);
+        atomic_fetch_sub(&g_mem_used, charge);
+        errno = ENOMEM;
+        return false;
+    }
+
+    store_clear(true);
+    snapshot_release();
+#ifdef POSIX_MADV_RANDOM
+    /* Lookups touch the index, name and chunk pages of one item each. */
+    if (g_lazy_load) posix_madvise(fv->base, fv->len, POSIX_MADV_RANDOM);
+#endif
+    char *base = fv->base;
+    const SnapShard *sh = (const SnapShard *)(base + sizeof *h);
+    const SnapBlock *bl = (const SnapBlock *)(sh + INDEX_SHARDS);
+    char *chunk_area = base + fv->len - nchunks * sizeof(ItemChunk);
+    for (size_t c = 0; c < nchunks; c++)
+        chunks[c] = (ItemChunk *)(chunk_area + c * sizeof(ItemChunk));
+    memset(epochs, 0, nchunks * sizeof *epochs);
+    g_chunks = chunks; g_chunk_epoch = epochs; g_chunk_cnt = nchunks; g_chunk_dir = dir;
+    for (int s = 0; s < INDEX_SHARDS; s++) {
+        g_shards[s] = (IndexShard){ sh[s].cap ? (IndexSlot *)(base + sh[s].off) : NULL,
+                                    (size_t)sh[s].cap, (size_t)sh[s].used };
+        stat_slots(g_shards[s].cap);
+    }
+    for (uint32_t b = 0; b < h->name_blocks; b++) {
+        g_name_blocks[b]   = base + bl[b].off;
+        g_name_block_sz[b] = (size_t)bl[b].size;
+    }
+    g_name_nblocks = h->name_blocks;
+    g_name_cur     = (NameCursor){ 0, 0, 0 }; /* new names go to fresh blocks */
+    g_name_live    = (size_t)h->name_bytes;
+    g_count        = (int)h->count;
+    stat_items();
+    g_total_cents  = h->total_cents;
+    g_total_units  = h->total_units;
+    g_seq_next     = (uint32_t)h->seq_next;
+    *lsn           = h->lsn;
+
+    g_snap        = *fv;
+    g_snap_charge = charge;
+    g_snap_lo     = (uintptr_t)fv->base;
+    g_snap_hi     = g_snap_lo + fv->len;
+    if (lazy) {
+        uint_fast64_t shards = 0;
+        size_t        left   = nchunks;
+        for (int s = 0; s < INDEX_SHARDS; s++)
+            if (g_shards[s].cap) { shards |= (uint_fast64_t)1 << s; left++; }
+        for (size_t c = 0; c < nchunks; c++) atomic_init(&lazy[c], SNAP_UNCHECKED);
+        g_lazy.chunk   = lazy;
+        g_lazy.nchunks = nchunks;
+        g_lazy.count   = g_count;
+        g_lazy.nblocks = g_name_nblocks;
+        atomic_store(&g_lazy.shard_unchecked, shards);
+        atomic_store(&g_lazy.left, left);
+    }
+    totals_check("snapshot load");
+    return true;
+}
+
+/*
+ * snapshot_install
+ *   Makes the checked snapshot `fv` the item store: adopts the mapping,
+ *   or decodes a compressed one and closes `fv`. False, as for
+ *   snapshot_adopt(), with errno = ENOMEM when it does not fit and
+ *   EINVAL when a compressed one proves inconsistent; `fv` is then
+ *   still for the caller to close.
+ */
+static bool snapshot_install(FileView *fv, uint64_t *lsn) {
+    if (!snapz_is(fv)) return snapshot_adopt(fv, lsn);
+    bool ok = snapz_decode(fv, lsn);
+    int  e  = errno;
+    file_view_close(fv);
+    errno = e;
+    return ok;
+}
+
+/*
+ * snapshot_load
+ *   Adopts SNAPSHOT_FILE as the item store when it exists, is intact and
+ *   is at least as current as INVENTORY_FILE. Returns false (leaving the
+ *   store untouched) when the CSV should be loaded instead.
+ */
+static bool snapshot_load(uint64_t *lsn) {
+    FileView fv;
+    if (!file_view_open(SNAPSHOT_FILE, &fv, true)) {
+        if (errno != ENOENT)
+            fprintf(stderr, "[WARN] Cannot open '%s': %s – importing '%s'.\n",
+                    SNAPSHOT_FILE, strerror(errno), INVENTORY_FILE);
+        return false;
+    }
+    FileAhead ahead; /* the checksum reads the whole file */
+    bool      whole = !g_lazy_load || snapz_is(&fv);
+    if (whole) file_ahead_start(&ahead, &fv);
+    const char *why = fv.mapped || fv.len == 0 ? snapshot_check(&fv, !g_lazy_load) : "not mappable";
+    if (whole) file_ahead_stop(&ahead);
+    if (why) {
+        fprintf(stderr, "[WARN] Ignoring '%s' (%s) – importing '%s'.\n",
+                SNAPSHOT_FILE, why, INVENTORY_FILE);
+        file_view_close(&fv);
+        return false;
+    }
+
+    const SnapHeader *h = (const SnapHeader *)fv.data;
+    int64_t csv_size, csv_mtime;
+    csv_stamp(&csv_size, &csv_mtime);
+    if (csv_size != h->csv_size || csv_mtime != h->csv_mtime) {
+        printf("[INFO] '%s' changed since '%s' was written – importing it.\n",
+               INVENTORY_FILE, SNAPSHOT_FILE);
+        file_view_close(&fv);
+        return false;
+    }
+    bool mapped = !snapz_is(&fv);
+    if (!snapshot_install(&fv, lsn)) {
+        fprintf(stderr, "[WARN] '%s' %s – importing '%s'.\n", SNAPSHOT_FILE,
+                errno == ENOMEM ? "does not fit in memory" : "is inconsistent", INVENTORY_FILE);
+        file_view_close(&fv);
+        return false;
+    }
+    if (!mapped)     printf("[INFO] Decoded %d item(s) from '%s'.\n", g_count, SNAPSHOT_FILE);
+    else if (g_lazy_load) printf("[INFO] Mapped %d item(s) from '%s'; paging in on use.\n", g_count, SNAPSHOT_FILE);
+    else             printf("[INFO] Loaded %d item(s) from '%s'.\n", g_count, SNAPSHOT_FILE);
+    return true;
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Write-ahead log
+ *    Every change is appended to WAL_FILE as one record holding the
+ *    item's resulting state (PUT), a change in its quantity (ADJ) or
+ *    its removal (DEL), so persisting a stock change costs O(1) bytes.
+ *    ADJ records come from lock-free updates (see item_adjust()); they
+ *    commute, so concurrent ones replay correctly in any order. Records carry increasing LSNs; a
+ *    snapshot stores the LSN it includes and startup replays only newer
+ *    records. Syncs are batched by a flusher thread, so writers that
+ *    arrive while an fsync is running share the next one (group
+ *    commit). Once the log passes WAL_CHECKPOINT_BYTES, a background
+ *    checkpoint folds a pinned image of the store into a fresh snapshot
+ *    and trims the log.
+ * ══════════════════════════════════════════════════════════════ */
+
+#define WAL_MAGIC    "INVWAL3" /* 8 bytes with the terminator           */
+#define WAL_MAGIC_V2 "INVWAL2" /* prices as doubles; replayed, then folded */
+#define WAL_MAGIC_V1 "INVWAL1" /* as V2 without WAL_ADJ                  */
+#define WAL_HEADER_V2 16       /* V1/V2 header: magic and base_lsn only  */
+
+typedef struct {
+    char     magic[8];
+    uint64_t base_lsn;     /* LSN of the snapshot this log continues */
+    uint32_t money_digits; /* MONEY_DIGITS of the prices logged      */
+    uint32_t pad;
+} WalHeader;
+
+enum { WAL_PUT = 1, WAL_DEL = 2, WAL_ADJ = 3 };
+
+/* One log record; the item name (name_len bytes) follows it. */
+typedef struct {
+    uint64_t sum;      /* snap_checksum() of the rest, name included */
+    uint64_t lsn;
+    Money    price;    /* WAL_PUT: unit price after the change       */
+    int32_t  qty;      /* WAL_PUT: quantity after; WAL_ADJ: change   */
+    uint32_t name_len;
+    uint8_t  op;       /* WAL_PUT, WAL_DEL or WAL_ADJ                */
+    uint8_t  pad[7];
+} WalRec;
+
+static struct {
+    Mutex    lock;
+    Cond     wake;      /* to the flusher: new records, or stop       */
+    Cond     synced;    /* from the flusher: an fsync finished        */
+    SysFile  fd;
+    bool     open;      /* appending (durability above off)           */
+    bool     failed;    /* a write or sync failed; logging stopped    */
+    bool     stop;      /* flusher should exit                        */
+    bool     syncing;   /* flusher is inside sys_sync(fd)             */
+    uint64_t next_lsn;  /* LSN for the next record                    */
+    uint64_t written;   /* last LSN handed to the OS                  */
+    uint64_t durable;   /* last LSN known to be on disk               */
+    uint64_t bytes;     /* log size                                   */
+    uint64_t ckpt_at;   /* log size that triggers the next checkpoint */
+    Thread   flusher;
+    TaskArg  flusher_arg;
+    bool     flusher_on;
+    bool     batching;  /* records collect in pend until wal_commit() */
+    char    *pend;
+    size_t   pend_len, pend_cap;
+    uint64_t pend_lsn;  /* last LSN in pend                           */
+} g_wal = { .fd = SYS_FILE_NONE };
+
+/* Last LSN the calling thread logged, for wal_wait(). */
+static _Thread_local uint64_t g_wal_mine;
+
+/* Set instead of checkpointing inline while serving (see serve_after()). */
+static atomic_bool g_ckpt_due;
+
+/* Sees every run of records as it is written, with the lock held (see "Replication"). */
+static void (*g_wal_tap)(const char *rec, size_t n);
+
+/* Background checkpoint state (started and joined by one thread at a time). */
+static struct {
+    StoreImage  im;      /* pinned image being written    */
+    uint64_t    cut;     /* log bytes the image covers    */
+    Thread      th;
+    TaskArg     arg;
+    bool        running; /* started and not yet joined    */
+    atomic_bool done;
+} g_ckpt;
+
+/*
+ * One save_inventory() or export at a time, as they write through fixed
+ * temporary names; g_saving holds off checkpoints during a save.
+ */
+static Mutex       g_save_lock;
+static atomic_bool g_saving;
+
+/* Report a log failure once and stop logging. Called with the lock held. */
+static void wal_fail(const char *what) {
+    if (g_wal.failed) return;
+    g_wal.failed = true;
+    fprintf(stderr, "[ERROR] Cannot %s '%s': %s – further changes are not logged "
+                    "until the next save.\n", what, WAL_FILE, strerror(errno));
+    cond_broadcast(&g_wal.synced);
+}
+
+/*
+ * wal_flusher
+ *   Flusher thread: whenever records are pending, fsyncs the log once
+ *   for all of them. Under --durability=group it first waits up to
+ *   WAL_GROUP_MS so a burst of changes is covered by one fsync.
+ */
+static void wal_flusher(void *ctx, int worker) {
+    (void)ctx; (void)worker;
+    mutex_lock(&g_wal.lock);
+    while (!g_wal.stop) {
+        if (g_wal.written == g_wal.durable || g_wal.failed) {
+            cond_wait_ms(&g_wal.wake, &g_wal.lock, -1);
+            continue;
+        }
+        if (g_durability == DUR_GROUP) {
+            cond_wait_ms(&g_wal.wake, &g_wal.lock, WAL_GROUP_MS);
+            if (g_wal.stop) break;
+        }
+        uint64_t target = g_wal.written;
+        g_wal.syncing = true;
+        mutex_unlock(&g_wal.lock);
+        bool ok = sys_sync(g_wal.fd);
+        mutex_lock(&g_wal.lock);
+        g_wal.syncing = false;
+        if (!ok) wal_fail("sync");
+        else if (target > g_wal.durable) g_wal.durable = target;
+        cond_broadcast(&g_wal.synced);
+    }
+    mutex_unlock(&g_wal.lock);
+}
+
+/*
+ * wal_rewrite
+ *   Replaces the log with one continuing from `lsn`, keeping the records
+ *   from byte `cut` on (those appended after the store image for `lsn`
+ *   was taken). Called with the lock held. On failure the old log stays;
+ *   it is still correct, only longer.
+ */
+static bool wal_rewrite(uint64_t lsn, uint64_t cut) {
+    while (g_wal.syncing) cond_wait_ms(&g_wal.synced, &g_wal.lock, -1);
+
+    FileView fv;
+    if (!file_view_open(WAL_FILE, &fv, false)) return false;
+    if (cut > fv.len) cut = fv.len;
+    AtomicFile f;
+    if (!afile_open(&f, WAL_FILE, WAL_TMP)) { file_view_close(&fv); return false; }
+    WalHeader h;
+    memset(&h, 0, sizeof h);
+    memcpy(h.magic, WAL_MAGIC, sizeof h.magic);
+    h.base_lsn = lsn;
+    h.money_digits = MONEY_DIGITS;
+    afile_write(&f, &h, sizeof h);
+    afile_write(&f, fv.data + cut, fv.len - cut);
+    uint64_t size = f.off;
+    file_view_close(&fv);
+    if (!afile_commit(&f)) return false;
+
+    /* The old descriptor now refers to the replaced file. */
+    SysFile fd = sys_open_write(WAL_FILE, true);
+    if (fd == SYS_FILE_NONE) { wal_fail("reopen"); return false; }
+    sys_close(g_wal.fd);
+    g_wal.fd      = fd;
+    g_wal.bytes   = size;
+    g_wal.ckpt_at = size + WAL_CHECKPOINT_BYTES;
+    g_wal.durable = g_wal.written;
+    return true;
+}
+
+static void ckpt_task(void *ctx, int worker) {
+    (void)ctx; (void)worker;
+    if (snapshot_save(&g_ckpt.im, false)) {
+        mutex_lock(&g_wal.lock);
+        if (g_wal.open && !g_wal.failed) wal_rewrite(g_ckpt.im.lsn, g_ckpt.cut);
+        mutex_unlock(&g_wal.lock);
+    }
+    store_unpin(&g_ckpt.im);
+    atomic_store(&g_ckpt.done, true);
+}
+
+/* Wait for a background checkpoint, if one is running. */
+static void ckpt_join(void) {
+    if (!g_ckpt.running) return;
+    thread_join(g_ckpt.th);
+    g_ckpt.running = false;
+}
+
+/*
+ * wal_checkpoint
+ *   Pins the store and hands it to a helper thread, which writes it as
+ *   the new snapshot and trims the log to the records appended in the
+ *   meantime. Skipped while a previous checkpoint or a save is running.
+ */
+static void wal_checkpoint(void) {
+    if (atomic_load(&g_saving)) return;
+    if (g_ckpt.running) {
+        if (!atomic_load(&g_ckpt.done)) return;
+        ckpt_join();
+    }
+#ifdef _WIN32
+    if (!snapshot_detach()) return;
+#endif
+    mutex_lock(&g_wal.lock);
+    uint64_t lsn = g_wal.next_lsn - 1, cut = g_wal.bytes;
+    g_wal.ckpt_at = cut + WAL_CHECKPOINT_BYTES; /* retry later on failure */
+    mutex_unlock(&g_wal.lock);
+    if (!store_pin(&g_ckpt.im, lsn)) {
+        if (!snap_failed())
+            fprintf(stderr, "[WARN] Not enough memory to checkpoint '%s'; it keeps growing.\n",
+                    WAL_FILE);
+        return;
+    }
+    g_ckpt.cut = cut;
+    atomic_store(&g_ckpt.done, false);
+    g_ckpt.arg = (TaskArg){ ckpt_task, NULL, 0 };
+    if (thread_start(&g_ckpt.th, &g_ckpt.arg)) g_ckpt.running = true;
+    else ckpt_task(NULL, 0);
+}
+
+/* The log is due for a checkpoint: take it now, or flag it while serving. */
+static void wal_due(void) {
+    if (g_serving) atomic_store(&g_ckpt_due, true);
+    else           wal_checkpoint();
+}
+
+/*
+ * wal_handed
+ *   Bookkeeping after records up to `lsn` (n bytes) reached the OS:
+ *   waits or wakes the flusher as --durability requires. Called with
+ *   the lock held; `clean` tells whether the log was fully synced before.
+ *   While serving the sync wait is left to wal_wait(), after the caller
+ *   has released its store locks.
+ */
+static void wal_handed(uint64_t lsn, size_t n, bool clean) {
+    g_wal.written = lsn;
+    g_wal.bytes  += n;
+    if (g_durability == DUR_SYNC) {
+        cond_signal(&g_wal.wake);
+        while (!g_serving && g_wal.durable < lsn && !g_wal.failed)
+            cond_wait_ms(&g_wal.synced, &g_wal.lock, -1);
+    } else if (g_durability == DUR_GROUP && clean) {
+        cond_signal(&g_wal.wake);
+    }
+}
+
+/*
+ * wal_append
+ *   Logs one change, then waits as long as --durability requires. In a
+ *   batch (wal_batch()) the record is only queued; wal_commit() writes
+ *   and syncs the whole batch at once. A no-op when the log is off or
+ *   has failed.
+ */
+static void wal_append(uint8_t op, const char *name, size_t len, int32_t qty, Money price) {
+    if (!g_wal.open) return;
+    size_t n = sizeof(WalRec) + len;
+    char   stack[512];
+    char  *buf = NULL;
+    WalRec r;
+    memset(&r, 0, sizeof r);
+    r.price = price; r.qty = qty; r.name_len = (uint32_t)len; r.op = op;
+
+    mutex_lock(&g_wal.lock);
+    if (g_wal.batching && g_wal.pend_len + n > g_wal.pend_cap) {
+        size_t cap = g_wal.pend_cap ? g_wal.pend_cap : SAVE_BUF;
+        while (cap < g_wal.pend_len + n) cap *= 2;
+        char *p = realloc(g_wal.pend, cap);
+        if (p) { g_wal.pend = p; g_wal.pend_cap = cap; }
+    }
+    if (g_wal.batching) buf = g_wal.pend_len + n <= g_wal.pend_cap ? g_wal.pend + g_wal.pend_len : NULL;
+    else                buf = n <= sizeof stack ? stack : malloc(n);
+    if (!buf) {
+        errno = ENOMEM;
+        wal_fail("append to");
+    } else if (!g_wal.failed) {
+        r.lsn = g_wal.next_lsn++;
+        memcpy(buf, &r, sizeof r);
+        memcpy(buf + sizeof r, name, len);
+        r.sum = snap_checksum(buf + sizeof r.sum, n - sizeof r.sum);
+        memcpy(buf, &r.sum, sizeof r.sum);
+        g_wal_mine = r.lsn;
+        if (g_wal.batching) {
+            g_wal.pend_len += n;
+            g_wal.pend_lsn  = r.lsn;
+        } else {
+            bool clean = g_wal.written == g_wal.durable;
+            if (sys_write_all(g_wal.fd, buf, n)) {
+                if (g_wal_tap) g_wal_tap(buf, n);
+                wal_handed(r.lsn, n, clean);
+            } else {
+                wal_fail("append to");
+            }
+        }
+    }
+    bool batching = g_wal.batching;
+    bool due = !batching && !g_wal.failed && g_wal.bytes >= g_wal.ckpt_at;
+    mutex_unlock(&g_wal.lock);
+    if (!batching && buf != stack) free(buf);
+    if (due) wal_due();
+}
+
+/*
+ * wal_wait
+ *   Under --durability=sync, waits until the log is on disk up to `lsn`
+ *   (normally g_wal_mine). Server workers call it once per batch of
+ *   requests with no store lock held, so concurrent clients share the
+ *   flusher's fsyncs.
+ */
+static void wal_wait(uint64_t lsn) {
+    if (!g_wal.open || g_durability != DUR_SYNC) return;
+    mutex_lock(&g_wal.lock);
+    while (g_wal.durable < lsn && !g_wal.failed)
+        cond_wait_ms(&g_wal.synced, &g_wal.lock, -1);
+    mutex_unlock(&g_wal.lock);
+}
+
+/* Start queueing records for one wal_commit(). */
+static void wal_batch(void) {
+    if (g_wal.open) g_wal.batching = true;
+}
+
+/*
+ * wal_commit
+ *   Ends a batch: writes the queued records with one call and, under
+ *   --durability=sync, waits for a single fsync covering all of them.
+ */
+static void wal_commit(void) {
+    if (!g_wal.batching) return;
+    mutex_lock(&g_wal.lock);
+    g_wal.batching = false;
+    if (g_wal.pend_len && !g_wal.failed) {
+        bool clean = g_wal.written == g_wal.durable;
+        if (sys_write_all(g_wal.fd, g_wal.pend, g_wal.pend_len)) {
+            if (g_wal_tap) g_wal_tap(g_wal.pend, g_wal.pend_len);
+            wal_handed(g_wal.pend_lsn, g_wal.pend_len, clean);
+        } else {
+            wal_fail("append to");
+        }
+    }
+    g_wal.pend_len = 0;
+    bool due = !g_wal.failed && g_wal.bytes >= g_wal.ckpt_at;
+    mutex_unlock(&g_wal.lock);
+    if (due) wal_due();
+}
+
+/* Log the current state of item idx. */
+static void wal_put(int idx) {
+    wal_append(WAL_PUT, name_str(ITEM_NAME(idx)), ITEM_LEN(idx), ITEM_QTY(idx), ITEM_PRICE(idx));
+}
+
+/* Log a change of `delta` units to item idx. */
+static void wal_adj(int idx, int32_t delta) {
+    wal_append(WAL_ADJ, name_str(ITEM_NAME(idx)), ITEM_LEN(idx), delta, 0);
+}
+
+/* Log the removal of `name`. */
+static void wal_del(const char *name, size_t len) {
+    wal_append(WAL_DEL, name, len, 0, 0);
+}
+
+/*
+ * wal_apply
+ *   Applies one logged change to the store: replayed at startup, or
+ *   received by a follower. Returns false when the store is full or
+ *   damaged.
+ */
+static bool wal_apply(const WalRec *r, const char *name) {
+    uint32_t hash = name_hash(name, r->name_len);
+    if (!snap_ready(hash) || !snap_ready_shape(r->op == WAL_DEL)) return false;
+    if (r->op == WAL_PUT) return store_put(name, r->name_len, r->qty, r->price);
+    IndexSlot *slot = index_probe(name, r->name_len, hash);
+    int idx = slot->idx;
+    if (idx >= 0 && r->op == WAL_DEL) store_delete(slot);
+    /* May pass through out-of-range values when concurrent
+     * changes were logged out of order; the sum is exact. */
+    if (idx >= 0 && r->op == WAL_ADJ)
+        item_set(idx, (int32_t)((uint32_t)ITEM_QTY(idx) + (uint32_t)r->qty), ITEM_PRICE(idx));
+    return true;
+}
+
+/*
+ * wal_start
+ *   Replays WAL_FILE over the loaded store, then opens it for appending
+ *   unless --durability=off. `snap_lsn` is the LSN the store includes
+ *   when it came from a snapshot; a store imported from the CSV is taken
+ *   to match the log's base. Returns false on a fatal error.
+ */
+static bool wal_start(bool from_snapshot, uint64_t snap_lsn) {
+    mutex_init(&g_wal.lock);
+    mutex_init(&g_save_lock);
+    cond_init(&g_wal.wake);
+    cond_init(&g_wal.synced);
+
+    uint64_t last = from_snapshot ? snap_lsn : 0, good = 0;
+    bool legacy = false;
+    FileView fv;
+    bool have = file_view_open(WAL_FILE, &fv, false);
+    if (!have && errno != ENOENT) {
+        fprintf(stderr, "[ERROR] Cannot open '%s': %s\n", WAL_FILE, strerror(errno));
+        return false;
+    }
+    if (have) {
+        WalHeader h;
+        memset(&h, 0, sizeof h);
+        legacy = fv.len >= WAL_HEADER_V2 && (memcmp(fv.data, WAL_MAGIC_V2, sizeof h.magic) == 0 ||
+                                             memcmp(fv.data, WAL_MAGIC_V1, sizeof h.magic) == 0);
+        if (!legacy && (fv.len < sizeof h || memcmp(fv.data, WAL_MAGIC, sizeof h.magic) != 0)) {
+            fprintf(stderr, "[ERROR] '%s' is not a write-ahead log; move it aside to continue.\n",
+                    WAL_FILE);
+            file_view_close(&fv);
+            return false;
+        }
+        memcpy(&h, fv.data, legacy ? WAL_HEADER_V2 : sizeof h);
+        if (!legacy && h.money_digits != MONEY_DIGITS) {
+            fprintf(stderr, "[ERROR] '%s' was written with %u price decimal(s), this build "
+                            "uses %d; replay it with that build and save.\n",
+                    WAL_FILE, h.money_digits, MONEY_DIGITS);
+            file_view_close(&fv);
+            return false;
+        }
+        uint64_t from = from_snapshot ? snap_lsn : h.base_lsn;
+        if (from_snapshot && h.base_lsn > snap_lsn)
+            fprintf(stderr, "[WARN] '%s' continues a newer snapshot than '%s'; "
+                            "some changes may be missing.\n", WAL_FILE, SNAPSHOT_FILE);
+        if (h.base_lsn > last) last = h.base_lsn;
+
+        size_t pos = legacy ? WAL_HEADER_V2 : sizeof h;
+        int  applied = 0;
+        bool full = false;
+        while (pos + sizeof(WalRec) <= fv.len) {
+            WalRec r;
+            memcpy(&r, fv.data + pos, sizeof r);
+            if (r.name_len > fv.len - pos - sizeof r) break;
+            size_t n = sizeof r + r.name_len;
+            if (snap_checksum(fv.data + pos + sizeof r.sum, n - sizeof r.sum) != r.sum) break;
+            const char *name = fv.data + pos + sizeof r;
+            pos += n;
+            if (r.lsn > last) last = r.lsn;
+            if (r.lsn <= from || full) continue;
+            if (legacy) {
+                double d;
+                memcpy(&d, &r.price, sizeof d);
+                r.price = d >= 0 && d < (double)MONEY_MAX ? (Money)(d * MONEY_SCALE + 0.5) : 0;
+            }
+            full = !wal_apply(&r, name);
+            applied += !full;
+        }
+        good = pos;
+        if (full && !snap_failed())
+            fprintf(stderr, "[WARN] Memory limit reached replaying '%s'; later changes were "
+                            "not applied.\n", WAL_FILE);
+        if (good < fv.len)
+            fprintf(stderr, "[WARN] '%s': dropping %zu byte(s) of an incomplete record.\n",
+                    WAL_FILE, fv.len - (size_t)good);
+        if (applied)
+            printf("[INFO] Replayed %d change(s) from '%s'.\n", applied, WAL_FILE);
+        have = fv.len > good; /* tail to truncate */
+        file_view_close(&fv);
+        totals_check("replay");
+
+        if (legacy) {
+            /* Fold the converted prices into a snapshot; a fresh log follows it. */
+            StoreImage im;
+            store_image_live(&im, last);
+            bool ok = true;
+#ifdef _WIN32
+            ok = snapshot_detach();
+#endif
+            if (applied && !(ok && snapshot_save(&im, false))) {
+                fprintf(stderr, "[ERROR] Cannot convert '%s' to this version's format; "
+                                "free some space and restart.\n", WAL_FILE);
+                return false;
+            }
+            if (applied)
+                printf("[INFO] Converted '%s' to exact prices in '%s'.\n", WAL_FILE, SNAPSHOT_FILE);
+            good = 0;
+        }
+    }
+    g_wal.next_lsn = last + 1;
+    g_wal.written  = g_wal.durable = last;
+    if (g_durability == DUR_OFF) return true;
+
+    if (good == 0) {
+        /* No log yet: create one continuing from the loaded store. */
+        AtomicFile f;
+        WalHeader h;
+        memset(&h, 0, sizeof h);
+        memcpy(h.magic, WAL_MAGIC, sizeof h.magic);
+        h.base_lsn = last;
+        h.money_digits = MONEY_DIGITS;
+        if (!afile_open(&f, WAL_FILE, WAL_TMP)) {
+            fprintf(stderr, "[ERROR] Cannot create '%s': %s\n", WAL_FILE, strerror(errno));
+            return false;
+        }
+        afile_write(&f, &h, sizeof h);
+        if (!afile_commit(&f)) return false;
+        good = sizeof h;
+    }
+    g_wal.fd = sys_open_write(WAL_FILE, true);
+    if (g_wal.fd == SYS_FILE_NONE || (have && !sys_truncate(g_wal.fd, good))) {
+        fprintf(stderr, "[ERROR] Cannot open '%s' for writing: %s\n", WAL_FILE, strerror(errno));
+        return false;
+    }
+    g_wal.bytes   = good;
+    g_wal.ckpt_at = WAL_CHECKPOINT_BYTES;
+    g_wal.open    = true;
+    if (g_durability >= DUR_GROUP) {
+        g_wal.flusher_arg = (TaskArg){ wal_flusher, NULL, 0 };
+        g_wal.flusher_on  = thread_start(&g_wal.flusher, &g_wal.flusher_arg);
+        if (!g_wal.flusher_on) {
+            fprintf(stderr, "[WARN] Cannot start the log flusher; using --durability=write.\n");
+            g_durability = DUR_WRITE;
+        }
+    }
+    if (g_wal.bytes >= g_wal.ckpt_at) wal_checkpoint();
+    return true;
+}
+
+/* Finish any checkpoint, sync what is pending and close the log. */
+static void wal_close(void) {
+    wal_commit();
+    free(g_wal.pend);
+    g_wal.pend     = NULL;
+    g_wal.pend_cap = 0;
+    ckpt_join();
+    if (!g_wal.open) return;
+    mutex_lock(&g_wal.lock);
+    g_wal.stop = true;
+    cond_signal(&g_wal.wake);
+    mutex_unlock(&g_wal.lock);
+    if (g_wal.flusher_on) thread_join(g_wal.flusher);
+    if (g_durability >= DUR_GROUP && !g_wal.failed && g_wal.written > g_wal.durable)
+        sys_sync(g_wal.fd);
+    sys_close(g_wal.fd);
+    g_wal.open       = false;
+    g_wal.stop       = false; /* wal_start() may follow (--fuzz reopens) */
+    g_wal.flusher_on = false;
+}
+
+/*
+ * save_inventory
+ *   Writes the binary snapshot, which then covers every logged change,
+ *   and trims the log to what was appended meanwhile. Unless
+ *   --snapshot-only the CSV is exported first, so the snapshot records
+ *   its stamp. Both are written from a pinned image, so while serving
+ *   other clients only wait for the pin. Returns true on success.
+ */
+static bool save_inventory(void) {
+    uint64_t t0 = stat_begin();
+    mutex_lock(&g_save_lock);
+    if (g_pin_gate) g_pin_gate(true);
+    wal_commit();
+    ckpt_join();
+    StoreImage im;
+    bool pinned = true;
+#ifdef _WIN32
+    pinned = snapshot_detach();
+#endif
+    mutex_lock(&g_wal.lock);
+    uint64_t lsn = g_wal.next_lsn - 1, cut = g_wal.bytes;
+    mutex_unlock(&g_wal.lock);
+    pinned = pinned && store_pin(&im, lsn);
+    if (pinned) atomic_store(&g_saving, true);
+    if (g_pin_gate) g_pin_gate(false);
+    if (!pinned) {
+        if (snap_failed())
+            fprintf(stderr, "[ERROR] Not saved: the store read from '%s' is damaged.\n",
+                    SNAPSHOT_FILE);
+        else
+            fprintf(stderr, "[ERROR] Out of memory saving '%s'.\n", SNAPSHOT_FILE);
+        mutex_unlock(&g_save_lock);
+        return false;
+    }
+
+    bool ok = g_snapshot_only || export_csv(&im);
+    if (snapshot_save(&im, true)) {
+        mutex_lock(&g_wal.lock);
+        if (g_wal.open) {
+            /* A log that failed is rebuilt from scratch if the snapshot has it all. */
+            if (wal_rewrite(lsn, cut) && g_wal.failed && g_wal.next_lsn - 1 == lsn) {
+                g_wal.failed = false;
+                g_wal.written = g_wal.durable = lsn;
+            }
+        } else {
+            remove(WAL_FILE);
+        }
+        mutex_unlock(&g_wal.lock);
+    } else {
+        ok = false;
+    }
+    store_unpin(&im);
+    atomic_store(&g_saving, false);
+    mutex_unlock(&g_save_lock);
+    if (ok) stat_end(STAT_SAVE, t0);
+    return ok;
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Core inventory operations
+ * ══════════════════════════════════════════════════════════════ */
+
+/* Outcome of an inventory operation. */
+typedef enum {
+    OP_OK,
+    OP_BAD_NAME,   /* empty or oversized name             */
+    OP_BAD_QTY,    /* quantity out of range for the op    */
+    OP_BAD_PRICE,  /* negative price                      */
+    OP_NOT_FOUND,
+    OP_OVERFLOW,   /* quantity would exceed INT32_MAX     */
+    OP_INDEX_FULL, /* name index cannot grow              */
+    OP_FULL,       /* item store or name pool exhausted   */
+    OP_SHORT,      /* fewer units in stock than requested */
+    OP_DAMAGED     /* lazily loaded snapshot found damaged */
+} OpStatus;
+
+/* Describe a failed operation on `name` (same wording as the menu). */
+static void op_text(OpStatus st, const char *name, size_t len, bool adding,
+                    char *buf, size_t n) {
+    int nl = len > LINE_BUF ? LINE_BUF : (int)len;
+    switch (st) {
+        case OP_BAD_NAME:   snprintf(buf, n, "Invalid item name."); break;
+        case OP_BAD_QTY:    snprintf(buf, n, adding ? "Quantity must be > 0."
+                                                    : "Quantity cannot be negative."); break;
+        case OP_BAD_PRICE:  snprintf(buf, n, "Price cannot be negative."); break;
+        case OP_NOT_FOUND:  snprintf(buf, n, "'%.*s' not found in inventory.", nl, name); break;
+        case OP_OVERFLOW:   snprintf(buf, n, "Quantity of '%.*s' would overflow.", nl, name); break;
+        case OP_INDEX_FULL: snprintf(buf, n, "Out of memory growing name index."); break;
+        case OP_FULL:       snprintf(buf, n, "Inventory full (memory limit %zu bytes).",
+                                     g_mem_limit); break;
+        case OP_SHORT:      snprintf(buf, n, "Not enough '%.*s' in stock.", nl, name); break;
+        case OP_DAMAGED:    snprintf(buf, n, "Snapshot '%s' is damaged; restart to reload.",
+                                     SNAPSHOT_FILE); break;
+        default:            snprintf(buf, n, "OK"); break;
+    }
+}
+
+static bool op_report(OpStatus st, const char *name, bool adding) {
+    if (st == OP_OK) return true;
+    char msg[LINE_BUF + 64];
+    op_text(st, name, name ? strlen(name) : 0, adding, msg, sizeof msg);
+    fprintf(stderr, "[ERROR] %s\n", msg);
+    return false;
+}
+
+/* Add qty units to item idx and set its price, logging the change. */
+static OpStatus item_restock(int idx, int qty, Money price) {
+    if (ITEM_QTY(idx) > INT32_MAX - qty) return OP_OVERFLOW;
+    item_set(idx, ITEM_QTY(idx) + qty, price);
+    wal_put(idx);
+    return OP_OK;
+}
+
+/*
+ * Lock-free quantity updates. Point requests run concurrently while
+ * serving, so the counter is changed with a compare-and-swap loop (or
+ * an exchange) and never read-modify-written. The change is logged as a
+ * relative WAL_ADJ record so replay does not depend on the order in
+ * which racing updates reached the log. Prices only change while the
+ * store is held exclusively, so the totals delta is exact. The column
+ * is plain int32_t (chunks are copied and mapped as bytes), so these go
+ * through the compiler's atomic builtins on it rather than _Atomic.
+ */
+#if defined(__GNUC__)
+static inline int32_t qty_load(int32_t *q) {
+    return __atomic_load_n(q, __ATOMIC_RELAXED);
+}
+
+static inline bool qty_cas(int32_t *q, int32_t *cur, int32_t to) {
+    return __atomic_compare_exchange_n(q, cur, to, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static inline int32_t qty_exchange(int32_t *q, int32_t to) {
+    return __atomic_exchange_n(q, to, __ATOMIC_RELAXED);
+}
+#else
+static inline int32_t qty_load(int32_t *q) {
+    return (int32_t)InterlockedCompareExchange((volatile LONG *)q, 0, 0);
+}
+
+static inline bool qty_cas(int32_t *q, int32_t *cur, int32_t to) {
+    int32_t was = (int32_t)InterlockedCompareExchange((volatile LONG *)q, to, *cur);
+    if (was == *cur) return true;
+    *cur = was;
+    return false;
+}
+
+static inline int32_t qty_exchange(int32_t *q, int32_t to) {
+    return (int32_t)InterlockedExchange((volatile LONG *)q, to);
+}
+#endif
+
+/*
+ * item_adjust
+ *   Changes item idx's stock by `delta` if the result stays within
+ *   0..INT32_MAX; fails with OP_SHORT (or OP_OVERFLOW) without touching
+ *   it otherwise. *now receives the new quantity.
+ */
+static OpStatus item_adjust(int idx, int32_t delta, int32_t *now) {
+    ITEM_OWN(idx); /* a no-op under the shared gate: see serve_point() */
+    int32_t *q   = &ITEM_QTY(idx);
+    int32_t  cur = qty_load(q);
+    do {
+        if (delta < 0 && cur < -delta)            return OP_SHORT;
+        if (delta > 0 && cur > INT32_MAX - delta) return OP_OVERFLOW;
+    } while (!qty_cas(q, &cur, cur + delta));
+    totals_add(delta, (Money)delta * ITEM_PRICE(idx));
+    ord_touch(idx);
+    wal_adj(idx, delta);
+    *now = cur + delta;
+    return OP_OK;
+}
+
+/* Set item idx's stock to qty (>= 0) atomically; logged as the change. */
+static void item_exchange(int idx, int32_t qty) {
+    ITEM_OWN(idx);
+    int32_t old   = qty_exchange(&ITEM_QTY(idx), qty);
+    int32_t delta = qty - old;
+    totals_add(delta, (Money)delta * ITEM_PRICE(idx));
+    if (delta) { ord_touch(idx); wal_adj(idx, delta); }
+}
+
+/*
+ * inv_reserve / inv_release
+ *   Take k units of an item (only if at least k remain: stock never goes
+ *   negative) or put k back. Lock-free on the item's counter; safe for
+ *   concurrent checkouts of the same SKU. *pos and *now receive the
+ *   item and its quantity afterwards.
+ */
+static OpStatus inv_reserve(const char *name, size_t len, uint32_t hash, int k,
+                            int *pos, int32_t *now) {
+    if (k <= 0) return OP_BAD_QTY;
+    if (!snap_ready(hash)) return OP_DAMAGED;
+    uint64_t t0 = stat_begin();
+    int idx = index_probe(name, len, hash)->idx;
+    OpStatus st = OP_NOT_FOUND;
+    if (idx >= 0) {
+        *pos = idx;
+        st = item_adjust(idx, -k, now);
+        if (st == OP_OK && !g_serving) totals_check("reserve");
+    }
+    stat_end(STAT_RESERVE, t0);
+    return st;
+}
+
+static OpStatus inv_release(const char *name, size_t len, uint32_t hash, int k,
+                            int *pos, int32_t *now) {
+    if (k <= 0) return OP_BAD_QTY;
+    if (!snap_ready(hash)) return OP_DAMAGED;
+    uint64_t t0 = stat_begin();
+    int idx = index_probe(name, len, hash)->idx;
+    OpStatus st = OP_NOT_FOUND;
+    if (idx >= 0) {
+        *pos = idx;
+        st = item_adjust(idx, k, now);
+        if (st == OP_OK && !g_serving) totals_check("release");
+    }
+    stat_end(STAT_RELEASE, t0);
+    return st;
+}
+
+/*
+ * inv_merge
+ *   Restock semantics for a validated record (qty >= 0, price within
+ *   0..MONEY_MAX): an existing item gains qty units and takes the new price;
+ *   otherwise a new record is created. `hash` is name_hash(name, len).
+ *   On success *pos is the item's position and *created tells which
+ *   case applied.
+ */
+static OpStatus inv_merge(const char *name, size_t len, uint32_t hash, int qty, Money price,
+                          int *pos, bool *created) {
+    if (!snap_ready(hash) || !snap_ready_shape(false)) return OP_DAMAGED;
+    IndexShard *sh = index_shard(hash);
+    if (!shard_reserve(sh, sh->used + 1)) return OP_INDEX_FULL;
+    IndexSlot *slot = index_probe(name, len, hash);
+    int        idx  = slot->idx;
+    if (idx >= 0) {
+        OpStatus st = item_restock(idx, qty, price);
+        *pos = idx; *created = false;
+        return st;
+    }
+
+    if (!store_reserve((size_t)g_count + 1) ||
+        !store_append(name, len, hash, slot, qty, price))
+        return OP_FULL;
+    wal_put(g_count - 1);
+    *pos = g_count - 1; *created = true;
+    return OP_OK;
+}
+
+/* inv_add: inv_merge() for menu and batch input, which is validated here. */
+static OpStatus inv_add(const char *name, size_t len, uint32_t hash, int qty, Money price,
+                        int *pos, bool *created) {
+    if (len == 0 || len > UINT32_MAX - 1) return OP_BAD_NAME;
+    if (qty <= 0)  return OP_BAD_QTY;
+    if (price < 0 || price > MONEY_MAX) return OP_BAD_PRICE;
+    uint64_t t0 = stat_begin();
+    OpStatus st = inv_merge(name, len, hash, qty, price, pos, created);
+    if (st == OP_OK) totals_check(*created ? "add" : "restock");
+    stat_end(STAT_ADD, t0);
+    return st;
+}
+
+/* inv_remove: deletes an item entirely from the store (see store_delete()). */
+static OpStatus inv_remove(const char *name, size_t len, uint32_t hash) {
+    if (!snap_ready(hash) || !snap_ready_shape(true)) return OP_DAMAGED;
+    uint64_t   t0   = stat_begin();
+    IndexSlot *slot = index_probe(name, len, hash);
+    OpStatus   st   = OP_NOT_FOUND;
+    if (slot->idx >= 0) {
+        store_delete(slot);
+        wal_del(name, len);
+        totals_check("remove");
+        st = OP_OK;
+    }
+    stat_end(STAT_REMOVE, t0);
+    return st;
+}
+
+/* inv_find: the named item's position in *pos. */
+static OpStatus inv_find(const char *name, size_t len, uint32_t hash, int *pos) {
+    if (!snap_ready(hash)) return OP_DAMAGED;
+    uint64_t t0 = stat_begin();
+    *pos = index_probe(name, len, hash)->idx;
+    stat_end(STAT_FIND, t0);
+    return *pos >= 0 ? OP_OK : OP_NOT_FOUND;
+}
+
+/*
+ * inv_setqty
+ *   Sets an item's stock to an absolute value (>= 0); 0 effectively
+ *   marks it as out-of-stock. On success *pos is the item's position.
+ */
+static OpStatus inv_setqty(const char *name, size_t len, uint32_t hash, int qty, int *pos) {
+    if (qty < 0) return OP_BAD_QTY;
+    if (!snap_ready(hash)) return OP_DAMAGED;
+    uint64_t t0  = stat_begin();
+    int      idx = index_probe(name, len, hash)->idx;
+    if (idx >= 0) {
+        item_set(idx, qty, ITEM_PRICE(idx));
+        wal_put(idx);
+        totals_check("update");
+        *pos = idx;
+    }
+    stat_end(STAT_UPDATE, t0);
+    return idx >= 0 ? OP_OK : OP_NOT_FOUND;
+}
+
+/* Menu wrappers: run an operation and print its outcome. */
+static bool add_item(const char *name, int qty, Money price) {
+    size_t len = name ? strlen(name) : 0;
+    int  idx = 0;
+    bool created = false;
+    char pb[MONEY_BUF];
+    OpStatus st = inv_add(name, len, len ? name_hash(name, len) : 0, qty, price,
+                          &idx, &created);
+    if (!op_report(st, name, true)) return false;
+    if (created)
+        printf("[OK] Added '%s': qty=%d, price=%s\n", name, qty,
+               money_str(pb, ITEM_PRICE(idx)));
+    else
+        printf("[OK] Restocked '%s' → qty=%d, price=%s\n",
+               name_str(ITEM_NAME(idx)), ITEM_QTY(idx), money_str(pb, ITEM_PRICE(idx)));
+    return true;
+}
+
+static bool remove_item(const char *name) {
+    size_t len = strlen(name);
+    if (!op_report(inv_remove(name, len, name_hash(name, len)), name, false)) return false;
+    printf("[OK] Removed '%s'.\n", name);
+    return true;
+}
+
+static bool update_quantity(const char *name, int new_qty) {
+    size_t len = strlen(name);
+    int idx = 0;
+    if (!op_report(inv_setqty(name, len, name_hash(name, len), new_qty, &idx), name, false))
+        return false;
+    printf("[OK] '%s' quantity → %d\n", name, new_qty);
+    return true;
+}
+
+/*
+ * calculate_total
+ *   Returns the sum of (quantity × price) for every item in stock.
+ *   O(1): the value is maintained incrementally in g_total_cents.
+ */
+static Money calculate_total(void) {
+    return g_total_cents;
+}
+
+/*
+ * list_inventory
+ *   Prints the items `q` selects as a table with a total row, streamed
+ *   to stdout in large writes. With page > 0, stops after each page of
+ *   rows and asks more() whether to go on.
+ */
+static void list_inventory(const ListQuery *q, size_t page, bool (*more)(size_t shown, size_t of)) {
+    int        *v;
+    size_t      n, matched;
+    StoreImage  live;
+    if (g_count == 0) { printf("  (inventory is empty)\n"); return; }
+    store_image_live(&live, 0);
+    if (!list_select(q, &live, &v, &n, &matched)) { printf("[ERROR] Out of memory.\n"); return; }
+    if (n == 0) { printf("  No matching items.\n"); free(v); return; }
+
+    ListSink s = { .fmt = LIST_TABLE, .flush = sink_stdout, .dst = stdout };
+    list_begin(&s);
+    for (size_t k = 0; k < n; ) {
+        size_t step = page && page < n - k ? page : n - k;
+        list_rows(&s, &live, v + k, step);
+        k += step;
+        if (k < n && page) {
+            list_flush(&s);
+            fflush(stdout);
+            if (!more(k, n)) break;
+        }
+    }
+    list_end(&s);
+    free(v);
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  ABC analysis
+ *    Classes items by their share of stock value (quantity × price):
+ *    A are the most valuable items that together make up ABC_A% of the
+ *    total, B the next ones up to ABC_AB%, C the rest. Only the class
+ *    sizes are needed, not the order within a class, so abc_rank()
+ *    finds each cut by a quickselect that is steered by partial sums:
+ *    expected O(n), no sort of the store.
+ * ══════════════════════════════════════════════════════════════ */
+
+typedef struct {
+    int64_t total;     /* cents */
+    size_t  items[3];  /* A, B, C */
+    int64_t cents[3];
+} AbcReport;
+
+/*
+ * abc_rank
+ *   The fewest of v[0, n) (values >= 0) whose sum reaches target: the
+ *   largest ones. Reorders v. *sum receives their sum.
+ */
+static size_t abc_rank(int64_t *v, size_t n, int64_t target, int64_t *sum) {
+    size_t   lo = 0, hi = n, k = 0;
+    int64_t  acc = 0;
+    uint32_t rng = 2463534242u;
+    while (target > acc && lo < hi) {
+        rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+        int64_t p = v[lo + rng % (hi - lo)];
+        /* Three-way partition: [lo, a) > p, [a, b) == p, [b, hi) < p. */
+        size_t  a = lo, i = lo, b = hi;
+        int64_t above = 0;
+        while (i < b) {
+            int64_t x = v[i];
+            if (x > p)      { v[i++] = v[a]; v[a++] = x; above += x; }
+            else if (x < p) { v[i] = v[--b]; v[b] = x; }
+            else            i++;
+        }
+        if (acc + above >= target) { hi = a; continue; }
+        int64_t equal = (int64_t)(b - a) * p;
+        if (acc + above + equal >= target) {
+            size_t need = (size_t)((target - acc - above + p - 1) / p);
+            *sum = acc + above + (int64_t)need * p;
+            return k + (a - lo) + need;
+        }
+        acc += above + equal;
+        k   += b - lo;
+        lo   = b;
+    }
+    *sum = acc;
+    return k;
+}
+
+/* Class sizes and values for image im. False when memory is short. */
+static bool abc_analyze(const StoreImage *im, AbcReport *r) {
+    size_t   n = (size_t)im->count;
+    int64_t *v = malloc((n + 1) * sizeof *v), total = im->total_cents;
+    if (!v) return false;
+    /* One pass over the quantity and price columns, chunk by chunk; the
+     * sum of them is the image's maintained total. */
+    for (size_t base = 0; base < n; base += ITEM_CHUNK) {
+        const ItemChunk *c = im->chunks[base >> ITEM_CHUNK_SHIFT];
+        size_t m = n - base < ITEM_CHUNK ? n - base : ITEM_CHUNK;
+        for (size_t k = 0; k < m; k++) v[base + k] = (int64_t)c->qty[k] * c->price[k];
+    }
+    int64_t sa, sab;
+    size_t  na  = abc_rank(v, n, (total * ABC_A + 99) / 100, &sa);
+    size_t  nab = abc_rank(v, n, (total * ABC_AB + 99) / 100, &sab);
+    free(v);
+    r->total    = total;
+    r->items[0] = na;      r->cents[0] = sa;
+    r->items[1] = nab - na; r->cents[1] = sab - sa;
+    r->items[2] = n - nab; r->cents[2] = total - sab;
+    return true;
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Statistics report
+ *    stats_format() renders the merged counters as the `stats` reply
+ *    or as JSON. With --stats-file a helper thread rewrites that JSON
+ *    atomically every --stats-interval seconds, and once more at exit,
+ *    for a monitoring scraper to poll. Everything read here is atomic,
+ *    so neither needs the store to be quiet.
+ * ══════════════════════════════════════════════════════════════ */
+
+static const char *g_stats_file;                 /* --stats-file     */
+static int         g_stats_interval = STATS_INTERVAL; /* --stats-interval */
+
+#if INVENTORY_STATS
+static struct {
+    uint64_t epoch;              /* now_ns() at stats_start() */
+    char     tmp[LINE_BUF + 8];
+    Mutex    lock;
+    Cond     wake;
+    bool     stop, running, warned;
+    Thread   th;
+    TaskArg  arg;
+} g_statf;
+
+/* One operation's figures, in nanoseconds. */
+typedef struct {
+    uint64_t count, avg, p50, p99, max;
+} StatLine;
+
+static StatLine stat_line(const StatTotals *t, int op) {
+    StatLine l = { t->count[op], 0, 0, 0, t->max[op] };
+    if (!l.count) return l;
+    l.avg = t->ns[op] / l.count;
+    l.p50 = stat_bucket_top(stat_percentile(t->hist[op], STAT_BUCKETS, l.count, 50));
+    l.p99 = stat_bucket_top(stat_percentile(t->hist[op], STAT_BUCKETS, l.count, 99));
+    if (l.p50 > l.max) l.p50 = l.max;
+    if (l.p99 > l.max) l.p99 = l.max;
+    return l;
+}
+
+/*
+ * stats_format
+ *   Appends the statistics to `o`: as " key=value..." for the stats
+ *   reply, or as one JSON object and a newline. Index load is items per
+ *   slot; probe lengths count the slots a lookup examined, with
+ *   STAT_PROBES standing for that many or more.
+ */
+static void stats_format(OutBuf *o, bool json) {
+    StatTotals t;
+    stat_collect(&t);
+    double   up    = (double)(now_ns() - g_statf.epoch) / 1e9;
+    double   load  = t.slots ? (double)t.items / (double)t.slots : 0.0;
+    double   pavg  = t.probes ? (double)t.probe_slots / (double)t.probes : 0.0;
+    unsigned p99   = t.probes ? stat_percentile(t.probe, STAT_PROBES, t.probes, 99) + 1 : 0;
+    unsigned long long probes = (unsigned long long)t.probes;
+    if (json)
+        out_printf(o, "{\"uptime_s\":%.3f,\"items\":%zu,\"index_slots\":%zu,\"load_factor\":%.4f,"
+                      "\"probes\":%llu,\"probe_avg\":%.3f,\"probe_p99\":%u",
+                   up, t.items, t.slots, load, probes, pavg, p99);
+    else
+        out_printf(o, " uptime=%.3f items=%zu slots=%zu load=%.4f probes=%llu probe_avg=%.3f"
+                      " probe_p99=%u", up, t.items, t.slots, load, probes, pavg, p99);
+    for (int op = 0; op < STAT_OPS; op++) {
+        StatLine l = stat_line(&t, op);
+        if (json)
+            out_printf(o, ",\"%s\":{\"count\":%llu,\"avg_ns\":%llu,\"p50_ns\":%llu,"
+                          "\"p99_ns\":%llu,\"max_ns\":%llu}", stat_names[op],
+                       (unsigned long long)l.count, (unsigned long long)l.avg,
+                       (unsigned long long)l.p50, (unsigned long long)l.p99,
+                       (unsigned long long)l.max);
+        else
+            out_printf(o, " %s=%llu,%llu,%llu,%llu,%llu", stat_names[op],
+                       (unsigned long long)l.count, (unsigned long long)l.avg,
+                       (unsigned long long)l.p50, (unsigned long long)l.p99,
+                       (unsigned long long)l.max);
+    }
+    if (json) out_printf(o, "}\n");
+}
+
+/* The statistics as a table, for the menu. */
+static void stats_print(void) {
+    StatTotals t;
+    stat_collect(&t);
+    printf("\n  Items: %zu   Index slots: %zu (%.1f%% full)\n", t.items, t.slots,
+           t.slots ? 100.0 * (double)t.items / (double)t.slots : 0.0);
+    printf("  Lookups: %llu, %.2f slots examined on average, 99%% within %u\n",
+           (unsigned long long)t.probes,
+           t.probes ? (double)t.probe_slots / (double)t.probes : 0.0,
+           t.probes ? stat_percentile(t.probe, STAT_PROBES, t.probes, 99) + 1 : 0);
+    printf("\n  %-8s %12s %12s %12s %12s %12s\n", "Op", "Count", "Avg (µs)", "p50 (µs)",
+           "p99 (µs)", "Max (µs)");
+    for (int op = 0; op < STAT_OPS; op++) {
+        StatLine l = stat_line(&t, op);
+        printf("  %-8s %12llu %12.2f %12.2f %12.2f %12.2f\n", stat_names[op],
+               (unsigned long long)l.count, (double)l.avg / 1e3, (double)l.p50 / 1e3,
+               (double)l.p99 / 1e3, (double)l.max / 1e3);
+    }
+}
+
+static void stats_dump(void) {
+    OutBuf     o = { NULL, 0, 0, false };
+    AtomicFile f;
+    stats_format(&o, true);
+    if (!o.lost && afile_open(&f, g_stats_file, g_statf.tmp)) {
+        afile_write(&f, o.buf, o.len);
+        afile_commit(&f);
+    } else if (!g_statf.warned) {
+        fprintf(stderr, "[WARN] Cannot write '%s': %s\n", g_stats_file, strerror(errno));
+        g_statf.warned = true;
+    }
+    free(o.buf);
+}
+
+/* Helper thread: a dump now, then every interval, and a last one on stop. */
+static void stats_task(void *ctx, int worker) {
+    (void)ctx; (void)worker;
+    for (bool done = false; !done; ) {
+        stats_dump();
+        mutex_lock(&g_statf.lock);
+        if (!g_statf.stop) cond_wait_ms(&g_statf.wake, &g_statf.lock, g_stats_interval * 1000);
+        done = g_statf.stop;
+        mutex_unlock(&g_statf.lock);
+    }
+    stats_dump();
+}
+
+static void stats_start(void) {
+    g_statf.epoch = now_ns();
+    if (!g_stats_file) return;
+    snprintf(g_statf.tmp, sizeof g_statf.tmp, "%s.tmp", g_stats_file);
+    mutex_init(&g_statf.lock);
+    cond_init(&g_statf.wake);
+    g_statf.arg     = (TaskArg){ stats_task, NULL, 0 };
+    g_statf.running = thread_start(&g_statf.th, &g_statf.arg);
+    if (!g_statf.running)
+        fprintf(stderr, "[WARN] Cannot start the statistics writer; '%s' is not updated.\n",
+                g_stats_file);
+}
+
+static void stats_stop(void) {
+    if (!g_statf.running) return;
+    mutex_lock(&g_statf.lock);
+    g_statf.stop = true;
+    cond_signal(&g_statf.wake);
+    mutex_unlock(&g_statf.lock);
+    thread_join(g_statf.th);
+    g_statf.running = false;
+}
+#else
+static void stats_start(void) {
+    if (g_stats_file)
+        fprintf(stderr, "[WARN] Built without statistics; --stats-file is ignored.\n");
+}
+static void stats_stop(void) {}
+#endif
+
+/* ══════════════════════════════════════════════════════════════
+ *  Merge import
+ *    import_csv() applies a delta file in the inventory.txt format with
+ *    restock semantics: each row adds its quantity to the item and sets
+ *    its price, creating the item if it is new. The file is streamed,
+ *    so memory use is bounded by one read buffer and IMPORT_ROWS rows
+ *    whatever the feed size. Each run of rows is sorted by home index
+ *    slot and merged against the index in that order, so a large feed
+ *    walks each shard's table front to back instead of probing at
+ *    random; names not yet in the store are then added in file order.
+ *    The result equals applying the rows one by one.
+ * ══════════════════════════════════════════════════════════════ */
+
+/*
+ * Line reader over any byte source: `read` fills up to n bytes and
+ * returns the count, 0 at end of input or -1 on error. `max` (0 = no
+ * limit) bounds the buffer, and so the longest line accepted.
+ */
+typedef struct {
+    long  (*read)(void *src, char *buf, size_t n);
+    void   *src;
+    char   *buf;
+    size_t  cap, max, len, pos; /* unread input is buf[pos, len) */
+    bool    eof, error;
+} LineReader;
+
+static long lr_read_file(void *src, char *buf, size_t n) {
+    size_t got = fread(buf, 1, n, src);
+    return got ? (long)got : ferror((FILE *)src) ? -1 : 0;
+}
+
+/*
+ * lr_fill
+ *   Reads once behind the unread input, which moves to the front of the
+ *   buffer (so lines already returned are invalidated). Returns false at
+ *   end of input or on error, and when the buffer cannot grow for a
+ *   longer line (error set, eof not).
+ */
+static bool lr_fill(LineReader *r) {
+    memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+    r->len -= r->pos;
+    r->pos  = 0;
+    if (r->len == r->cap) {
+        char *nb = r->max && r->cap * 2 > r->max ? NULL : realloc(r->buf, r->cap * 2);
+        if (!nb) { r->error = true; return false; }
+        r->buf = nb; r->cap *= 2;
+    }
+    long got = r->read(r->src, r->buf + r->len, r->cap - r->len);
+    if (got > 0) { r->len += (size_t)got; return true; }
+    r->eof   = true;
+    r->error = got < 0;
+    return false;
+}
+
+/*
+ * lr_next
+ *   Yields the next line as [*b, *e), without its terminator. Lines
+ *   already returned stay valid until a call with `refill` set; without
+ *   it, returns false once no complete line is buffered.
+ */
+static bool lr_next(LineReader *r, const char **b, const char **e, bool refill) {
+    for (;;) {
+        char *p   = r->buf + r->pos;
+        char *eol = memchr(p, '\n', r->len - r->pos);
+        if (eol || (r->eof && r->pos < r->len)) {
+            if (!eol) eol = r->buf + r->len;
+            *b = p; *e = eol;
+            r->pos = (size_t)(eol - r->buf) + (eol < r->buf + r->len);
+            return true;
+        }
+        if (!refill || r->eof) return false;
+        /* Keep the partial line and read more behind it. */
+        if (!lr_fill(r) && !r->eof) return false;
+    }
+}
+
+typedef struct {
+    uint64_t    key;   /* shard << 32 | home slot: the merge order */
+    const char *name;
+    uint32_t    len, hash;
+    int32_t     qty;
+    int         line;
+    Money       price;
+} ImportRow;
+
+typedef struct {
+    long inserted, updated, rejected;
+} ImportStats;
+
+static int import_cmp_key(const void *a, const void *b) {
+    const ImportRow *x = a, *y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return (x->line > y->line) - (x->line < y->line);
+}
+
+static int import_cmp_line(const void *a, const void *b) {
+    const ImportRow *x = a, *y = b;
+    return (x->line > y->line) - (x->line < y->line);
+}
+
+static void import_overflow(const ImportRow *r, ImportStats *st) {
+    fprintf(stderr, "[WARN] Line %d: quantity of '%.*s' would overflow (skipped).\n",
+            r->line, (int)r->len, r->name);
+    st->rejected++;
+}
+
+/*
+ * import_run
+ *   Merges rows[0, n) into the store. Rows for one name stay in file
+ *   order in both passes, so the last price wins as it would row by
+ *   row. Returns false when memory runs out or the store is damaged.
+ */
+static bool import_run(ImportRow *rows, int n, ImportStats *st) {
+    for (int k = 0; k < n; k++) {
+        if (!snap_ready(rows[k].hash)) return false; /* before any row is merged */
+        IndexShard *sh = index_shard(rows[k].hash);
+        rows[k].key = (uint64_t)(rows[k].hash >> (32 - INDEX_SHARD_BITS)) << 32 |
+                      (sh->tab ? rows[k].hash & (sh->cap - 1) : 0);
+    }
+    qsort(rows, (size_t)n, sizeof *rows, import_cmp_key);
+
+    /* Pass 1, index order: restock known items, set the new ones aside. */
+    int fresh = 0;
+    for (int k = 0; k < n; k++) {
+        if (k + LOAD_BATCH < n) PREFETCH(index_home(rows[k + LOAD_BATCH].hash));
+        ImportRow *r = &rows[k];
+        int idx = index_probe(r->name, r->len, r->hash)->idx;
+        if (idx < 0)                                     rows[fresh++] = *r;
+        else if (item_restock(idx, r->qty, r->price) == OP_OK) st->updated++;
+        else                                             import_overflow(r, st);
+    }
+
+    /* Pass 2, file order: insertion order follows the feed. */
+    qsort(rows, (size_t)fresh, sizeof *rows, import_cmp_line);
+    for (int k = 0; k < fresh; k++) {
+        ImportRow *r = &rows[k];
+        int  idx;
+        bool created;
+        switch (inv_merge(r->name, r->len, r->hash, r->qty, r->price, &idx, &created)) {
+            case OP_OK:       if (created) st->inserted++; else st->updated++; break;
+            case OP_OVERFLOW: import_overflow(r, st);                          break;
+            case OP_DAMAGED:  return false;
+            default:
+                fprintf(stderr, "[ERROR] Inventory full (memory limit %zu bytes) at line %d; "
+                                "the rest of the feed was not applied.\n", g_mem_limit, r->line);
+                return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * import_csv
+ *   Merges the delta file at `path` into the store (see above) and
+ *   reports the counts in *st. Rows that fail validation are skipped
+ *   with the loader's warnings. Returns false if the file cannot be
+ *   read, memory runs out or the store is damaged; rows merged before
+ *   that stay applied.
+ */
+static bool import_csv(const char *path, ImportStats *st) {
+    memset(st, 0, sizeof *st);
+    uint64_t   t0 = stat_begin();
+    LineReader r = { .read = lr_read_file, .cap = SAVE_BUF };
+    if (!(r.src = fopen(path, "rb"))) {
+        fprintf(stderr, "[ERROR] Cannot open '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+    ImportRow *rows = malloc(IMPORT_ROWS * sizeof *rows);
+    r.buf = malloc(r.cap);
+    bool ok = rows && r.buf;
+    if (!ok) fprintf(stderr, "[ERROR] Out of memory importing '%s'.\n", path);
+
+    int lineno = 0;
+    const char *b, *e;
+    for (bool more = ok; more && ok; ) {
+        /* One run: the complete rows already buffered, up to IMPORT_ROWS. */
+        int n = 0;
+        while (n < IMPORT_ROWS && (more = lr_next(&r, &b, &e, n == 0))) {
+            lineno++;
+            CsvRow row;
+            CsvStatus cs = csv_scan_line(b, e, 1000000, &row);
+            if (cs == CSV_BLANK) continue;
+            if (cs != CSV_OK) { csv_warn(cs, lineno, &row); st->rejected++; continue; }
+            rows[n++] = (ImportRow){ 0, row.name, (uint32_t)row.name_len,
+                                     name_hash(row.name, row.name_len), row.qty, lineno,
+                                     row.price };
+        }
+        if (!more && !r.eof && !r.error) more = true; /* buffer drained mid-run */
+        wal_batch();
+        ok = import_run(rows, n, st);
+        wal_commit();
+        totals_check("import");
+    }
+    if (r.error) {
+        fprintf(stderr, "[ERROR] Cannot read '%s': %s\n", path, strerror(errno));
+        ok = false;
+    }
+    fclose(r.src);
+    free(r.buf);
+    free(rows);
+    stat_end(STAT_IMPORT, t0);
+    return ok;
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Chain stores
+ *    --chain=FILE loads the inventories of other locations next to the
+ *    process's own store: FILE names one inventory.txt-format file per
+ *    line, relative to FILE's directory unless absolute. Each becomes
+ *    a read-only ChainStore with its own columns and name table; the
+ *    files are mapped and parsed in parallel, one store per worker at
+ *    a time, and names are served straight from the mappings.
+ *
+ *    Chain-wide queries are a map-reduce: chain_reduce() hands blocks
+ *    of stores to workers, each folds its stores into a private
+ *    ChainSum, and the caller adds up the partial sums. The stores are
+ *    not changed after startup, so queries need no locks.
+ * ══════════════════════════════════════════════════════════════ */
+
+#define CHAIN_PAR_MIN 64  /* stores per query worker before a query is split */
+#define CHAIN_BLOCK   16  /* stores a query worker claims at a time          */
+
+typedef struct {
+    char        *path;
+    FileView     fv;      /* the mapped file; names point into it         */
+    const char **name;    /* columns, one entry per item                  */
+    uint32_t    *len;
+    uint32_t    *hash;    /* name_hash()                                  */
+    int32_t     *qty;
+    Money       *price;
+    int32_t     *slot;    /* open addressing: item or -1, `mask` + 1 slots */
+    size_t       count, mask;
+    Money        value;   /* Σ quantity × price                            */
+    int64_t      units;   /* Σ quantity                                    */
+    size_t       skipped; /* malformed, invalid or duplicate lines         */
+    int          error;   /* errno from opening the file, or 0             */
+} ChainStore;
+
+typedef struct {
+    Money   value;
+    int64_t units;
+    size_t  items;  /* items counted                */
+    size_t  stores; /* stores that contributed      */
+} ChainSum;
+
+static struct {
+    ChainStore *store;
+    size_t      n;
+    bool        on; /* --chain was given */
+} g_chain;
+
+static int g_chain_threads = 0; /* --chain-threads, 0 = all CPUs */
+
+static int chain_workers(void) {
+    int n = g_chain_threads > 0 ? g_chain_threads : cpu_count();
+    return n > MAX_LOAD_THREADS ? MAX_LOAD_THREADS : n;
+}
+
+/* Item of store s named [name, name + len) with hash `hash`, or -1. */
+static int32_t chain_find(const ChainStore *s, const char *name, size_t len, uint32_t hash) {
+    if (!s->slot) return -1;
+    for (size_t h = hash & s->mask; ; h = (h + 1) & s->mask) {
+        int32_t i = s->slot[h];
+        if (i < 0) return -1;
+        if (s->hash[i] == hash && s->len[i] == len && strncasecmp(s->name[i], name, len) == 0)
+            return i;
+    }
+}
+
+/* Parse the mapped file of store s into its columns; the first of duplicate names wins. */
+static bool chain_store_fill(ChainStore *s) {
+    const char *p = s->fv.data, *end = p + s->fv.len;
+    size_t lines = 1;
+    for (const char *q = p; (q = memchr(q, '\n', (size_t)(end - q))) != NULL; q++) lines++;
+    if (lines > INT32_MAX / 2) { s->error = EFBIG; return false; }
+    size_t cap = INDEX_MIN_CAP;
+    while (cap < lines * 2) cap *= 2;
+    s->name  = malloc(lines * sizeof *s->name);
+    s->len   = malloc(lines * sizeof *s->len);
+    s->hash  = malloc(lines * sizeof *s->hash);
+    s->qty   = malloc(lines * sizeof *s->qty);
+    s->price = malloc(lines * sizeof *s->price);
+    s->slot  = malloc(cap * sizeof *s->slot);
+    if (!s->name || !s->len || !s->hash || !s->qty || !s->price || !s->slot) {
+        s->error = ENOMEM;
+        return false;
+    }
+    memset(s->slot, 0xff, cap * sizeof *s->slot);
+    s->mask = cap - 1;
+
+    while (p < end) {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (!eol) eol = end;
+        CsvRow    row;
+        CsvStatus st = csv_scan_line(p, eol, INT32_MAX, &row);
+        p = eol + (eol < end);
+        if (st == CSV_BLANK) continue;
+        if (st != CSV_OK || row.name_len > UINT32_MAX) { s->skipped++; continue; }
+        uint32_t hash = name_hash(row.name, row.name_len);
+        size_t   h    = hash & s->mask;
+        bool     dup  = false;
+        for (int32_t i; (i = s->slot[h]) >= 0 && !dup; h = (h + 1) & s->mask)
+            dup = s->hash[i] == hash && s->len[i] == row.name_len &&
+                  strncasecmp(s->name[i], row.name, row.name_len) == 0;
+        if (dup) { s->skipped++; continue; }
+
+        size_t i = s->count++;
+        s->slot[h]  = (int32_t)i;
+        s->name[i]  = row.name;
+        s->len[i]   = (uint32_t)row.name_len;
+        s->hash[i]  = hash;
+        s->qty[i]   = row.qty;
+        s->price[i] = row.price;
+        s->value   += (Money)row.qty * row.price;
+        s->units   += row.qty;
+    }
+    return true;
+}
+
+typedef struct {
+    atomic_size_t next; /* next store to load */
+} ChainLoadJob;
+
+static void chain_task_load(void *ctx, int w) {
+    (void)w;
+    ChainLoadJob *job = ctx;
+    for (size_t k; (k = atomic_fetch_add(&job->next, 1)) < g_chain.n; ) {
+        ChainStore *s = &g_chain.store[k];
+        if (!file_view_open(s->path, &s->fv, false)) { s->error = errno ? errno : EIO; continue; }
+        chain_store_fill(s);
+    }
+}
+
+/*
+ * chain_load
+ *   Reads the --chain list `list` and loads every store it names, on
+ *   --chain-threads workers. A store that cannot be read is fatal: a
+ *   chain total missing a location would look right and be wrong.
+ *   Returns true on success.
+ */
+static bool chain_load(const char *list) {
+    FileView fv;
+    if (!file_view_open(list, &fv, false)) {
+        fprintf(stderr, "[ERROR] Cannot open '%s': %s\n", list, strerror(errno));
+        return false;
+    }
+    size_t dir = strlen(list);
+    while (dir > 0 && list[dir - 1] != '/'
+#ifdef _WIN32
+           && list[dir - 1] != '\\' && list[dir - 1] != ':'
+#endif
+           )
+        dir--;
+
+    size_t cap = 0;
+    bool   ok  = true;
+    for (const char *p = fv.data, *end = p + fv.len; p < end && ok; ) {
+        const char *b = p, *e = memchr(p, '\n', (size_t)(end - p));
+        if (!e) e = end;
+        p = e + (e < end);
+        span_trim(&b, &e);
+        if (b == e || *b == '#') continue;
+        bool abs = *b == '/';
+#ifdef _WIN32
+        abs = abs || *b == '\\' || (e - b > 1 && b[1] == ':');
+#endif
+        size_t pre = abs ? 0 : dir, n = (size_t)(e - b);
+        char  *path = malloc(pre + n + 1);
+        ok = path && vec_reserve(&g_chain.store, &cap, g_chain.n + 1, sizeof *g_chain.store);
+        if (!ok) { free(path); break; }
+        memcpy(path, list, pre);
+        memcpy(path + pre, b, n);
+        path[pre + n] = '\0';
+        g_chain.store[g_chain.n++] = (ChainStore){ .path = path };
+    }
+    file_view_close(&fv);
+    if (!ok) {
+        fprintf(stderr, "[ERROR] Out of memory reading '%s'.\n", list);
+        return false;
+    }
+    g_chain.on = true;
+
+    int threads = chain_workers();
+    if ((size_t)threads > g_chain.n) threads = g_chain.n ? (int)g_chain.n : 1;
+    ChainLoadJob job;
+    atomic_init(&job.next, 0);
+    parallel_run(threads, chain_task_load, &job);
+
+    size_t items = 0;
+    for (size_t k = 0; k < g_chain.n; k++) {
+        const ChainStore *s = &g_chain.store[k];
+        if (s->error) {
+            fprintf(stderr, "[ERROR] Cannot load '%s': %s\n", s->path, strerror(s->error));
+            ok = false;
+        } else if (s->skipped) {
+            fprintf(stderr, "[WARN] '%s': %zu line(s) skipped (invalid or duplicate).\n",
+                    s->path, s->skipped);
+        }
+        items += s->count;
+    }
+    if (ok)
+        printf("[INFO] Loaded %zu item(s) in %zu store(s) from '%s'.\n", items, g_chain.n, list);
+    return ok;
+}
+
+/* ─── Chain queries ───────────────────────────────────────────── */
+
+typedef void (*chain_map_fn)(const ChainStore *s, const void *arg, ChainSum *acc);
+
+typedef struct {
+    chain_map_fn  map;
+    const void   *arg;
+    atomic_size_t next;                    /* first store of the next block */
+    ChainSum      part[MAX_LOAD_THREADS];  /* one per worker                */
+} ChainJob;
+
+static void chain_task_map(void *ctx, int w) {
+    ChainJob *job = ctx;
+    ChainSum  acc = { 0, 0, 0, 0 };
+    for (size_t k; (k = atomic_fetch_add(&job->next, CHAIN_BLOCK)) < g_chain.n; ) {
+        size_t end = k + CHAIN_BLOCK < g_chain.n ? k + CHAIN_BLOCK : g_chain.n;
+        for (; k < end; k++) job->map(&g_chain.store[k], job->arg, &acc);
+    }
+    job->part[w] = acc;
+}
+
+/* Run map over every store, split across workers once the chain is large enough. */
+static ChainSum chain_reduce(chain_map_fn map, const void *arg) {
+    ChainJob *job = malloc(sizeof *job);
+    ChainSum  sum = { 0, 0, 0, 0 };
+    int threads = (int)(g_chain.n / CHAIN_PAR_MIN);
+    if (threads > chain_workers()) threads = chain_workers();
+    if (!job || threads <= 1) {
+        free(job);
+        for (size_t k = 0; k < g_chain.n; k++) map(&g_chain.store[k], arg, &sum);
+        return sum;
+    }
+    job->map = map;
+    job->arg = arg;
+    atomic_init(&job->next, 0);
+    parallel_run(threads, chain_task_map, job);
+    for (int w = 0; w < threads; w++) {
+        sum.value  += job->part[w].value;
+        sum.units  += job->part[w].units;
+        sum.items  += job->part[w].items;
+        sum.stores += job->part[w].stores;
+    }
+    free(job);
+    return sum;
+}
+
+/* chain total: each store's running totals, kept since it was loaded. */
+static void chain_map_total(const ChainStore *s, const void *arg, ChainSum *acc) {
+    (void)arg;
+    acc->value += s->value;
+    acc->units += s->units;
+    acc->items += s->count;
+    acc->stores++;
+}
+
+typedef struct { const char *name; size_t len; uint32_t hash; } ChainKey;
+
+/* chain get: one probe of each store's name table. */
+static void chain_map_item(const ChainStore *s, const void *arg, ChainSum *acc) {
+    const ChainKey *key = arg;
+    int32_t i = chain_find(s, key->name, key->len, key->hash);
+    if (i < 0) return;
+    acc->value += (Money)s->qty[i] * s->price[i];
+    acc->units += s->qty[i];
+    acc->items++;
+    acc->stores++;
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Batch mode
+ *    --batch[=FILE] applies commands read from FILE (or stdin), one
+ *    per line, without the menu:
+ *      add NAME,QTY,PRICE   setqty NAME,QTY   remove NAME   get NAME
+ *      reserve NAME,QTY     release NAME,QTY  search TEXT
+ *      low QTY              prices MIN,MAX    list [OPTION...]
+ *      export FILE [OPTION...]  top COUNT         abc
+ *      total                save              import FILE   stats
+ *      chain total          chain get NAME    (with --chain; see "Chain stores")
+ *    Blank lines and '#' comments are skipped. Each command prints one
+ *    result line, "OK <command> ..." or "ERR <line>: <message>", on a
+ *    fully buffered stdout. Commands are taken BATCH_OPS at a time:
+ *    their index slots are prefetched up front, and their log records
+ *    reach inventory.wal with one write (and under --durability=sync
+ *    one fsync) per batch.
+ * ══════════════════════════════════════════════════════════════ */
+
+typedef enum {
+    CMD_ADD, CMD_SETQTY, CMD_REMOVE, CMD_GET, CMD_RESERVE, CMD_RELEASE,
+    CMD_TOTAL, CMD_SAVE, CMD_IMPORT, CMD_SEARCH, CMD_LOW, CMD_PRICES, CMD_LIST, CMD_EXPORT,
+    CMD_TOP, CMD_ABC, CMD_STATS, CMD_CHAIN, CMD_BAD
+} CmdVerb;
+
+static const char *const cmd_verbs[] = {
+    "add", "setqty", "remove", "get", "reserve", "release", "total", "save", "import", "search",
+    "low", "prices", "list", "export", "top", "abc", "stats", "chain"
+};
+
+typedef struct {
+    CmdVerb     verb;
+    int         line;
+    const char *name;  size_t len;
+    uint32_t    hash;
+    int32_t     qty;
+    Money       price;
+    Money       price_max; /* CMD_PRICES: range is price..price_max */
+    bool        chain_get; /* CMD_CHAIN: get NAME rather than total */
+    char        err[96];   /* CMD_BAD: what was wrong */
+} BatchCmd;
+
+/* "LO..HI" with either end optional, as quantities or prices (as Money). */
+static bool list_parse_range(const char *b, const char *e, bool price, int64_t *lo, int64_t *hi) {
+    const char *dots = NULL;
+    for (const char *p = b; p + 1 < e && !dots; p++)
+        if (p[0] == '.' && p[1] == '.') dots = p;
+    if (!dots) return false;
+    const char *end[2] = { dots, e }, *start[2] = { b, dots + 2 };
+    int64_t    *out[2] = { lo, hi };
+    for (int k = 0; k < 2; k++) {
+        if (start[k] == end[k]) continue;
+        int32_t q;
+        Money   p;
+        if (price ? !scan_price(start[k], end[k], &p) : !scan_qty(start[k], end[k], &q))
+            return false;
+        *out[k] = price ? p : q;
+    }
+    return true;
+}
+
+/*
+ * list_parse
+ *   Reads listing options into `q` (and `fmt`, if given):
+ *     sort=insertion|name|store|qty|price|value  desc  offset=N  limit=N
+ *     qty=LO..HI  price=LO..HI  format=csv|json  name=TEXT (rest of line)
+ *   Returns false with a message in err[n] for anything else.
+ */
+static bool list_parse(const char *b, const char *e, ListQuery *q, ListFormat *fmt,
+                       char *err, size_t n) {
+    static const char *const sorts[] = { "insertion", "name", "store", "qty", "price", "value" };
+    list_query_init(q, (ListSort)g_order);
+    for (span_trim(&b, &e); b < e; span_trim(&b, &e)) {
+        const char *w = b;
+        while (b < e && !is_space(*b)) b++;
+        const char *eq = memchr(w, '=', (size_t)(b - w)), *v = eq ? eq + 1 : b;
+        size_t      kl = (size_t)((eq ? eq : b) - w);
+        int32_t     num;
+#define KEY(k) (kl == sizeof k - 1 && strncasecmp(w, k, kl) == 0)
+        if (KEY("desc") && !eq) { q->desc = true; continue; }
+        if (KEY("name") && eq)  { q->name = v; q->name_len = (size_t)(e - v); break; }
+        if (KEY("sort") && eq) {
+            int m = 0;
+            while (m < 6 && !(strlen(sorts[m]) == (size_t)(b - v) &&
+                              strncasecmp(v, sorts[m], (size_t)(b - v)) == 0)) m++;
+            if (m < 6) { q->sort = (ListSort)m; continue; }
+        }
+        if ((KEY("offset") || KEY("limit")) && eq && scan_qty(v, b, &num) && num >= 0) {
+            *(KEY("offset") ? &q->offset : &q->limit) = (size_t)num;
+            continue;
+        }
+        if (KEY("qty") && eq && list_parse_range(v, b, false, &q->qty_lo, &q->qty_hi)) continue;
+        if (KEY("price") && eq && list_parse_range(v, b, true, &q->cents_lo, &q->cents_hi)) continue;
+        if (KEY("format") && eq && fmt) {
+            size_t vl = (size_t)(b - v);
+            if (vl == 3 && strncasecmp(v, "csv", 3) == 0)  { *fmt = LIST_CSV;  continue; }
+            if (vl == 4 && strncasecmp(v, "json", 4) == 0) { *fmt = LIST_JSON; continue; }
+        }
+#undef KEY
+        snprintf(err, n, "bad list option '%.*s'", b - w > 32 ? 32 : (int)(b - w), w);
+        return false;
+    }
+    return true;
+}
+
+/* Parse one line into `c`. Returns false for blank and comment lines. */
+static bool batch_parse(const char *b, const char *e, BatchCmd *c) {
+    const char *const *verbs = cmd_verbs;
+    span_trim(&b, &e);
+    if (b == e || *b == '#') return false;
+
+    const char *w = b;
+    while (b < e && !is_space(*b)) b++;
+    size_t wl = (size_t)(b - w);
+    span_trim(&b, &e);
+    c->verb = CMD_BAD;
+    c->name = b; c->len = (size_t)(e - b);
+    for (int v = 0; v < CMD_BAD; v++)
+        if (strlen(verbs[v]) == wl && strncasecmp(verbs[v], w, wl) == 0) c->verb = (CmdVerb)v;
+
+    switch (c->verb) {
+        case CMD_ADD: {
+            CsvRow row;
+            CsvStatus st = b == e ? CSV_MALFORMED : csv_scan_line(b, e, 1000000, &row);
+            if (st == CSV_OK) {
+                c->name = row.name; c->len = row.name_len;
+                c->qty  = row.qty;  c->price = row.price;
+                break;
+            }
+            c->verb = CMD_BAD;
+            if (st == CSV_BAD_QTY || st == CSV_BAD_PRICE)
+                snprintf(c->err, sizeof c->err, "invalid %s '%.*s'",
+                         st == CSV_BAD_QTY ? "quantity" : "price",
+                         row.bad_len > 32 ? 32 : row.bad_len, row.bad);
+            else
+                snprintf(c->err, sizeof c->err, "expected add NAME,QTY,PRICE");
+            return true;
+        }
+        case CMD_SETQTY: case CMD_RESERVE: case CMD_RELEASE: {
+            const char *comma = memchr(b, ',', (size_t)(e - b));
+            const char *nb = b, *ne = comma ? comma : e, *qb = comma ? comma + 1 : e, *qe = e;
+            span_trim(&nb, &ne);
+            span_trim(&qb, &qe);
+            if (!comma || nb == ne || qb == qe) {
+                snprintf(c->err, sizeof c->err, "expected %s NAME,QTY", verbs[c->verb]);
+                c->verb = CMD_BAD;
+                return true;
+            }
+            if (!scan_qty(qb, qe, &c->qty)) {
+                c->verb = CMD_BAD;
+                snprintf(c->err, sizeof c->err, "invalid quantity '%.*s'",
+                         qe - qb > 32 ? 32 : (int)(qe - qb), qb);
+                return true;
+            }
+            c->name = nb; c->len = (size_t)(ne - nb);
+            break;
+        }
+        case CMD_REMOVE: case CMD_GET: case CMD_IMPORT: case CMD_SEARCH:
+            if (b == e) {
+                snprintf(c->err, sizeof c->err, "expected %s %s", verbs[c->verb],
+                     c->verb == CMD_IMPORT ? "FILE" : c->verb == CMD_SEARCH ? "TEXT" : "NAME");
+                c->verb = CMD_BAD;
+                return true;
+            }
+            break;
+        case CMD_LOW: case CMD_TOP:
+            if (b == e || !scan_qty(b, e, &c->qty)) {
+                if (b == e) snprintf(c->err, sizeof c->err, "expected %s %s", verbs[c->verb],
+                                     c->verb == CMD_TOP ? "COUNT" : "QTY");
+                else        snprintf(c->err, sizeof c->err, "invalid %s '%.*s'",
+                                     c->verb == CMD_TOP ? "count" : "quantity",
+                                     e - b > 32 ? 32 : (int)(e - b), b);
+                c->verb = CMD_BAD;
+            }
+            return true;
+        case CMD_PRICES: {
+            const char *comma = memchr(b, ',', (size_t)(e - b));
+            const char *lb = b, *le = comma ? comma : e, *hb = comma ? comma + 1 : e, *he = e;
+            span_trim(&lb, &le);
+            span_trim(&hb, &he);
+            if (!comma || !scan_price(lb, le, &c->price) || !scan_price(hb, he, &c->price_max)) {
+                c->verb = CMD_BAD;
+                snprintf(c->err, sizeof c->err, "expected prices MIN,MAX");
+            }
+            return true;
+        }
+        case CMD_LIST: case CMD_EXPORT: {
+            ListQuery  q;
+            ListFormat fmt;
+            const char *opt = b;
+            if (c->verb == CMD_EXPORT) {
+                while (opt < e && !is_space(*opt)) opt++;
+                if (b == e) {
+                    snprintf(c->err, sizeof c->err, "expected export FILE [OPTION...]");
+                    c->verb = CMD_BAD;
+                    return true;
+                }
+            }
+            if (!list_parse(opt, e, &q, &fmt, c->err, sizeof c->err)) c->verb = CMD_BAD;
+            return true;
+        }
+        case CMD_CHAIN: {
+            const char *s = b;
+            while (b < e && !is_space(*b)) b++;
+            size_t sl = (size_t)(b - s);
+            span_trim(&b, &e);
+            c->chain_get = sl == 3 && strncasecmp(s, "get", 3) == 0;
+            if (c->chain_get && b != e) { c->name = b; c->len = (size_t)(e - b); break; }
+            if (!(sl == 5 && strncasecmp(s, "total", 5) == 0 && b == e)) {
+                snprintf(c->err, sizeof c->err, "expected chain total or chain get NAME");
+                c->verb = CMD_BAD;
+            }
+            return true;
+        }
+        case CMD_TOTAL: case CMD_SAVE: case CMD_ABC: case CMD_STATS:
+            if (b != e) {
+                snprintf(c->err, sizeof c->err, "%s takes no arguments", verbs[c->verb]);
+                c->verb = CMD_BAD;
+            }
+            return true;
+        default:
+            snprintf(c->err, sizeof c->err, "unknown command '%.*s'", wl > 32 ? 32 : (int)wl, w);
+            return true;
+    }
+    c->hash = name_hash(c->name, c->len);
+    return true;
+}
+
+static void out_item(OutBuf *o, const char *verb, const char *name, int32_t qty, Money price) {
+    char pb[MONEY_BUF];
+    out_printf(o, "OK %s %s,%d,%s\n", verb, name, qty, money_str(pb, price));
+}
+
+/* " name,qty,price;name,qty,price;...\n": the rest of a report reply on image im. */
+static void out_items(OutBuf *o, const StoreImage *im, const int *v, size_t n) {
+    char pb[MONEY_BUF];
+    for (size_t i = 0; i < n; i++)
+        out_printf(o, "%c%s,%d,%s", i ? ';' : ' ', img_name(im, v[i]),
+                   IMG_COL(im, qty, v[i]), money_str(pb, IMG_COL(im, price, v[i])));
+    out_printf(o, "\n");
+}
+
+static void out_error(OutBuf *o, const BatchCmd *c, OpStatus st) {
+    char msg[LINE_BUF + 64];
+    op_text(st, c->name, c->len, c->verb != CMD_SETQTY, msg, sizeof msg);
+    out_printf(o, "ERR %d: %s\n", c->line, msg);
+}
+
+/* A report that could not pin the store: damaged, or short of memory. */
+static bool out_unpinned(OutBuf *o, const BatchCmd *c) {
+    if (snap_failed()) out_error(o, c, OP_DAMAGED);
+    else               out_printf(o, "ERR %d: out of memory\n", c->line);
+    return false;
+}
+
+/*
+ * Apply one parsed command and format its result. Returns true on
+ * success. A damaged store (snap_failed()) refuses every command.
+ */
+static bool batch_apply(const BatchCmd *c, OutBuf *o) {
+    OpStatus st = OP_OK;
+    int      idx = 0;
+    bool     created;
+    if (snap_failed()) { out_error(o, c, OP_DAMAGED); return false; }
+    switch (c->verb) {
+        case CMD_ADD:
+            st = inv_add(c->name, c->len, c->hash, c->qty, c->price, &idx, &created);
+            break;
+        case CMD_SETQTY:
+            st = inv_setqty(c->name, c->len, c->hash, c->qty, &idx);
+            break;
+        case CMD_RESERVE: case CMD_RELEASE: {
+            int32_t now;
+            st = (c->verb == CMD_RESERVE ? inv_reserve : inv_release)
+                     (c->name, c->len, c->hash, c->qty, &idx, &now);
+            break;
+        }
+        case CMD_REMOVE:
+            st = inv_remove(c->name, c->len, c->hash);
+            if (st == OP_OK) out_printf(o, "OK remove %.*s\n", (int)c->len, c->name);
+            break;
+        case CMD_GET:
+            st = inv_find(c->name, c->len, c->hash, &idx);
+            break;
+        case CMD_TOTAL: {
+            char tb[MONEY_BUF];
+            out_printf(o, "OK total %s %d %lld\n", money_str(tb, calculate_total()), g_count,
+                       (long long)g_total_units);
+            break;
+        }
+        case CMD_SAVE:
+            if (!save_inventory()) {
+                if (snap_failed()) out_error(o, c, OP_DAMAGED);
+                else               out_printf(o, "ERR %d: save failed\n", c->line);
+                return false;
+            }
+            out_printf(o, "OK save\n");
+            break;
+        case CMD_IMPORT: {
+            char path[LINE_BUF];
+            ImportStats is;
+            snprintf(path, sizeof path, "%.*s", (int)c->len, c->name);
+            if (!import_csv(path, &is)) {
+                if (snap_failed()) out_error(o, c, OP_DAMAGED);
+                else               out_printf(o, "ERR %d: import of '%s' failed\n", c->line, path);
+                return false;
+            }
+            out_printf(o, "OK import %s %ld %ld %ld\n", path, is.inserted, is.updated,
+                       is.rejected);
+            break;
+        }
+        case CMD_LOW: case CMD_PRICES: {
+            bool   by_price = c->verb == CMD_PRICES;
+            int   *v;
+            size_t n;
+            if (!snap_touch_all()) { out_error(o, c, OP_DAMAGED); return false; }
+            if (!ord_range(by_price, by_price ? c->price : INT64_MIN,
+                           by_price ? c->price_max : c->qty, &v, &n)) {
+                out_printf(o, "ERR %d: out of memory\n", c->line);
+                return false;
+            }
+            StoreImage live;
+            store_image_live(&live, 0);
+            out_printf(o, "OK %s %zu", cmd_verbs[c->verb], n);
+            out_items(o, &live, v, n);
+            free(v);
+            break;
+        }
+        case CMD_LIST: {
+            ListQuery  q;
+            int       *v;
+            size_t     n, matched;
+            StoreImage im;
+            list_parse(c->name, c->name + c->len, &q, NULL, NULL, 0); /* checked by batch_parse */
+            if (!view_pin(&im)) return out_unpinned(o, c);
+            if (!list_select(&q, &im, &v, &n, &matched)) {
+                store_unpin(&im);
+                out_printf(o, "ERR %d: out of memory\n", c->line);
+                return false;
+            }
+            out_printf(o, "OK list %zu %zu", matched, n);
+            out_items(o, &im, v, n);
+            store_unpin(&im);
+            free(v);
+            break;
+        }
+        case CMD_EXPORT: {
+            char        path[LINE_BUF], tmp[LINE_BUF + 8];
+            const char *w = c->name, *e = c->name + c->len;
+            while (w < e && !is_space(*w)) w++;
+            size_t      pl  = (size_t)(w - c->name);
+            ListFormat  fmt = pl > 5 && strncasecmp(w - 5, ".json", 5) == 0 ? LIST_JSON : LIST_CSV;
+            ListQuery   q;
+            size_t      n;
+            StoreImage  im;
+            snprintf(path, sizeof path, "%.*s", (int)pl, c->name);
+            snprintf(tmp, sizeof tmp, "%s.tmp", path);
+            list_parse(w, e, &q, &fmt, NULL, 0); /* checked by batch_parse */
+            mutex_lock(&g_save_lock);
+            bool ok = view_pin(&im);
+            if (!ok && !snap_failed())
+                fprintf(stderr, "[ERROR] Out of memory writing '%s'.\n", path);
+            ok = ok && list_export(path, tmp, fmt, &q, &im, &n);
+            store_unpin(&im);
+            mutex_unlock(&g_save_lock);
+            if (!ok) {
+                if (snap_failed()) out_error(o, c, OP_DAMAGED);
+                else               out_printf(o, "ERR %d: export to '%s' failed\n", c->line, path);
+                return false;
+            }
+            out_printf(o, "OK export %s %zu\n", path, n);
+            break;
+        }
+        case CMD_TOP: {
+            ListQuery  q;
+            int       *v = NULL;
+            size_t     n = 0, matched;
+            StoreImage im;
+            list_query_init(&q, SORT_VALUE);
+            q.desc  = true;
+            q.limit = (size_t)c->qty;
+            if (!view_pin(&im)) return out_unpinned(o, c);
+            if (c->qty && !list_select(&q, &im, &v, &n, &matched)) {
+                store_unpin(&im);
+                out_printf(o, "ERR %d: out of memory\n", c->line);
+                return false;
+            }
+            out_printf(o, "OK top %zu", n);
+            out_items(o, &im, v, n);
+            store_unpin(&im);
+            free(v);
+            break;
+        }
+        case CMD_ABC: {
+            AbcReport  r;
+            StoreImage im;
+            bool       ok = view_pin(&im);
+            ok = ok && abc_analyze(&im, &r);
+            store_unpin(&im);
+            if (!ok) return out_unpinned(o, c);
+            char mb[MONEY_BUF];
+            out_printf(o, "OK abc %s", money_str(mb, r.total));
+            for (int k = 0; k < 3; k++)
+                out_printf(o, " %zu %s", r.items[k], money_str(mb, r.cents[k]));
+            out_printf(o, "\n");
+            break;
+        }
+        case CMD_STATS:
+#if INVENTORY_STATS
+            out_printf(o, "OK stats");
+            stats_format(o, false);
+            out_printf(o, "\n");
+            break;
+#else
+            out_printf(o, "ERR %d: built without statistics\n", c->line);
+            return false;
+#endif
+        case CMD_CHAIN: {
+            if (!g_chain.on) {
+                out_printf(o, "ERR %d: no chain loaded (start with --chain=FILE)\n", c->line);
+                return false;
+            }
+            char     vb[MONEY_BUF];
+            ChainKey key = { c->name, c->len, c->hash };
+            ChainSum t   = c->chain_get ? chain_reduce(chain_map_item, &key)
+                                        : chain_reduce(chain_map_total, NULL);
+            if (c->chain_get)
+                out_printf(o, "OK chain get %.*s %zu %lld %s\n", (int)c->len, c->name, t.stores,
+                           (long long)t.units, money_str(vb, t.value));
+            else
+                out_printf(o, "OK chain total %s %zu %zu %lld\n", money_str(vb, t.value),
+                           t.stores, t.items, (long long)t.units);
+            break;
+        }
+        case CMD_SEARCH: {
+            int  hits[SEARCH_TOP];
+            bool more;
+            if (!snap_touch_all()) { out_error(o, c, OP_DAMAGED); return false; }
+            int  n = search_find(c->name, c->len, hits, SEARCH_TOP, &more);
+            out_printf(o, "OK search %d", n);
+            for (int i = 0; i < n; i++)
+                out_printf(o, "%c%s", i ? ',' : ' ', name_str(ITEM_NAME(hits[i])));
+            out_printf(o, "\n");
+            break;
+        }
+        default:
+            out_printf(o, "ERR %d: %s\n", c->line, c->err);
+            return false;
+    }
+    if (st != OP_OK) { out_error(o, c, st); return false; }
+    if (c->verb <= CMD_RELEASE && c->verb != CMD_REMOVE)
+        out_item(o, cmd_verbs[c->verb], name_str(ITEM_NAME(idx)), ITEM_QTY(idx), ITEM_PRICE(idx));
+    return true;
+}
+
+/*
+ * batch_run
+ *   Runs commands from `path` ("-" for stdin) until end of input.
+ *   Returns the process exit status: failure if the input could not be
+ *   read or any command failed.
+ */
+static int batch_run(const char *path) {
+    static BatchCmd cmd[BATCH_OPS];
+    LineReader r = { .read = lr_read_file, .src = stdin, .cap = SAVE_BUF };
+    OutBuf     o = { NULL, 0, 0, false };
+    if (strcmp(path, "-") != 0 && !(r.src = fopen(path, "rb"))) {
+        fprintf(stderr, "[ERROR] Cannot open '%s': %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (!(r.buf = malloc(r.cap))) {
+        fprintf(stderr, "[ERROR] Out of memory.\n");
+        if (r.src != stdin) fclose(r.src);
+        return EXIT_FAILURE;
+    }
+    int lineno = 0, done = 0, failed = 0;
+    const char *b, *e;
+    for (bool more = true; more; ) {
+        /* Gather a batch from buffered lines, refilling only when empty. */
+        int n = 0;
+        while (n < BATCH_OPS && (more = lr_next(&r, &b, &e, n == 0))) {
+            lineno++;
+            cmd[n].line = lineno;
+            if (!batch_parse(b, e, &cmd[n])) continue;
+            if (cmd[n].verb <= CMD_RELEASE) PREFETCH(index_home(cmd[n].hash));
+            n++;
+        }
+        if (!more && !r.eof && !r.error) more = true; /* buffer drained mid-batch */
+        wal_batch();
+        for (int k = 0; k < n; k++) {
+            bool own = cmd[k].verb == CMD_SAVE || cmd[k].verb == CMD_IMPORT;
+            if (own) wal_commit();
+            failed += !batch_apply(&cmd[k], &o);
+            if (own) wal_batch();
+        }
+        wal_commit();
+        done += n;
+        if (o.len) fwrite(o.buf, 1, o.len, stdout);
+        o.len = 0;
+    }
+    fflush(stdout);
+    if (r.error) fprintf(stderr, "[ERROR] Cannot read '%s': %s\n", path, strerror(errno));
+    if (r.src != stdin) fclose(r.src);
+    free(r.buf);
+    free(o.buf);
+    fprintf(stderr, "[INFO] Batch: %d command(s), %d failed.\n", done, failed);
+    return r.error || failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Server mode
+ *    --serve=[HOST:]PORT accepts TCP clients speaking the batch
+ *    protocol above. One thread polls every idle connection and hands
+ *    those with requests waiting to a pool of worker threads, which
+ *    answer what has arrived and hand them back, so no thread waits on
+ *    a quiet client and any number of clients share the workers.
+ *    Locking:
+ *    - The store gate is a big-reader lock with one mutex per worker.
+ *      Every request takes its own worker's, which no other request
+ *      contends for; import, checkpoints, store_pin(), the reports and
+ *      the rare changes serve_shape() cannot make take all of them.
+ *    - Each index shard has a reader-writer lock, for the items whose
+ *      names hash to it. A new name, a removal or a restock at a new
+ *      price write-locks the shards it changes (a removal also moves
+ *      the last item, possibly of another shard), in shard order, and
+ *      g_serve.shape, which orders those changes among themselves and
+ *      guards the count and name pool. Requests on other shards carry
+ *      on meanwhile.
+ *    - save, list, export, top and abc take no gate but for the pin,
+ *      and then read their pinned image while others keep changing the
+ *      store (see "Store versions").
+ *    - Under a shard's read lock its index, item positions and prices
+ *      are fixed, so get, setqty, reserve, release and same-price
+ *      restocks touch only the item's quantity counter, with the
+ *      lock-free updates of item_adjust()/item_exchange(). Concurrent
+ *      checkouts of one hot SKU meet only in its compare-and-swap.
+ *    Pipelined requests are handled BATCH_OPS at a time and answered
+ *    together after wal_wait(), so clients share the flusher's fsyncs.
+ *    A server can also feed its change log to read-only followers (see
+ *    "Replication").
+ * ══════════════════════════════════════════════════════════════ */
+
+#ifdef _WIN32
+typedef SOCKET Socket;
+#define SOCKET_NONE INVALID_SOCKET
+static void sock_close(Socket s)    { closesocket(s); }
+static void sock_shutdown(Socket s) { shutdown(s, SD_BOTH); }
+typedef WSAPOLLFD PollFd;
+static int sock_poll(PollFd *f, size_t n) { return WSAPoll(f, (ULONG)n, -1); }
+#else
+typedef int Socket;
+#define SOCKET_NONE (-1)
+static void sock_close(Socket s)    { close(s); }
+static void sock_shutdown(Socket s) { shutdown(s, SHUT_RDWR); }
+typedef struct pollfd PollFd;
+static int sock_poll(PollFd *f, size_t n) { return poll(f, (nfds_t)n, -1); }
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static long lr_read_sock(void *src, char *buf, size_t n) {
+    for (;;) {
+        long got = (long)recv(*(Socket *)src, buf, n > INT_MAX ? INT_MAX : (int)n, 0);
+        if (got >= 0) return got;
+#ifndef _WIN32
+        if (errno == EINTR) continue;
+#endif
+        return -1;
+    }
+}
+
+static bool sock_send_all(Socket s, const char *p, size_t n) {
+    while (n > 0) {
+        long put = (long)send(s, p, n > INT_MAX ? INT_MAX : (int)n, MSG_NOSIGNAL);
+        if (put < 0) {
+#ifndef _WIN32
+            if (errno == EINTR) continue;
+#endif
+            return false;
+        }
+        p += put; n -= (size_t)put;
+    }
+    return true;
+}
+
+/* Receive exactly n bytes. False on EOF or error. */
+static bool sock_recv_all(Socket s, char *p, size_t n) {
+    while (n > 0) {
+        long got = lr_read_sock(&s, p, n);
+        if (got <= 0) return false;
+        p += got; n -= (size_t)got;
+    }
+    return true;
+}
+
+/* Resolve "[HOST:]PORT" (HOST defaults to 127.0.0.1); prints and returns NULL on error. */
+static struct addrinfo *sock_resolve(const char *spec, bool passive) {
+    char host[LINE_BUF] = "127.0.0.1";
+    const char *port = spec, *colon = strrchr(spec, ':');
+    if (colon) {
+        const char *h = spec, *he = colon;
+        if (*h == '[' && he > h && he[-1] == ']') { h++; he--; } /* [::1]:PORT */
+        snprintf(host, sizeof host, "%.*s", (int)(he - h), h);
+        port = colon + 1;
+    }
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = passive ? AI_PASSIVE : 0;
+    int rc = getaddrinfo(host[0] ? host : NULL, port, &hints, &res);
+    if (rc != 0) {
+        fprintf(stderr, "[ERROR] Cannot resolve '%s': %s\n", spec, gai_strerror(rc));
+        return NULL;
+    }
+    return res;
+}
+
+/* Listening socket for "[HOST:]PORT" (HOST defaults to 127.0.0.1). */
+static Socket sock_listen(const char *spec) {
+    struct addrinfo *res = sock_resolve(spec, true), *ai;
+    if (!res) return SOCKET_NONE;
+    Socket s = SOCKET_NONE;
+    for (ai = res; ai && s == SOCKET_NONE; ai = ai->ai_next) {
+        s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (s == SOCKET_NONE) continue;
+        int on = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof on);
+        if (bind(s, ai->ai_addr, (socklen_t)ai->ai_addrlen) != 0 || listen(s, SOMAXCONN) != 0) {
+            sock_close(s);
+            s = SOCKET_NONE;
+        }
+    }
+    freeaddrinfo(res);
+    if (s == SOCKET_NONE)
+        fprintf(stderr, "[ERROR] Cannot listen on '%s': %s\n", spec, strerror(errno));
+    return s;
+}
+
+/* Connected socket to "[HOST:]PORT", with Nagle off; SOCKET_NONE on failure. */
+static Socket sock_connect(const char *spec) {
+    struct addrinfo *res = sock_resolve(spec, false), *ai;
+    if (!res) return SOCKET_NONE;
+    Socket s = SOCKET_NONE;
+    for (ai = res; ai && s == SOCKET_NONE; ai = ai->ai_next) {
+        s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (s == SOCKET_NONE) continue;
+        if (connect(s, ai->ai_addr, (socklen_t)ai->ai_addrlen) != 0) {
+            sock_close(s);
+            s = SOCKET_NONE;
+        }
+    }
+    freeaddrinfo(res);
+    if (s == SOCKET_NONE) return SOCKET_NONE;
+    int on = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof on);
+    return s;
+}
+
+/*
+ * A loopback UDP socket connected to itself: each send() makes it
+ * readable, which wakes a poll() of it (pipes cannot be polled
+ * alongside sockets on Windows). SOCKET_NONE on failure.
+ */
+static Socket sock_wake_open(void) {
+    struct sockaddr_in a;
+    socklen_t n = sizeof a;
+    memset(&a, 0, sizeof a);
+    a.sin_family      = AF_INET;
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Socket s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s == SOCKET_NONE) return SOCKET_NONE;
+    if (bind(s, (struct sockaddr *)&a, sizeof a) != 0 ||
+        getsockname(s, (struct sockaddr *)&a, &n) != 0 ||
+        connect(s, (struct sockaddr *)&a, sizeof a) != 0) {
+        sock_close(s);
+        return SOCKET_NONE;
+    }
+    return s;
+}
+
+typedef struct {
+    _Alignas(64) Mutex gate;    /* this worker's share of the store gate */
+    Socket             conn;    /* client being served (under g_serve.lock) */
+    Thread             th;
+    TaskArg            arg;
+    bool               started;
+} ServeWorker;
+
+/* A client connection, and its requests read but not yet answered. */
+typedef struct ServeConn {
+    Socket            sock;
+    LineReader        r;
+    int               lineno;
+    struct ServeConn *next; /* in g_serve.ready or g_serve.back */
+} ServeConn;
+
+typedef struct {
+    _Alignas(64) RwLock lock;   /* the items of one index shard */
+} ShardLock;
+
+static struct {
+    Socket       listener;
+    int          nworkers;
+    ServeWorker *w;
+    Mutex        lock;      /* guards ServeWorker.conn and the lists below */
+    Cond         more;      /* a client is ready, or stop */
+    ServeConn   *ready, *ready_tail; /* clients with requests, for the workers */
+    ServeConn   *back;      /* clients answered, for the poller            */
+    Socket       wake;      /* makes the poller take g_serve.back, or stop */
+    Thread       poll_th;
+    TaskArg      poll_arg;
+    Mutex        shape;     /* held by serve_shape() changes */
+    ShardLock    shard[INDEX_SHARDS];
+    atomic_bool  stop;
+#ifdef _WIN32
+    HANDLE       stop_event;
+#endif
+} g_serve;
+
+static int  g_serve_threads = SERVE_THREADS; /* --serve-threads */
+static bool g_read_only;                     /* --follow: changes come from the primary */
+
+static void gate_exclusive(void) {
+    for (int w = 0; w < g_serve.nworkers; w++) mutex_lock(&g_serve.w[w].gate);
+}
+
+static void gate_release(void) {
+    for (int w = g_serve.nworkers - 1; w >= 0; w--) mutex_unlock(&g_serve.w[w].gate);
+}
+
+/* The lock of the shard `hash` belongs to. */
+static inline RwLock *shard_lock(uint32_t hash) {
+    return &g_serve.shard[hash >> (32 - INDEX_SHARD_BITS)].lock;
+}
+
+/* g_pin_gate while serving: pins are taken with every worker held off. */
+static void gate_pin(bool take) {
+    if (take) gate_exclusive();
+    else      gate_release();
+}
+
+/*
+ * The store gate of n workers and the locks under it, with g_serving
+ * and g_pin_gate set as the workers need; serve_gates_close() undoes it.
+ */
+static bool serve_gates_open(int n) {
+    if (!(g_serve.w = calloc((size_t)n, sizeof *g_serve.w))) return false;
+    g_serve.nworkers = n;
+    mutex_init(&g_serve.shape);
+    for (int s = 0; s < INDEX_SHARDS; s++) rw_init(&g_serve.shard[s].lock);
+    for (int w = 0; w < n; w++) {
+        mutex_init(&g_serve.w[w].gate);
+        g_serve.w[w].conn = SOCKET_NONE;
+    }
+    g_serving  = true;
+    g_pin_gate = gate_pin;
+    return true;
+}
+
+static void serve_gates_close(void) {
+    g_serving  = false;
+    g_pin_gate = NULL;
+    free(g_serve.w);
+    g_serve.w        = NULL;
+    g_serve.nworkers = 0;
+}
+
+/*
+ * serve_point
+ *   Requests on a known item's quantity, under worker w's shared gate
+ *   and its shard's read lock. Returns false (having output nothing)
+ *   when the request needs serve_shape() instead, an add of a new name
+ *   or at a new price, or the exclusive gate: a change to an item whose
+ *   chunk a pinned image shares (copying it replaces the chunk, which
+ *   readers of other shards may hold).
+ */
+static bool serve_point(int w, const BatchCmd *c, OutBuf *o, bool *ok) {
+    static const StatOp op[] = {
+        [CMD_ADD] = STAT_ADD, [CMD_SETQTY] = STAT_UPDATE, [CMD_GET] = STAT_FIND,
+        [CMD_RESERVE] = STAT_RESERVE, [CMD_RELEASE] = STAT_RELEASE
+    };
+    uint64_t t0 = stat_begin();
+    RwLock  *sl = shard_lock(c->hash);
+    mutex_lock(&g_serve.w[w].gate);
+    rw_lock_shared(sl);
+    bool ready = snap_ready(c->hash);
+    int  idx   = ready ? index_probe(c->name, c->len, c->hash)->idx : -1;
+    if (ready &&
+        ((c->verb == CMD_ADD && c->qty > 0 && (idx < 0 || c->price != ITEM_PRICE(idx))) ||
+         (c->verb != CMD_GET && idx >= 0 &&
+          version_shared(g_chunk_epoch[(size_t)idx >> ITEM_CHUNK_SHIFT])))) {
+        rw_unlock_shared(sl);
+        mutex_unlock(&g_serve.w[w].gate);
+        return false;
+    }
+
+    OpStatus st  = !ready ? OP_DAMAGED : idx < 0 ? OP_NOT_FOUND : OP_OK;
+    int32_t  qty = 0;
+    if (ready && c->verb == CMD_ADD && c->qty <= 0) st = OP_BAD_QTY;
+    if (st == OP_OK) {
+        switch (c->verb) {
+            case CMD_GET:
+                qty = qty_load(&ITEM_QTY(idx));
+                break;
+            case CMD_SETQTY:
+                item_exchange(idx, c->qty);
+                qty = c->qty;
+                break;
+            default:
+                st = c->qty <= 0 ? OP_BAD_QTY
+                                 : item_adjust(idx, c->verb == CMD_RESERVE ? -c->qty : c->qty, &qty);
+                break;
+        }
+    }
+    if (st == OP_OK) out_item(o, cmd_verbs[c->verb], name_str(ITEM_NAME(idx)), qty, ITEM_PRICE(idx));
+    else             out_error(o, c, st);
+    rw_unlock_shared(sl);
+    mutex_unlock(&g_serve.w[w].gate);
+    stat_end(op[c->verb], t0);
+    *ok = st == OP_OK;
+    return true;
+}
+
+/*
+ * serve_shape
+ *   An add or a removal, under worker w's shared gate, g_serve.shape
+ *   and the write locks of the shards it changes. Returns false (having
+ *   output nothing) when it needs the exclusive gate instead: when it
+ *   would replace what requests on other shards may be reading (a chunk
+ *   a pinned image shares, a full chunk directory or ordered index, the
+ *   insertion counters on wrapping), or under --check-totals, whose
+ *   check reads every item.
+ */
+static bool serve_shape(int w, const BatchCmd *c, OutBuf *o, bool *ok) {
+    if (g_check_totals) return false;
+    mutex_lock(&g_serve.w[w].gate);
+    mutex_lock(&g_serve.shape);
+    if (!snap_ready(c->hash) || !snap_ready_shape(c->verb == CMD_REMOVE)) {
+        out_error(o, c, OP_DAMAGED);
+        *ok = false;
+        mutex_unlock(&g_serve.shape);
+        mutex_unlock(&g_serve.w[w].gate);
+        return true;
+    }
+    /* Only changes under g_serve.shape move items or fill the index. */
+    int  idx = index_probe(c->name, c->len, c->hash)->idx;
+    int  s   = (int)(c->hash >> (32 - INDEX_SHARD_BITS)), t = s;
+    bool fits = true;
+    if (idx >= 0) {
+        fits = !version_shared(g_chunk_epoch[(size_t)idx >> ITEM_CHUNK_SHIFT]);
+        if (c->verb == CMD_REMOVE) {
+            int last = g_count - 1;
+            snap_touch_item(last);
+            t = (int)(ITEM_HASH(last) >> (32 - INDEX_SHARD_BITS));
+        }
+    } else if (c->verb == CMD_ADD) {
+        size_t n = (size_t)g_count;
+        fits = g_seq_next != UINT32_MAX && (!g_ord.built || n < g_ord.cap) &&
+               (n < g_chunk_cnt * ITEM_CHUNK
+                    ? !version_shared(g_chunk_epoch[n >> ITEM_CHUNK_SHIFT])
+                    : g_chunk_cnt < g_chunk_dir);
+    }
+    if (fits) {
+        RwLock *a = &g_serve.shard[s < t ? s : t].lock, *b = &g_serve.shard[s < t ? t : s].lock;
+        rw_lock(a);
+        if (b != a) rw_lock(b);
+        g_shape_shared = true;
+        *ok = batch_apply(c, o);
+        g_shape_shared = false;
+        if (b != a) rw_unlock(b);
+        rw_unlock(a);
+    }
+    mutex_unlock(&g_serve.shape);
+    mutex_unlock(&g_serve.w[w].gate);
+    return fits;
+}
+
+static bool serve_apply(int w, const BatchCmd *c, OutBuf *o) {
+    bool ok = false;
+    switch (c->verb) {
+        case CMD_ADD: case CMD_SETQTY: case CMD_REMOVE: case CMD_RESERVE: case CMD_RELEASE:
+        case CMD_SAVE: case CMD_IMPORT:
+            if (!g_read_only) break;
+            out_printf(o, "ERR %d: read-only replica; send changes to the primary\n", c->line);
+            return false;
+        default:
+            break;
+    }
+    switch (c->verb) {
+        case CMD_ADD: case CMD_SETQTY: case CMD_GET: case CMD_RESERVE: case CMD_RELEASE:
+            if (serve_point(w, c, o, &ok)) return ok;
+            if (c->verb == CMD_ADD && serve_shape(w, c, o, &ok)) return ok;
+            break;
+        case CMD_REMOVE:
+            if (serve_shape(w, c, o, &ok)) return ok;
+            break;
+        case CMD_TOTAL: /* g_serve.shape for the item count */
+            mutex_lock(&g_serve.w[w].gate);
+            mutex_lock(&g_serve.shape);
+            ok = batch_apply(c, o);
+            mutex_unlock(&g_serve.shape);
+            mutex_unlock(&g_serve.w[w].gate);
+            return ok;
+        case CMD_BAD: case CMD_STATS: case CMD_CHAIN: /* the chain is read-only */
+        case CMD_SAVE: case CMD_LIST: case CMD_EXPORT: case CMD_TOP: case CMD_ABC:
+            return batch_apply(c, o); /* these pin the store themselves */
+        default:
+            break;
+    }
+    gate_exclusive();
+    ok = batch_apply(c, o);
+    gate_release();
+    return ok;
+}
+
+/*
+ * After a batch: take a checkpoint the log asked for while serving, and
+ * compact the name pool if a removal under the shard locks could not.
+ */
+static void serve_after(void) {
+    bool ckpt    = atomic_exchange(&g_ckpt_due, false);
+    bool compact = atomic_exchange(&g_compact_due, false);
+    if (!ckpt && !compact) return;
+    gate_exclusive();
+    if (ckpt) wal_checkpoint();
+    if (compact) name_pool_compact();
+    gate_release();
+}
+
+static ServeConn *serve_conn_new(Socket s) {
+    ServeConn *c = malloc(sizeof *c);
+    if (!c) return NULL;
+    *c = (ServeConn){ .sock = s, .next = NULL };
+    c->r = (LineReader){ .read = lr_read_sock, .src = &c->sock, .cap = 4096,
+                         .max = SERVE_LINE_MAX };
+    if (!(c->r.buf = malloc(c->r.cap))) { free(c); return NULL; }
+    int on = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof on);
+    return c;
+}
+
+static void serve_conn_free(ServeConn *c) {
+    sock_close(c->sock);
+    free(c->r.buf);
+    free(c);
+}
+
+/*
+ * serve_conn
+ *   Answers what client c has sent since it was last polled: one read,
+ *   then every complete request line, BATCH_OPS at a time, each batch
+ *   answered after wal_wait(). A partial line waits for the next read.
+ *   Returns false once the client is done: disconnected, sent too long
+ *   a line, or could not be answered.
+ */
+static bool serve_conn(int w, ServeConn *c, BatchCmd *cmd, OutBuf *o) {
+    const char *b, *e;
+    lr_fill(&c->r);
+    for (bool more = true; more; ) {
+        int n = 0;
+        while (n < BATCH_OPS && (more = lr_next(&c->r, &b, &e, false))) {
+            cmd[n].line = ++c->lineno;
+            if (batch_parse(b, e, &cmd[n])) n++;
+        }
+        for (int k = 0; k < n; k++) serve_apply(w, &cmd[k], o);
+        wal_wait(g_wal_mine);
+        serve_after();
+        bool sent = !o->len || sock_send_all(c->sock, o->buf, o->len);
+        o->len = 0;
+        if (!sent) return false;
+    }
+    return !c->r.eof && !c->r.error;
+}
+
+/* Worker w: answers the clients the poller finds ready until stop. */
+static void serve_worker(void *ctx, int w) {
+    (void)ctx;
+    BatchCmd *cmd = malloc(BATCH_OPS * sizeof *cmd);
+    OutBuf    o   = { NULL, 0, 0, false };
+    mutex_lock(&g_serve.lock);
+    while (cmd) {
+        while (!g_serve.ready && !atomic_load(&g_serve.stop))
+            cond_wait_ms(&g_serve.more, &g_serve.lock, -1);
+        ServeConn *c = g_serve.ready;
+        if (!c) break;
+        if (!(g_serve.ready = c->next)) g_serve.ready_tail = NULL;
+        g_serve.w[w].conn = c->sock;
+        mutex_unlock(&g_serve.lock);
+
+        bool keep = serve_conn(w, c, cmd, &o);
+
+        mutex_lock(&g_serve.lock);
+        g_serve.w[w].conn = SOCKET_NONE;
+        keep = keep && !atomic_load(&g_serve.stop);
+        bool wake = keep && !g_serve.back; /* the poller takes the whole list */
+        if (keep) { c->next = g_serve.back; g_serve.back = c; }
+        else      serve_conn_free(c);
+        if (wake) send(g_serve.wake, "", 1, 0);
+    }
+    mutex_unlock(&g_serve.lock);
+    free(o.buf);
+    free(cmd);
+}
+
+/*
+ * serve_poll
+ *   The poller: accepts clients and waits on every idle one (pfd[2..],
+ *   with conn[] alongside), queueing each that becomes readable for the
+ *   workers and taking it back once answered. Closes the idle ones on
+ *   stop.
+ */
+static void serve_poll(void *ctx, int unused) {
+    (void)ctx; (void)unused;
+    size_t      n = 2, cap = 64;
+    PollFd     *pfd  = malloc(cap * sizeof *pfd);
+    ServeConn **conn = malloc(cap * sizeof *conn);
+    if (!pfd || !conn) {
+        fprintf(stderr, "[ERROR] Out of memory polling clients.\n");
+        free(pfd); free(conn);
+        return;
+    }
+    pfd[0] = (PollFd){ .fd = g_serve.listener, .events = POLLIN };
+    pfd[1] = (PollFd){ .fd = g_serve.wake, .events = POLLIN };
+    while (!atomic_load(&g_serve.stop)) {
+        if (sock_poll(pfd, n) < 0) {
+#ifndef _WIN32
+            if (errno == EINTR) continue;
+#endif
+            fprintf(stderr, "[ERROR] Cannot poll clients: %s\n", strerror(errno));
+            break;
+        }
+        if (atomic_load(&g_serve.stop)) break;
+        ServeConn *in = NULL;
+        if (pfd[1].revents) {
+            char b;
+            recv(g_serve.wake, &b, 1, 0);
+            mutex_lock(&g_serve.lock);
+            in = g_serve.back;
+            g_serve.back = NULL;
+            mutex_unlock(&g_serve.lock);
+        }
+        if (pfd[0].revents & POLLIN) {
+            Socket s = accept(g_serve.listener, NULL, NULL);
+            ServeConn *c = s == SOCKET_NONE ? NULL : serve_conn_new(s);
+            if (c) { c->next = in; in = c; }
+            else if (s != SOCKET_NONE) sock_close(s);
+        }
+
+        /* Queue the clients with something to read, keeping the rest. */
+        ServeConn *head = NULL, *last = NULL;
+        for (size_t i = n; i-- > 2; ) {
+            if (!pfd[i].revents) continue;
+            conn[i]->next = NULL;
+            if (last) last->next = conn[i];
+            else      head = conn[i];
+            last    = conn[i];
+            pfd[i]  = pfd[n - 1];
+            conn[i] = conn[n - 1];
+            n--;
+        }
+        if (head) {
+            mutex_lock(&g_serve.lock);
+            if (g_serve.ready_tail) g_serve.ready_tail->next = head;
+            else                    g_serve.ready = head;
+            g_serve.ready_tail = last;
+            cond_broadcast(&g_serve.more);
+            mutex_unlock(&g_serve.lock);
+        }
+
+        while (in) {
+            ServeConn *c = in;
+            in = c->next;
+            if (n == cap) {
+                PollFd     *np = realloc(pfd, cap * 2 * sizeof *np);
+                if (np) pfd = np;
+                ServeConn **nc = np ? realloc(conn, cap * 2 * sizeof *nc) : NULL;
+                if (nc) { conn = nc; cap *= 2; }
+                else    { serve_conn_free(c); continue; } /* out of memory: drop it */
+            }
+            pfd[n]  = (PollFd){ .fd = c->sock, .events = POLLIN };
+            conn[n] = c;
+            n++;
+        }
+    }
+    for (size_t i = 2; i < n; i++) serve_conn_free(conn[i]);
+    free(pfd);
+    free(conn);
+}
+
+/* ─── Replication ─────────────────────────────────────────────── */
+/*
+ * --replicate=[HOST:]PORT lets read-only followers, started with
+ * --follow=HOST:PORT, mirror the store. A follower sends REPL_HELLO;
+ * the primary pins the store, writes the pinned image as a snapshot
+ * and sends it as "SNAP <bytes>\n" and the file, then streams every
+ * log record written after the pin as raw WAL records, in log order.
+ * Records reach the feed through g_wal_tap as they are written to
+ * the log and stay in one shared backlog until every follower has
+ * sent them. Each sender ships whatever has accumulated in one write
+ * and never waits for acknowledgements. A follower that falls
+ * REPL_BACKLOG bytes behind is dropped; it then reconnects and
+ * resynchronises from a fresh snapshot.
+ *
+ * A follower adopts the snapshot as its store, then applies each run
+ * of received records under the exclusive gate. Meanwhile its own
+ * server answers get, list, total and the other read-only commands.
+ */
+
+typedef struct {
+    Socket      conn;
+    uint64_t    pos;    /* feed bytes sent (or, before streaming, to start at) */
+    bool        active; /* pos holds back the backlog             */
+    bool        used;   /* slot has a thread to join              */
+    atomic_bool done;   /* that thread has finished               */
+    Thread      th;
+    TaskArg     arg;
+} ReplFollower;
+
+static struct {
+    Mutex        lock;      /* guards the feed and the follower slots */
+    Cond         more;      /* records were added, or stop            */
+    char        *buf;       /* backlog: feed bytes [base, base + len) */
+    size_t       len, cap;
+    uint64_t     base;
+    int          active;    /* followers with active set              */
+    bool         stop;
+    ReplFollower f[REPL_FOLLOWERS];
+    Socket       listener;
+    Thread       th;
+    TaskArg      arg;
+    bool         started;
+    Mutex        snap_lock; /* one catch-up snapshot file at a time    */
+} g_repl = { .listener = SOCKET_NONE };
+
+static const char *g_replicate; /* --replicate=[HOST:]PORT */
+
+/* Stop holding the backlog for follower f and cut its connection. Lock held. */
+static void repl_drop(ReplFollower *f) {
+    f->active = false;
+    g_repl.active--;
+    sock_shutdown(f->conn);
+}
+
+/*
+ * Discard the backlog every follower has sent; if n more bytes would
+ * still exceed REPL_BACKLOG, drop the slowest follower and retry.
+ * Lock held.
+ */
+static void repl_trim(size_t n) {
+    for (;;) {
+        uint64_t      low  = g_repl.base + g_repl.len;
+        ReplFollower *slow = NULL;
+        for (int i = 0; i < REPL_FOLLOWERS; i++)
+            if (g_repl.f[i].active && g_repl.f[i].pos <= low) {
+                low  = g_repl.f[i].pos;
+                slow = &g_repl.f[i];
+            }
+        size_t keep = (size_t)(g_repl.base + g_repl.len - low);
+        if (keep) memmove(g_repl.buf, g_repl.buf + (g_repl.len - keep), keep);
+        g_repl.len  = keep;
+        g_repl.base = low;
+        if (!slow || keep + n <= REPL_BACKLOG) return;
+        fprintf(stderr, "[WARN] A follower fell %zu MiB behind; dropping it.\n",
+                REPL_BACKLOG >> 20);
+        repl_drop(slow);
+    }
+}
+
+/* g_wal_tap while replicating: append a run of records to the feed. */
+static void repl_tap(const char *rec, size_t n) {
+    mutex_lock(&g_repl.lock);
+    if (g_repl.len + n > g_repl.cap) repl_trim(n);
+    if (g_repl.active && !vec_reserve(&g_repl.buf, &g_repl.cap, g_repl.len + n, 1)) {
+        fprintf(stderr, "[WARN] Out of memory replicating; dropping the followers.\n");
+        for (int i = 0; i < REPL_FOLLOWERS; i++)
+            if (g_repl.f[i].active) repl_drop(&g_repl.f[i]);
+    }
+    if (g_repl.active) {
+        memcpy(g_repl.buf + g_repl.len, rec, n);
+        g_repl.len += n;
+        cond_broadcast(&g_repl.more);
+    } else {
+        g_repl.base += g_repl.len + n; /* nobody to keep it for */
+        g_repl.len   = 0;
+    }
+    mutex_unlock(&g_repl.lock);
+}
+
+/* Send the store, pinned at the current log position, as a snapshot. */
+static bool repl_send_snapshot(ReplFollower *f) {
+    StoreImage im;
+    g_pin_gate(true);
+    mutex_lock(&g_wal.lock);
+    uint64_t lsn = g_wal.next_lsn - 1;
+    mutex_lock(&g_repl.lock);
+    f->pos    = g_repl.base + g_repl.len; /* the first record after the pin */
+    f->active = true;
+    g_repl.active++;
+    mutex_unlock(&g_repl.lock);
+    mutex_unlock(&g_wal.lock);
+    bool ok = store_pin(&im, lsn);
+    g_pin_gate(false);
+    if (!ok) {
+        fprintf(stderr, "[ERROR] Out of memory pinning the store for a follower.\n");
+        return false;
+    }
+
+    mutex_lock(&g_repl.snap_lock);
+    ok = snapshot_write(&im, REPL_SNAP_FILE, REPL_SNAP_TMP, false);
+    store_unpin(&im);
+    FileView fv;
+    if (ok && (ok = file_view_open(REPL_SNAP_FILE, &fv, false))) {
+        char line[32];
+        int  k = snprintf(line, sizeof line, "SNAP %zu\n", fv.len);
+        ok = sock_send_all(f->conn, line, (size_t)k) && sock_send_all(f->conn, fv.data, fv.len);
+        file_view_close(&fv);
+    }
+    remove(REPL_SNAP_FILE);
+    mutex_unlock(&g_repl.snap_lock);
+    if (ok) printf("[INFO] Follower caught up to LSN %llu; streaming.\n", (unsigned long long)lsn);
+    fflush(stdout);
+    return ok;
+}
+
+/* One follower's connection: the catch-up snapshot, then the feed. */
+static void repl_sender(void *ctx, int i) {
+    (void)ctx;
+    ReplFollower *f = &g_repl.f[i];
+    char hello[sizeof REPL_HELLO - 1];
+    bool ok = sock_recv_all(f->conn, hello, sizeof hello) &&
+              memcmp(hello, REPL_HELLO, sizeof hello) == 0 && repl_send_snapshot(f);
+
+    char *out = ok ? malloc(SAVE_BUF) : NULL;
+    mutex_lock(&g_repl.lock);
+    while (out && f->active && !g_repl.stop) {
+        if (f->pos == g_repl.base + g_repl.len) {
+            cond_wait_ms(&g_repl.more, &g_repl.lock, -1);
+            continue;
+        }
+        size_t off = (size_t)(f->pos - g_repl.base);
+        size_t n   = g_repl.len - off < SAVE_BUF ? g_repl.len - off : SAVE_BUF;
+        memcpy(out, g_repl.buf + off, n);
+        mutex_unlock(&g_repl.lock);
+        bool sent = sock_send_all(f->conn, out, n);
+        mutex_lock(&g_repl.lock);
+        if (!sent) break;
+        f->pos += n;
+    }
+    if (f->active) { f->active = false; g_repl.active--; }
+    sock_close(f->conn);
+    f->conn = SOCKET_NONE;
+    mutex_unlock(&g_repl.lock);
+    free(out);
+    atomic_store(&f->done, true);
+}
+
+static void repl_accept(void *ctx, int worker) {
+    (void)ctx; (void)worker;
+    while (!atomic_load(&g_serve.stop)) {
+        Socket s = accept(g_repl.listener, NULL, NULL);
+        if (s == SOCKET_NONE) continue;
+        mutex_lock(&g_repl.lock);
+        ReplFollower *f = NULL;
+        for (int i = 0; i < REPL_FOLLOWERS && !f; i++) {
+            ReplFollower *t = &g_repl.f[i];
+            if (t->used && atomic_load(&t->done)) { thread_join(t->th); t->used = false; }
+            if (!t->used) {
+                f = t;
+                f->conn = s;
+                atomic_store(&f->done, false);
+                f->arg  = (TaskArg){ repl_sender, NULL, i };
+                f->used = !g_repl.stop && thread_start(&f->th, &f->arg);
+                if (!f->used) f->conn = SOCKET_NONE;
+            }
+        }
+        mutex_unlock(&g_repl.lock);
+        if (!f || !f->used) {
+            if (!f) fprintf(stderr, "[WARN] More than %d followers; refusing one.\n", REPL_FOLLOWERS);
+            sock_close(s);
+        } else {
+            int on = 1;
+            setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof on);
         }
-        fprintf(stderr, "[ERROR] Cannot open '%s': %s\n",
-                INVENTORY_FILE, strerror(errno));
+    }
+}
+
+/* Listen for followers on --replicate and start feeding them. */
+static bool repl_start(void) {
+    mutex_init(&g_repl.lock);
+    mutex_init(&g_repl.snap_lock);
+    cond_init(&g_repl.more);
+    for (int i = 0; i < REPL_FOLLOWERS; i++) g_repl.f[i].conn = SOCKET_NONE;
+    g_repl.listener = sock_listen(g_replicate);
+    if (g_repl.listener == SOCKET_NONE) return false;
+    mutex_lock(&g_wal.lock);
+    g_wal_tap = repl_tap;
+    mutex_unlock(&g_wal.lock);
+    g_repl.arg     = (TaskArg){ repl_accept, NULL, 0 };
+    g_repl.started = thread_start(&g_repl.th, &g_repl.arg);
+    if (!g_repl.started) {
+        fprintf(stderr, "[ERROR] Cannot start the replication thread.\n");
         return false;
     }
+    printf("[INFO] Replicating to followers on %s.\n", g_replicate);
+    return true;
+}
 
-    char line[LINE_BUF];
-    int  lineno = 0;
-    g_count = 0;
+/* Disconnect the followers and wait for their threads. Call after g_serve.stop is set. */
+static void repl_stop(void) {
+    if (g_repl.listener == SOCKET_NONE) return;
+    mutex_lock(&g_wal.lock);
+    g_wal_tap = NULL;
+    mutex_unlock(&g_wal.lock);
+    sock_shutdown(g_repl.listener);
+    sock_close(g_repl.listener);
+    if (g_repl.started) thread_join(g_repl.th);
+    mutex_lock(&g_repl.lock);
+    g_repl.stop = true;
+    cond_broadcast(&g_repl.more);
+    for (int i = 0; i < REPL_FOLLOWERS; i++)
+        if (g_repl.f[i].conn != SOCKET_NONE) sock_shutdown(g_repl.f[i].conn);
+    mutex_unlock(&g_repl.lock);
+    for (int i = 0; i < REPL_FOLLOWERS; i++)
+        if (g_repl.f[i].used) thread_join(g_repl.f[i].th);
+    free(g_repl.buf);
+    g_repl.listener = SOCKET_NONE;
+}
 
-    while (fgets(line, sizeof line, fp)) {
-        lineno++;
-        trim(line);
+/* ─── Following ─── */
 
-        /* Skip blank lines and comments */
-        if (line[0] == '\0' || line[0] == '#') continue;
+static struct {
+    const char *spec;     /* --follow=HOST:PORT                 */
+    Socket      conn;     /* under lock, for follow_stop()       */
+    char       *buf;      /* received records not yet applied    */
+    size_t      len, cap;
+    uint64_t    base;     /* LSN the adopted snapshot includes   */
+    uint64_t    lsn;      /* highest change applied since        */
+    Mutex       lock;
+    Cond        wake;     /* follow_stop() to a retry wait       */
+    Thread      th;
+    TaskArg     arg;
+    bool        started;
+} g_follow = { .conn = SOCKET_NONE };
 
-        if (g_count >= MAX_ITEMS) {
-            fprintf(stderr, "[WARN] Max capacity (%d) reached; remaining lines ignored.\n",
-                    MAX_ITEMS);
-            break;
-        }
+/* Receive more bytes into g_follow.buf (at most `max`). False on EOF or error. */
+static bool follow_fill(size_t max) {
+    if (!vec_reserve(&g_follow.buf, &g_follow.cap, g_follow.len + SAVE_BUF, 1)) return false;
+    size_t room = g_follow.cap - g_follow.len;
+    long got = lr_read_sock(&g_follow.conn, g_follow.buf + g_follow.len, room < max ? room : max);
+    if (got <= 0) return false;
+    g_follow.len += (size_t)got;
+    return true;
+}
 
-        /* Parse: name , quantity , price */
-        char tmp[LINE_BUF];
-        strncpy(tmp, line, LINE_BUF - 1);
-        tmp[LINE_BUF - 1] = '\0';
+static void follow_disconnect(void) {
+    mutex_lock(&g_follow.lock);
+    if (g_follow.conn != SOCKET_NONE) sock_close(g_follow.conn);
+    g_follow.conn = SOCKET_NONE;
+    mutex_unlock(&g_follow.lock);
+    g_follow.len = 0;
+}
 
-        char *tok_name  = strtok(tmp,  ",");
-        char *tok_qty   = strtok(NULL, ",");
-        char *tok_price = strtok(NULL, ",");
+/*
+ * follow_sync
+ *   Connects to the primary, receives its snapshot into SNAPSHOT_FILE
+ *   and adopts it as the store; records that arrived behind it are
+ *   left in g_follow.buf. Returns true on success.
+ */
+static bool follow_sync(void) {
+    Socket s = sock_connect(g_follow.spec);
+    if (s == SOCKET_NONE) return false;
+    mutex_lock(&g_follow.lock);
+    bool stop = atomic_load(&g_serve.stop);
+    g_follow.conn = s;
+    mutex_unlock(&g_follow.lock);
+    g_follow.len = 0;
+    bool ok = !stop && sock_send_all(s, REPL_HELLO, sizeof REPL_HELLO - 1);
 
-        if (!tok_name || !tok_qty || !tok_price) {
-            fprintf(stderr, "[WARN] Line %d: malformed record (skipped): %s\n",
-                    lineno, line);
-            continue;
-        }
+    /* "SNAP <bytes>\n" */
+    char *eol = NULL;
+    while (ok && !(eol = g_follow.len ? memchr(g_follow.buf, '\n', g_follow.len) : NULL))
+        ok = g_follow.len < 32 && follow_fill(32 - g_follow.len);
+    char *end = NULL;
+    unsigned long long left = ok && strncmp(g_follow.buf, "SNAP ", 5) == 0
+                            ? strtoull(g_follow.buf + 5, &end, 10) : 0;
+    ok = ok && end == eol;
+    AtomicFile f;
+    if (ok && !afile_open(&f, SNAPSHOT_FILE, SNAPSHOT_TMP)) {
+        fprintf(stderr, "[ERROR] Cannot write '%s': %s\n", SNAPSHOT_TMP, strerror(errno));
+        ok = false;
+    }
+    if (!ok) { follow_disconnect(); return false; }
+    size_t at = (size_t)(eol + 1 - g_follow.buf);
+    for (;;) {
+        size_t n = g_follow.len - at < left ? g_follow.len - at : (size_t)left;
+        afile_write(&f, g_follow.buf + at, n);
+        left -= n;
+        at   += n;
+        if (!left) break;
+        g_follow.len = at = 0;
+        if (!(ok = follow_fill(left))) break;
+    }
+    if (!ok) {
+        afile_abort(&f);
+        follow_disconnect();
+        return false;
+    }
+    memmove(g_follow.buf, g_follow.buf + at, g_follow.len - at);
+    g_follow.len -= at;
 
-        trim(tok_name); trim(tok_qty); trim(tok_price);
+    /* Swap it in. */
+    gate_exclusive();
+#ifdef _WIN32
+    if (!snapshot_detach()) f.err = true;
+#endif
+    ok = afile_commit(&f);
+    FileView fv;
+    if (ok && (ok = file_view_open(SNAPSHOT_FILE, &fv, true))) {
+        const char *why = fv.mapped || fv.len == 0 ? snapshot_check(&fv, true) : "not mappable";
+        if (why) fprintf(stderr, "[ERROR] Snapshot from the primary rejected (%s).\n", why);
+        else if (!(ok = snapshot_install(&fv, &g_follow.base)))
+            fprintf(stderr, "[ERROR] The primary's snapshot %s.\n",
+                    errno == ENOMEM ? "does not fit in memory" : "is inconsistent");
+        ok = ok && !why;
+        if (!ok) file_view_close(&fv);
+    }
+    if (ok) {
+        g_follow.lsn = g_follow.base;
+        printf("[INFO] Following %s: %d item(s) at LSN %llu.\n", g_follow.spec, g_count,
+               (unsigned long long)g_follow.base);
+    }
+    gate_release();
+    if (!ok) follow_disconnect();
+    fflush(stdout);
+    return ok;
+}
 
-        /* Validate name length */
-        if (strlen(tok_name) == 0 || strlen(tok_name) >= MAX_NAME_LEN) {
-            fprintf(stderr, "[WARN] Line %d: invalid name length (skipped).\n", lineno);
-            continue;
+/*
+ * Apply the complete records in g_follow.buf under the exclusive gate.
+ * False if the stream is damaged or the store is full.
+ */
+static bool follow_apply(void) {
+    size_t pos = 0;
+    bool   ok  = true;
+    if (g_follow.len < sizeof(WalRec)) return true;
+    gate_exclusive();
+    while (ok && pos + sizeof(WalRec) <= g_follow.len) {
+        WalRec r;
+        memcpy(&r, g_follow.buf + pos, sizeof r);
+        size_t n = sizeof r + r.name_len;
+        if (r.name_len > SERVE_LINE_MAX) { ok = false; break; }
+        if (n > g_follow.len - pos) break;
+        if (snap_checksum(g_follow.buf + pos + sizeof r.sum, n - sizeof r.sum) != r.sum) {
+            fprintf(stderr, "[WARN] Damaged record from the primary; resynchronising.\n");
+            ok = false;
+            break;
         }
-
-        /* Validate quantity (non-negative integer) */
-        char *ep;
-        long lqty = strtol(tok_qty, &ep, 10);
-        if (*ep != '\0' || lqty < 0 || lqty > 1000000) {
-            fprintf(stderr, "[WARN] Line %d: invalid quantity '%s' (skipped).\n",
-                    lineno, tok_qty);
-            continue;
+        /* Concurrent changes may be logged slightly out of LSN order, so
+         * the feed can still bring changes the snapshot already has. */
+        if (r.lsn > g_follow.base) {
+            if (!wal_apply(&r, g_follow.buf + pos + sizeof r)) {
+                if (!snap_failed())
+                    fprintf(stderr, "[ERROR] Memory limit reached following the primary; "
+                                    "resynchronising.\n");
+                ok = false;
+                break;
+            }
+            if (r.lsn > g_follow.lsn) g_follow.lsn = r.lsn;
         }
+        pos += n;
+    }
+    totals_check("follow");
+    gate_release();
+    memmove(g_follow.buf, g_follow.buf + pos, g_follow.len - pos);
+    g_follow.len -= pos;
+    return ok;
+}
 
-        /* Validate price (non-negative float) */
-        double price = strtod(tok_price, &ep);
-        if (*ep != '\0' || price < 0.0 || price > 1e9) {
-            fprintf(stderr, "[WARN] Line %d: invalid price '%s' (skipped).\n",
-                    lineno, tok_price);
+/* Follower thread: apply the feed, and resynchronise whenever it breaks. */
+static void follow_task(void *ctx, int worker) {
+    (void)ctx; (void)worker;
+    bool live = true; /* main() already synced */
+    while (!atomic_load(&g_serve.stop)) {
+        if (!live) {
+            mutex_lock(&g_follow.lock);
+            if (!atomic_load(&g_serve.stop)) cond_wait_ms(&g_follow.wake, &g_follow.lock, REPL_RETRY_MS);
+            mutex_unlock(&g_follow.lock);
+            live = !atomic_load(&g_serve.stop) && follow_sync();
             continue;
         }
-
-        /* Skip duplicates */
-        if (find_item(tok_name) >= 0) {
-            fprintf(stderr, "[WARN] Line %d: duplicate name '%s' (skipped).\n",
-                    lineno, tok_name);
-            continue;
+        if (!follow_apply() || !follow_fill(SAVE_BUF)) {
+            if (!atomic_load(&g_serve.stop))
+                fprintf(stderr, "[WARN] Lost the primary at LSN %llu; reconnecting.\n",
+                        (unsigned long long)g_follow.lsn);
+            follow_disconnect();
+            live = false;
         }
-
-        /* Commit record */
-        strncpy(g_items[g_count].name, tok_name, MAX_NAME_LEN - 1);
-        g_items[g_count].name[MAX_NAME_LEN - 1] = '\0';
-        g_items[g_count].quantity = (int)lqty;
-        g_items[g_count].price    = price;
-        g_count++;
     }
-
-    fclose(fp);
-    printf("[INFO] Loaded %d item(s) from '%s'.\n", g_count, INVENTORY_FILE);
-    return true;
 }
 
-/*
- * save_inventory
- *   Overwrites INVENTORY_FILE with the current in-memory state.
- *   Returns true on success.
- */
-static bool save_inventory(void) {
-    FILE *fp = fopen(INVENTORY_FILE, "w");
-    if (!fp) {
-        fprintf(stderr, "[ERROR] Cannot write '%s': %s\n",
-                INVENTORY_FILE, strerror(errno));
+/* Take the first snapshot from the primary (before serving) and start following. */
+static bool follow_start(void) {
+    mutex_init(&g_follow.lock);
+    cond_init(&g_follow.wake);
+    if (!follow_sync()) {
+        fprintf(stderr, "[ERROR] Cannot synchronise with the primary at %s.\n", g_follow.spec);
         return false;
     }
+    g_follow.arg     = (TaskArg){ follow_task, NULL, 0 };
+    g_follow.started = thread_start(&g_follow.th, &g_follow.arg);
+    if (!g_follow.started) fprintf(stderr, "[ERROR] Cannot start the follower thread.\n");
+    return g_follow.started;
+}
 
-    fprintf(fp, "# Retail Inventory – format: name,quantity,price\n");
-    for (int i = 0; i < g_count; i++)
-        fprintf(fp, "%s,%d,%.2f\n",
-                g_items[i].name,
-                g_items[i].quantity,
-                g_items[i].price);
-
-    fclose(fp);
-    printf("[INFO] %d item(s) saved to '%s'.\n", g_count, INVENTORY_FILE);
-    return true;
+/* Call after g_serve.stop is set. */
+static void follow_stop(void) {
+    if (!g_follow.started) return;
+    mutex_lock(&g_follow.lock);
+    if (g_follow.conn != SOCKET_NONE) sock_shutdown(g_follow.conn);
+    cond_broadcast(&g_follow.wake);
+    mutex_unlock(&g_follow.lock);
+    thread_join(g_follow.th);
+    follow_disconnect();
+    free(g_follow.buf);
 }
 
-/* ══════════════════════════════════════════════════════════════
- *  Core inventory operations
- * ══════════════════════════════════════════════════════════════ */
+#ifdef _WIN32
+static BOOL WINAPI serve_ctrl(DWORD type) {
+    (void)type;
+    SetEvent(g_serve.stop_event);
+    return TRUE;
+}
+#endif
 
 /*
- * add_item
- *   If the item already exists its stock is incremented and its price updated.
- *   Otherwise a new record is created.
+ * serve_run
+ *   Runs the server on `spec` until SIGINT/SIGTERM (Ctrl+C on Windows),
+ *   then closes every connection and returns once the workers are done.
+ *   Returns the process exit status.
  */
-static bool add_item(const char *name, int qty, double price) {
-    if (!name || strlen(name) == 0 || strlen(name) >= MAX_NAME_LEN) {
-        fprintf(stderr, "[ERROR] Invalid item name.\n"); return false;
+static int serve_run(const char *spec) {
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        fprintf(stderr, "[ERROR] Cannot initialise Winsock.\n");
+        return EXIT_FAILURE;
     }
-    if (qty <= 0)   { fprintf(stderr, "[ERROR] Quantity must be > 0.\n");         return false; }
-    if (price < 0)  { fprintf(stderr, "[ERROR] Price cannot be negative.\n");      return false; }
-
-    int idx = find_item(name);
-    if (idx >= 0) {
-        /* Restock existing item */
-        g_items[idx].quantity += qty;
-        g_items[idx].price     = price;
-        printf("[OK] Restocked '%s' → qty=%d, price=%.2f\n",
-               g_items[idx].name, g_items[idx].quantity, g_items[idx].price);
-        return true;
+    g_serve.stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    SetConsoleCtrlHandler(serve_ctrl, TRUE);
+#else
+    /* Workers inherit the blocked mask; only sigwait() below sees these. */
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    g_serve.listener = sock_listen(spec);
+    if (g_serve.listener == SOCKET_NONE) return EXIT_FAILURE;
+    if ((g_serve.wake = sock_wake_open()) == SOCKET_NONE) {
+        fprintf(stderr, "[ERROR] Cannot create the server's wake-up socket.\n");
+        sock_close(g_serve.listener);
+        return EXIT_FAILURE;
+    }
+    if (!serve_gates_open(g_serve_threads)) {
+        fprintf(stderr, "[ERROR] Out of memory.\n");
+        sock_close(g_serve.listener);
+        sock_close(g_serve.wake);
+        return EXIT_FAILURE;
     }
+    mutex_init(&g_serve.lock);
+    cond_init(&g_serve.more);
+    bool repl_ok = g_follow.spec ? follow_start() : !g_replicate || repl_start();
+    int  started = 0;
+    for (int w = 0; w < g_serve.nworkers && repl_ok; w++) {
+        g_serve.w[w].arg     = (TaskArg){ serve_worker, NULL, w };
+        g_serve.w[w].started = thread_start(&g_serve.w[w].th, &g_serve.w[w].arg);
+        started += g_serve.w[w].started;
+    }
+    g_serve.poll_arg = (TaskArg){ serve_poll, NULL, 0 };
+    bool polling = started > 0 && thread_start(&g_serve.poll_th, &g_serve.poll_arg);
+    if (!polling) started = 0;
+    if (!repl_ok) ;
+    else if (started == 0) fprintf(stderr, "[ERROR] Cannot start server threads.\n");
+    else printf("[INFO] Serving on %s with %d worker(s); Ctrl+C stops.\n", spec, started);
+    fflush(stdout);
 
-    if (g_count >= MAX_ITEMS) {
-        fprintf(stderr, "[ERROR] Inventory full (max %d items).\n", MAX_ITEMS);
-        return false;
+    if (started > 0) {
+#ifdef _WIN32
+        WaitForSingleObject(g_serve.stop_event, INFINITE);
+#else
+        int sig;
+        sigwait(&set, &sig);
+#endif
     }
+    atomic_store(&g_serve.stop, true);
+    send(g_serve.wake, "", 1, 0);
+    mutex_lock(&g_serve.lock);
+    cond_broadcast(&g_serve.more);
+    for (int w = 0; w < g_serve.nworkers; w++)
+        if (g_serve.w[w].conn != SOCKET_NONE) sock_shutdown(g_serve.w[w].conn);
+    mutex_unlock(&g_serve.lock);
+    if (polling) thread_join(g_serve.poll_th);
+    for (int w = 0; w < g_serve.nworkers; w++)
+        if (g_serve.w[w].started) thread_join(g_serve.w[w].th);
+    for (ServeConn *l = g_serve.ready; l; ) { ServeConn *c = l; l = c->next; serve_conn_free(c); }
+    for (ServeConn *l = g_serve.back; l; ) { ServeConn *c = l; l = c->next; serve_conn_free(c); }
+    g_serve.ready = g_serve.ready_tail = g_serve.back = NULL;
+    sock_close(g_serve.listener);
+    sock_close(g_serve.wake);
+    follow_stop();
+    repl_stop();
+    serve_gates_close();
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    printf("[INFO] Server stopped.\n");
+    return started > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-    strncpy(g_items[g_count].name, name, MAX_NAME_LEN - 1);
-    g_items[g_count].name[MAX_NAME_LEN - 1] = '\0';
-    g_items[g_count].quantity = qty;
-    g_items[g_count].price    = price;
-    g_count++;
+/* ══════════════════════════════════════════════════════════════
+ *  Benchmark mode
+ *  --bench[=ROWS] generates a catalog of ROWS synthetic items in a
+ *  scratch directory and times the core operations against it: whole-
+ *  store load, save and rescan (BENCH_REPS runs each), then BENCH_OPS
+ *  single lookups (hits and misses), adds, removes and total reads.
+ *  Each result is one JSON object per line on stdout, so runs before
+ *  and after a change can be compared by script.
+ * ══════════════════════════════════════════════════════════════ */
 
-    printf("[OK] Added '%s': qty=%d, price=%.2f\n", name, qty, price);
-    return true;
+/* splitmix64: every synthetic field is a function of the item number. */
+static uint64_t bench_mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15u;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9u;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBu;
+    return x ^ (x >> 31);
 }
 
 /*
- * remove_item
- *   Deletes an item entirely from the store. Fills the gap by shifting
- *   subsequent elements left (order-preserving).
+ * bench_name
+ *   Writes the name of synthetic item i to buf (64 bytes) and returns
+ *   its length. Names read like catalog entries – brand, product,
+ *   optional variant, pack size – 15 to 50 bytes long, and end in a
+ *   code unique to i.
  */
-static bool remove_item(const char *name) {
-    int idx = find_item(name);
-    if (idx < 0) {
-        fprintf(stderr, "[ERROR] '%s' not found in inventory.\n", name);
+static size_t bench_name(uint64_t i, char *buf) {
+    static const char *const brand[16] = {
+        "Acme", "Bluebird", "Cornerstone", "Delta", "Evergreen", "Fairway",
+        "Golden Valley", "Harbor", "Ivy", "Juniper", "Keystone", "Lakeside",
+        "Meadow", "Northwind", "Oak & Ash", "Pioneer"
+    };
+    static const char *const product[16] = {
+        "Apple Juice", "Basmati Rice", "Coffee Beans", "Dish Soap", "Eggs",
+        "Flour", "Green Tea", "Honey", "Instant Noodles", "Jam", "Ketchup",
+        "Laundry Detergent", "Milk", "Olive Oil", "Peanut Butter", "Tissues"
+    };
+    static const char *const variant[8] = {
+        "", "", "", " Organic", " Low Fat", " Family Pack", " Unscented", " Extra"
+    };
+    static const char *const size[8] = {
+        "100g", "250g", "500g", "1kg", "2kg", "330ml", "1L", "12ct"
+    };
+    uint64_t r = bench_mix(i);
+    int n = snprintf(buf, 64, "%s %s%s %s %llX", brand[r & 15], product[(r >> 4) & 15],
+                     variant[(r >> 8) & 7], size[(r >> 11) & 7], (unsigned long long)i);
+    return (size_t)n;
+}
+
+static int     bench_qty(uint64_t i)   { return 1 + (int)((bench_mix(i) >> 20) % 500); }
+static Money   bench_price(uint64_t i) {
+    return (50 + (Money)((bench_mix(i) >> 40) % 20000)) * MONEY_SCALE / 100;
+}
+
+/* Writes the synthetic catalog to inventory.txt (untimed). */
+static bool bench_write(size_t rows) {
+    FILE *f = fopen(INVENTORY_FILE, "wb");
+    if (!f) {
+        fprintf(stderr, "[ERROR] Cannot write '%s': %s\n", INVENTORY_FILE, strerror(errno));
+        return false;
+    }
+    setvbuf(f, NULL, _IOFBF, SAVE_BUF);
+    fprintf(f, "# name,quantity,price\n");
+    char name[64], pb[MONEY_BUF];
+    for (size_t i = 0; i < rows; i++) {
+        bench_name(i, name);
+        fprintf(f, "%s,%d,%s\n", name, bench_qty(i), money_str(pb, bench_price(i)));
+    }
+    if (fclose(f) != 0) {
+        fprintf(stderr, "[ERROR] Cannot write '%s': %s\n", INVENTORY_FILE, strerror(errno));
         return false;
     }
-    for (int i = idx; i < g_count - 1; i++)
-        g_items[i] = g_items[i + 1];
-    g_count--;
-    printf("[OK] Removed '%s'.\n", name);
     return true;
 }
 
+static uint64_t bench_sum(const uint64_t *ns, size_t n) {
+    uint64_t s = 0;
+    for (size_t k = 0; k < n; k++) s += ns[k];
+    return s;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
 /*
- * update_quantity
- *   Sets an item's stock to an absolute value (>= 0).
- *   Passing 0 effectively marks the item as out-of-stock.
+ * bench_report
+ *   Prints one result: n calls that took wall_ns in all and ns[k] each
+ *   (sorted here for the nearest-rank percentiles). Whole-store runs
+ *   also report rows per second.
  */
-static bool update_quantity(const char *name, int new_qty) {
-    if (new_qty < 0) { fprintf(stderr, "[ERROR] Quantity cannot be negative.\n"); return false; }
-    int idx = find_item(name);
-    if (idx < 0) {
-        fprintf(stderr, "[ERROR] '%s' not found in inventory.\n", name);
-        return false;
+static void bench_report(const char *what, size_t rows, uint64_t wall_ns,
+                         uint64_t *ns, size_t n, bool whole) {
+    qsort(ns, n, sizeof *ns, cmp_u64);
+    double sec = (double)wall_ns / 1e9;
+    printf("{\"bench\":\"%s\",\"rows\":%zu,\"ops\":%zu,\"seconds\":%.6f,\"ops_per_sec\":%.0f",
+           what, rows, n, sec, sec > 0 ? (double)n / sec : 0.0);
+    if (whole)
+        printf(",\"rows_per_sec\":%.0f", sec > 0 ? (double)rows * (double)n / sec : 0.0);
+    printf(",\"p50_ns\":%llu,\"p99_ns\":%llu}\n",
+           (unsigned long long)ns[(n * 50 + 99) / 100 - 1],
+           (unsigned long long)ns[(n * 99 + 99) / 100 - 1]);
+    fflush(stdout);
+}
+
+/* The name of synthetic item i, precomputed so only the operation is timed. */
+typedef struct {
+    char   name[64];
+    size_t len;
+    uint32_t hash;
+} BenchKey;
+
+static void bench_keys(BenchKey *k, size_t n, uint64_t (*id)(size_t, size_t), size_t rows) {
+    for (size_t j = 0; j < n; j++) {
+        k[j].len  = bench_name(id(j, rows), k[j].name);
+        k[j].hash = name_hash(k[j].name, k[j].len);
     }
-    g_items[idx].quantity = new_qty;
-    printf("[OK] '%s' quantity → %d\n", name, new_qty);
-    return true;
 }
 
-/*
- * calculate_total
- *   Returns the sum of (quantity × price) for every item in stock.
- */
-static double calculate_total(void) {
-    double total = 0.0;
-    for (int i = 0; i < g_count; i++)
-        total += (double)g_items[i].quantity * g_items[i].price;
-    return total;
+static uint64_t bench_id_hit(size_t j, size_t rows)  { return bench_mix(~(uint64_t)j) % rows; }
+static uint64_t bench_id_miss(size_t j, size_t rows) { return rows + BENCH_OPS + j; }
+static uint64_t bench_id_new(size_t j, size_t rows)  { return rows + j; }
+
+static bool bench_suite(size_t rows) {
+    uint64_t  *ns  = malloc(BENCH_OPS * sizeof *ns);
+    BenchKey  *key = malloc(BENCH_OPS * sizeof *key);
+    bool ok = ns && key;
+    uint64_t t0, wall;
+    volatile Money sink = 0;
+
+    for (int r = 0; ok && r < BENCH_REPS; r++) {
+        store_clear(true);
+        t0 = now_ns();
+        ok = load_inventory() && (size_t)g_count == rows;
+        ns[r] = now_ns() - t0;
+    }
+    if (ok) bench_report("load", rows, bench_sum(ns, BENCH_REPS), ns, BENCH_REPS, true);
+
+    for (int r = 0; ok && r < BENCH_REPS; r++) {
+        t0 = now_ns();
+        ok = save_inventory();
+        ns[r] = now_ns() - t0;
+    }
+    if (ok) bench_report("save", rows, bench_sum(ns, BENCH_REPS), ns, BENCH_REPS, true);
+
+    for (int r = 0; ok && r < BENCH_REPS; r++) {
+        t0 = now_ns();
+        sink += recompute_total();
+        ns[r] = now_ns() - t0;
+    }
+    if (ok) bench_report("total_rescan", rows, bench_sum(ns, BENCH_REPS), ns, BENCH_REPS, true);
+
+    /* find_hit / find_miss: hash and index probe, as every lookup does. */
+    if (ok) bench_keys(key, BENCH_OPS, bench_id_hit, rows);
+    wall = now_ns();
+    for (size_t j = 0; ok && j < BENCH_OPS; j++) {
+        t0 = now_ns();
+        ok = index_probe(key[j].name, key[j].len, name_hash(key[j].name, key[j].len))->idx >= 0;
+        ns[j] = now_ns() - t0;
+    }
+    if (ok) bench_report("find_hit", rows, now_ns() - wall, ns, BENCH_OPS, false);
+
+    if (ok) bench_keys(key, BENCH_OPS, bench_id_miss, rows);
+    wall = now_ns();
+    for (size_t j = 0; ok && j < BENCH_OPS; j++) {
+        t0 = now_ns();
+        ok = index_probe(key[j].name, key[j].len, name_hash(key[j].name, key[j].len))->idx < 0;
+        ns[j] = now_ns() - t0;
+    }
+    if (ok) bench_report("find_miss", rows, now_ns() - wall, ns, BENCH_OPS, false);
+
+    /* add / remove: new names, then the same ones again, so the store ends as loaded. */
+    if (ok) bench_keys(key, BENCH_OPS, bench_id_new, rows);
+    wall = now_ns();
+    for (size_t j = 0; ok && j < BENCH_OPS; j++) {
+        uint64_t i = rows + j;
+        int pos;
+        bool created = false;
+        t0 = now_ns();
+        ok = inv_add(key[j].name, key[j].len, key[j].hash, bench_qty(i),
+                     bench_price(i), &pos, &created) == OP_OK && created;
+        ns[j] = now_ns() - t0;
+    }
+    if (ok) bench_report("add", rows, now_ns() - wall, ns, BENCH_OPS, false);
+
+    wall = now_ns();
+    for (size_t j = 0; ok && j < BENCH_OPS; j++) {
+        t0 = now_ns();
+        ok = inv_remove(key[j].name, key[j].len, key[j].hash) == OP_OK;
+        ns[j] = now_ns() - t0;
+    }
+    if (ok) bench_report("remove", rows, now_ns() - wall, ns, BENCH_OPS, false);
+
+    wall = now_ns();
+    for (size_t j = 0; ok && j < BENCH_OPS; j++) {
+        t0 = now_ns();
+        sink += calculate_total();
+        ns[j] = now_ns() - t0;
+    }
+    if (ok) bench_report("total", rows, now_ns() - wall, ns, BENCH_OPS, false);
+
+    if (!ok) fprintf(stderr, "[ERROR] Benchmark aborted.\n");
+    (void)sink;
+    free(ns);
+    free(key);
+    return ok;
 }
 
+/* The scratch directory's helpers. */
+#ifdef _WIN32
+static int dir_make(const char *p)   { return _mkdir(p); }
+static int dir_enter(const char *p)  { return _chdir(p); }
+static int dir_remove(const char *p) { return _rmdir(p); }
+#else
+static int dir_make(const char *p)   { return mkdir(p, 0777); }
+static int dir_enter(const char *p)  { return chdir(p); }
+static int dir_remove(const char *p) { return rmdir(p); }
+#endif
+
 /*
- * list_inventory
- *   Prints a formatted table with a running total row.
+ * bench_run
+ *   Runs the benchmark in BENCH_DIR, created under the current
+ *   directory and removed afterwards, with the log off so that only
+ *   the operations themselves are measured.
  */
-static void list_inventory(void) {
-    if (g_count == 0) { printf("  (inventory is empty)\n"); return; }
-
-    const char *sep =
-        "  ─────────────────────────────────────────────────────────────────\n";
-    printf("\n  %-30s %8s %10s %14s\n", "Name", "Qty", "Price ($)", "Value ($)");
-    printf("%s", sep);
-    for (int i = 0; i < g_count; i++) {
-        double val = (double)g_items[i].quantity * g_items[i].price;
-        printf("  %-30s %8d %10.2f %14.2f\n",
-               g_items[i].name, g_items[i].quantity, g_items[i].price, val);
+static int bench_run(size_t rows) {
+    if ((dir_make(BENCH_DIR) != 0 && errno != EEXIST) || dir_enter(BENCH_DIR) != 0) {
+        fprintf(stderr, "[ERROR] Cannot use directory '%s': %s\n", BENCH_DIR, strerror(errno));
+        return EXIT_FAILURE;
     }
-    printf("%s", sep);
-    printf("  %-30s %8s %10s %14.2f\n\n", "TOTAL", "", "", calculate_total());
+
+    g_durability = DUR_OFF;
+    bool ok = wal_start(false, 0) && bench_write(rows) && bench_suite(rows);
+    wal_close();
+    store_clear(true);
+    remove(INVENTORY_FILE);
+    remove(INVENTORY_TMP);
+    remove(SNAPSHOT_FILE);
+    remove(SNAPSHOT_TMP);
+    if (dir_enter("..") == 0) dir_remove(BENCH_DIR);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 /* ══════════════════════════════════════════════════════════════
@@ -308,83 +7981,811 @@ static bool read_line(const char *prompt, char *buf, size_t n) {
     return true;
 }
 
-/* Parse a non-negative integer. Returns false on bad input. */
-static bool parse_int(const char *s, int *out) {
+/* The menu's quantities, and main.c's numeric options (see inventory.h). */
+bool inventory_parse_int(const char *s, int *out) {
     char *ep;
     long v = strtol(s, &ep, 10);
     if (*ep != '\0' || v < 0 || v > 1000000) return false;
     *out = (int)v; return true;
 }
 
-/* Parse a non-negative double. Returns false on bad input. */
-static bool parse_double(const char *s, double *out) {
-    char *ep;
-    double v = strtod(s, &ep);
-    if (*ep != '\0' || v < 0.0 || v > 1e9) return false;
+/* Parse a price of 0..MONEY_MAX. Returns false on bad input. */
+static bool parse_money(const char *s, Money *out) {
+    Money v;
+    if (!money_scan(s, s + strlen(s), &v) || v < 0 || v > MONEY_MAX) return false;
     *out = v; return true;
 }
 
 /* ─── Individual menu actions ─────────────────────────────────── */
 
+/* Before a listing or report: false, having said so, on a damaged store. */
+static bool menu_ready(void) {
+    return snap_touch_all() || op_report(OP_DAMAGED, NULL, false);
+}
+
+/* Listing pauses between pages only for a person at a terminal. */
+static bool is_terminal(void) {
+#ifdef _WIN32
+    return _isatty(_fileno(stdin)) && _isatty(_fileno(stdout));
+#else
+    return isatty(fileno(stdin)) && isatty(fileno(stdout));
+#endif
+}
+
+static void menu_abc(void) {
+    AbcReport  r;
+    StoreImage live;
+    store_image_live(&live, 0);
+    if (!abc_analyze(&live, &r)) { printf("[ERROR] Out of memory.\n"); return; }
+    static const char *const what[3] = { "top 80%", "next 15%", "last 5%" };
+    char mb[MONEY_BUF];
+    printf("\n  %-5s %-10s %10s %8s %16s %8s\n", "Class", "of value", "Items", "Share",
+           "Value ($)", "Share");
+    for (int c = 0; c < 3; c++)
+        printf("  %-5c %-10s %10zu %7.1f%% %16s %7.1f%%\n", "ABC"[c], what[c], r.items[c],
+               g_count ? 100.0 * (double)r.items[c] / g_count : 0.0, money_str(mb, r.cents[c]),
+               r.total ? 100.0 * (double)r.cents[c] / (double)r.total : 0.0);
+    ListQuery q;
+    list_query_init(&q, SORT_VALUE);
+    q.desc  = true;
+    q.limit = ABC_TOP;
+    printf("\n  Top %d items by value:", ABC_TOP);
+    list_inventory(&q, 0, NULL);
+}
+
+static bool page_more(size_t shown, size_t of) {
+    char prompt[96], buf[8];
+    snprintf(prompt, sizeof prompt, "  -- %zu of %zu shown; Enter for more, q to stop -- ",
+             shown, of);
+    return read_line(prompt, buf, sizeof buf) && buf[0] != 'q' && buf[0] != 'Q';
+}
+
+static void menu_list(void) {
+    ListQuery q;
+    if (!menu_ready()) return;
+    list_query_init(&q, (ListSort)g_order);
+    list_inventory(&q, is_terminal() ? LIST_PAGE : 0, page_more);
+}
+
 static void menu_add(void) {
-    char   name[MAX_NAME_LEN], buf[64];
-    int    qty;  double price;
+    char   name[LINE_BUF], buf[64];
+    int    qty;  Money price;
 
     if (!read_line("  Item name  : ", name, sizeof name) || !name[0])
         { printf("[WARN] Cancelled.\n"); return; }
-    if (!read_line("  Quantity   : ", buf, sizeof buf) || !parse_int(buf, &qty) || qty <= 0)
+    if (!read_line("  Quantity   : ", buf, sizeof buf) || !inventory_parse_int(buf, &qty) ||
+        qty <= 0)
         { printf("[WARN] Invalid quantity – cancelled.\n"); return; }
-    if (!read_line("  Price ($)  : ", buf, sizeof buf) || !parse_double(buf, &price))
+    if (!read_line("  Price ($)  : ", buf, sizeof buf) || !parse_money(buf, &price))
         { printf("[WARN] Invalid price – cancelled.\n"); return; }
 
     add_item(name, qty, price);
 }
 
 static void menu_remove(void) {
-    char name[MAX_NAME_LEN];
+    char name[LINE_BUF];
     if (!read_line("  Item name to remove: ", name, sizeof name) || !name[0])
         { printf("[WARN] Cancelled.\n"); return; }
     remove_item(name);
 }
 
 static void menu_update_qty(void) {
-    char name[MAX_NAME_LEN], buf[64]; int qty;
+    char name[LINE_BUF], buf[64]; int qty;
     if (!read_line("  Item name    : ", name, sizeof name) || !name[0])
         { printf("[WARN] Cancelled.\n"); return; }
-    if (!read_line("  New quantity : ", buf, sizeof buf) || !parse_int(buf, &qty))
+    if (!read_line("  New quantity : ", buf, sizeof buf) || !inventory_parse_int(buf, &qty))
         { printf("[WARN] Invalid quantity – cancelled.\n"); return; }
     update_quantity(name, qty);
 }
 
 static void menu_search(void) {
-    char name[MAX_NAME_LEN];
+    char name[LINE_BUF];
     if (!read_line("  Search name: ", name, sizeof name) || !name[0])
         { printf("[WARN] Cancelled.\n"); return; }
-    int idx = find_item(name);
-    if (idx < 0) {
-        printf("  Not found: '%s'\n", name);
+    if (!menu_ready()) return;
+    int  hits[SEARCH_TOP];
+    bool more;
+    int  n = search_find(name, strlen(name), hits, SEARCH_TOP, &more);
+    if (n == 0) { printf("  Not found: '%s'\n", name); return; }
+    char pb[MONEY_BUF], vb[MONEY_BUF];
+    for (int i = 0; i < n; i++) {
+        int idx = hits[i];
+        printf("  %-30s qty=%-6d price=$%s  stock value=$%s\n",
+               name_str(ITEM_NAME(idx)), ITEM_QTY(idx), money_str(pb, ITEM_PRICE(idx)),
+               money_str(vb, (Money)ITEM_QTY(idx) * ITEM_PRICE(idx)));
+    }
+    if (more) printf("  (showing the first %d matches; refine the search)\n", SEARCH_TOP);
+}
+
+/* Low-stock, price-range or ABC report. */
+static void menu_report(void) {
+    char      buf[64];
+    int       qty;
+    Money     lo, hi;
+    ListQuery q;
+    if (!read_line("  (1) Low stock  (2) Price range  (3) ABC analysis  (4) Statistics: ",
+                   buf, sizeof buf) ||
+        !buf[0] || buf[1] || buf[0] < '1' || buf[0] > '4')
+        { printf("[WARN] Cancelled.\n"); return; }
+    if (buf[0] != '4' && !menu_ready()) return;
+    if (buf[0] == '3') { menu_abc(); return; }
+    if (buf[0] == '4') {
+#if INVENTORY_STATS
+        stats_print();
+#else
+        printf("  Built without statistics.\n");
+#endif
+        return;
+    }
+    if (buf[0] == '1') {
+        if (!read_line("  Quantity at most : ", buf, sizeof buf) ||
+            !inventory_parse_int(buf, &qty))
+            { printf("[WARN] Invalid quantity – cancelled.\n"); return; }
+        list_query_init(&q, SORT_QTY);
+        q.qty_hi = qty;
     } else {
-        printf("  %-30s qty=%-6d price=$%.2f  stock value=$%.2f\n",
-               g_items[idx].name, g_items[idx].quantity,
-               g_items[idx].price,
-               (double)g_items[idx].quantity * g_items[idx].price);
+        if (!read_line("  Lowest price ($) : ", buf, sizeof buf) || !parse_money(buf, &lo) ||
+            !read_line("  Highest price ($): ", buf, sizeof buf) || !parse_money(buf, &hi))
+            { printf("[WARN] Invalid price – cancelled.\n"); return; }
+        list_query_init(&q, SORT_PRICE);
+        q.cents_lo = lo;
+        q.cents_hi = hi;
+    }
+    list_inventory(&q, is_terminal() ? LIST_PAGE : 0, page_more);
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Library API
+ *    The inventory.h functions: the engine behind the menu, for other
+ *    programs linking inventory_engine. They call the same operations
+ *    the menu and --batch do, on the calling thread.
+ * ══════════════════════════════════════════════════════════════ */
+
+_Static_assert(INVENTORY_SHORT == (int)OP_SHORT && INVENTORY_FULL == (int)OP_FULL &&
+               INVENTORY_NOT_FOUND == (int)OP_NOT_FOUND && INVENTORY_DAMAGED == (int)OP_DAMAGED,
+               "InventoryStatus must mirror OpStatus");
+
+/* Load the store from the working directory: snapshot or CSV, then the log. */
+static bool store_open(void) {
+    uint64_t snap_lsn = 0;
+    bool from_snapshot = !g_follow.spec && snapshot_load(&snap_lsn); /* a follower syncs instead */
+    if (!from_snapshot && !g_follow.spec && !load_inventory()) return false;
+    if (!wal_start(from_snapshot, snap_lsn)) return false;
+    if (!snap_failed()) return true;
+    wal_close(); /* damaged under the replay: the next start imports the CSV */
+    return false;
+}
+
+/* Take over the settings in opt (NULL = keep the defaults). */
+static void options_apply(const InventoryOptions *opt) {
+    if (!opt) return;
+    g_mem_limit     = opt->mem_limit;
+    g_load_threads  = opt->load_threads > MAX_LOAD_THREADS ? MAX_LOAD_THREADS
+                                                           : opt->load_threads;
+    g_check_totals  = opt->check_totals;
+    g_snapshot_only = opt->snapshot_only;
+    g_lazy_load     = opt->lazy_load;
+    g_snap_compress = opt->compress_snapshot;
+    if (opt->durability != INVENTORY_DURABILITY_DEFAULT)
+        g_durability = (Durability)(opt->durability - INVENTORY_DURABILITY_OFF);
+    g_order         = (ViewOrder)opt->order;
+    g_chain_threads = opt->chain_threads > MAX_LOAD_THREADS ? MAX_LOAD_THREADS
+                                                            : opt->chain_threads;
+    g_stats_file    = opt->stats_file;
+    if (opt->stats_interval > 0) g_stats_interval = opt->stats_interval;
+    if (opt->serve_threads > 0)
+        g_serve_threads = opt->serve_threads > SERVE_MAX_THREADS ? SERVE_MAX_THREADS
+                                                                 : opt->serve_threads;
+    g_replicate   = opt->replicate;
+    g_follow.spec = opt->follow;
+    if (g_follow.spec) {
+        g_durability = DUR_OFF; /* the primary keeps the log */
+        g_read_only  = true;
+    }
+}
+
+bool inventory_open(const InventoryOptions *opt) {
+    options_apply(opt);
+    version_init();
+    if (opt && opt->chain && !chain_load(opt->chain)) return false;
+    stats_start();
+    return store_open();
+}
+
+void inventory_close(void) {
+    stats_stop();
+    wal_close();
+}
+
+int inventory_batch(const char *file) {
+    return batch_run(file ? file : "-");
+}
+
+int inventory_serve(const char *spec) {
+    return serve_run(spec);
+}
+
+InventoryStatus inventory_add(const char *name, int qty, InventoryMoney price) {
+    size_t len = name ? strlen(name) : 0;
+    int  idx;
+    bool created;
+    OpStatus st = inv_add(name, len, len ? name_hash(name, len) : 0, qty, price, &idx, &created);
+    return (InventoryStatus)st;
+}
+
+InventoryStatus inventory_set_qty(const char *name, int qty) {
+    size_t len = name ? strlen(name) : 0;
+    int idx;
+    if (len == 0) return INVENTORY_BAD_NAME;
+    return (InventoryStatus)inv_setqty(name, len, name_hash(name, len), qty, &idx);
+}
+
+InventoryStatus inventory_remove(const char *name) {
+    size_t len = name ? strlen(name) : 0;
+    if (len == 0) return INVENTORY_BAD_NAME;
+    return (InventoryStatus)inv_remove(name, len, name_hash(name, len));
+}
+
+InventoryStatus inventory_reserve(const char *name, int qty, int *left) {
+    size_t  len = name ? strlen(name) : 0;
+    int     idx;
+    int32_t now = 0;
+    if (len == 0) return INVENTORY_BAD_NAME;
+    OpStatus st = inv_reserve(name, len, name_hash(name, len), qty, &idx, &now);
+    if (left) *left = now;
+    return (InventoryStatus)st;
+}
+
+InventoryStatus inventory_release(const char *name, int qty, int *left) {
+    size_t  len = name ? strlen(name) : 0;
+    int     idx;
+    int32_t now = 0;
+    if (len == 0) return INVENTORY_BAD_NAME;
+    OpStatus st = inv_release(name, len, name_hash(name, len), qty, &idx, &now);
+    if (left) *left = now;
+    return (InventoryStatus)st;
+}
+
+InventoryStatus inventory_get(const char *name, int *qty, InventoryMoney *price) {
+    size_t len = name ? strlen(name) : 0;
+    if (len == 0) return INVENTORY_BAD_NAME;
+    int      idx;
+    OpStatus st = inv_find(name, len, name_hash(name, len), &idx);
+    if (st != OP_OK) return (InventoryStatus)st;
+    if (qty)   *qty   = ITEM_QTY(idx);
+    if (price) *price = ITEM_PRICE(idx);
+    return INVENTORY_OK;
+}
+
+int inventory_count(void) {
+    return g_count;
+}
+
+InventoryMoney inventory_total(int64_t *units) {
+    if (units) *units = g_total_units;
+    return calculate_total();
+}
+
+bool inventory_save(void) {
+    return save_inventory();
+}
+
+size_t inventory_exec(const char *cmd, char *reply, size_t cap) {
+    BatchCmd c;
+    OutBuf   o = { NULL, 0, 0, false };
+    const char *end = cmd + strlen(cmd);
+    while (end > cmd && (end[-1] == '\n' || end[-1] == '\r')) end--;
+    c.line = 1;
+    if (batch_parse(cmd, end, &c)) {
+        bool own = c.verb == CMD_SAVE || c.verb == CMD_IMPORT; /* as in batch_run() */
+        if (!own) wal_batch();
+        batch_apply(&c, &o);
+        if (!own) wal_commit();
+    }
+    if (o.lost) o.len = 0;
+    if (o.len && o.buf[o.len - 1] == '\n') o.len--;
+    if (cap) {
+        size_t n = o.len < cap - 1 ? o.len : cap - 1;
+        if (n) memcpy(reply, o.buf, n);
+        reply[n] = '\0';
+    }
+    free(o.buf);
+    return o.len;
+}
+
+int inventory_money_digits(void) {
+    return MONEY_DIGITS;
+}
+
+/* ══════════════════════════════════════════════════════════════
+ *  Fuzz mode
+ *  --fuzz[=OPS] checks the engine against a reference model, a plain
+ *  array indexed by key with the original add/restock, update, remove
+ *  and reserve rules. In a scratch directory it applies OPS random
+ *  operations on FUZZ_KEYS names, FUZZ_BATCH at a time, checking each
+ *  status as it goes and, after each batch, every key's stock and
+ *  price, the item count and the running totals. Every few batches it
+ *  saves (alternating the snapshot formats) or reopens the store, from
+ *  the snapshot or from the CSV on every CPU, replaying the change log,
+ *  and checks again. Then reserves and releases run on FUZZ_THREADS
+ *  threads at once, as server workers do, and the store is checked
+ *  against the sum of the changes that succeeded, before and after a
+ *  replay. A last phase sends every kind of change, reports and saves
+ *  through serve_apply() on as many workers, under the server's locks,
+ *  and checks every reply and then the store the same way. The workload is a function of --fuzz-seed, so a
+ *  reported mismatch reproduces with the same seed. Throughput is
+ *  printed as JSON lines, as --bench does.
+ * ══════════════════════════════════════════════════════════════ */
+
+typedef enum { FUZZ_ADD, FUZZ_SETQTY, FUZZ_REMOVE, FUZZ_RESERVE, FUZZ_RELEASE, FUZZ_GET } FuzzVerb;
+
+static const char *const fuzz_verb[] = { "add", "setqty", "remove", "reserve", "release", "get" };
+
+/* The model's state of one key. */
+typedef struct {
+    int32_t qty;
+    Money   price;
+    bool    live;
+} FuzzRef;
+
+typedef struct {
+    BenchKey *key;   /* FUZZ_KEYS names           */
+    FuzzRef  *ref;   /* the model, one per key    */
+    int       count; /* live keys                 */
+    int64_t   units;
+    Money     cents;
+    uint64_t  seed;
+    size_t    batch; /* current batch, for reports */
+} Fuzz;
+
+static uint64_t fuzz_next(uint64_t *state) { return bench_mix((*state)++); }
+
+static void fuzz_set(Fuzz *z, FuzzRef *r, int32_t qty, Money price) {
+    z->units += (int64_t)qty - r->qty;
+    z->cents += qty * price - r->qty * r->price;
+    r->qty   = qty;
+    r->price = price;
+}
+
+/* One operation on the model; returns what the engine must return. */
+static OpStatus fuzz_model(Fuzz *z, FuzzVerb verb, size_t k, int qty, Money price) {
+    FuzzRef *r = &z->ref[k];
+    switch (verb) {
+        case FUZZ_ADD:
+            if (qty <= 0) return OP_BAD_QTY;
+            if (!r->live) {
+                r->live = true;
+                z->count++;
+                fuzz_set(z, r, qty, price);
+            } else {
+                if (r->qty > INT32_MAX - qty) return OP_OVERFLOW;
+                fuzz_set(z, r, r->qty + qty, price);
+            }
+            return OP_OK;
+        case FUZZ_SETQTY:
+            if (qty < 0)   return OP_BAD_QTY;
+            if (!r->live)  return OP_NOT_FOUND;
+            fuzz_set(z, r, qty, r->price);
+            return OP_OK;
+        case FUZZ_REMOVE:
+            if (!r->live) return OP_NOT_FOUND;
+            fuzz_set(z, r, 0, 0);
+            r->live = false;
+            z->count--;
+            return OP_OK;
+        case FUZZ_RESERVE:
+        case FUZZ_RELEASE:
+            if (qty <= 0)  return OP_BAD_QTY;
+            if (!r->live)  return OP_NOT_FOUND;
+            if (verb == FUZZ_RESERVE && r->qty < qty) return OP_SHORT;
+            if (verb == FUZZ_RELEASE && r->qty > INT32_MAX - qty) return OP_OVERFLOW;
+            fuzz_set(z, r, verb == FUZZ_RESERVE ? r->qty - qty : r->qty + qty, r->price);
+            return OP_OK;
+        case FUZZ_GET:
+            return r->live ? OP_OK : OP_NOT_FOUND;
+    }
+    return OP_OK;
+}
+
+/* The same operation on the engine. */
+static OpStatus fuzz_engine(FuzzVerb verb, const BenchKey *key, int qty, Money price) {
+    int     pos = 0;
+    int32_t now = 0;
+    bool    created;
+    switch (verb) {
+        case FUZZ_ADD:     return inv_add(key->name, key->len, key->hash, qty, price, &pos, &created);
+        case FUZZ_SETQTY:  return inv_setqty(key->name, key->len, key->hash, qty, &pos);
+        case FUZZ_REMOVE:  return inv_remove(key->name, key->len, key->hash);
+        case FUZZ_RESERVE: return inv_reserve(key->name, key->len, key->hash, qty, &pos, &now);
+        case FUZZ_RELEASE: return inv_release(key->name, key->len, key->hash, qty, &pos, &now);
+        case FUZZ_GET:     return inv_find(key->name, key->len, key->hash, &pos);
+    }
+    return OP_OK;
+}
+
+/*
+ * fuzz_draw
+ *   The next operation of the serial workload. Quantities are mostly
+ *   small; a few are out of range, and a few take one of the first 16
+ *   keys one unit past INT32_MAX or (at price 0) exactly to it, so the
+ *   overflow checks meet their limit while the totals stay in range.
+ */
+static FuzzVerb fuzz_draw(const Fuzz *z, uint64_t *state, size_t *k, int *qty, Money *price) {
+    uint64_t r = fuzz_next(state);
+    unsigned pick = (unsigned)(r % 100);
+    FuzzVerb verb = pick < 30 ? FUZZ_ADD : pick < 45 ? FUZZ_SETQTY : pick < 55 ? FUZZ_REMOVE
+                  : pick < 75 ? FUZZ_RESERVE : pick < 95 ? FUZZ_RELEASE : FUZZ_GET;
+    *k     = (size_t)((r >> 8) % FUZZ_KEYS);
+    *qty   = (verb == FUZZ_SETQTY ? 0 : 1) + (int)((r >> 40) % 100);
+    *price = (Money)((r >> 48) % 256) * 37 * MONEY_SCALE / 100; /* 256 distinct */
+    switch ((r >> 32) % 64) {
+        case 0: *qty = -(int)((r >> 40) % 2); break;
+        case 1:
+            *k = (size_t)((r >> 8) % 16);
+            if ((verb == FUZZ_ADD || verb == FUZZ_RELEASE) && z->ref[*k].qty > 0) {
+                bool fill = (r >> 38) & 1 && (verb == FUZZ_ADD || z->ref[*k].price == 0);
+                *qty = INT32_MAX - z->ref[*k].qty + !fill;
+                if (fill) *price = 0;
+            }
+            break;
+    }
+    return verb;
+}
+
+static bool fuzz_fail(const Fuzz *z, const char *when, const char *what, const BenchKey *key) {
+    fprintf(stderr, "[BUG] Fuzz seed %llu, batch %zu, %s: engine and model differ on %s%s%.*s%s.\n",
+            (unsigned long long)z->seed, z->batch, when, what, key ? " '" : "",
+            key ? (int)key->len : 0, key ? key->name : "", key ? "'" : "");
+    return false;
+}
+
+/* Compare the whole store with the model. */
+static bool fuzz_compare(const Fuzz *z, const char *when) {
+    if (g_count != z->count)
+        return fuzz_fail(z, when, "the item count", NULL);
+    if (g_total_units != z->units || g_total_cents != z->cents || recompute_total() != z->cents)
+        return fuzz_fail(z, when, "the running totals", NULL);
+    for (size_t k = 0; k < FUZZ_KEYS; k++) {
+        const FuzzRef  *r   = &z->ref[k];
+        const BenchKey *key = &z->key[k];
+        int idx = index_probe(key->name, key->len, key->hash)->idx;
+        if ((idx >= 0) != r->live ||
+            (idx >= 0 && (ITEM_QTY(idx) != r->qty || ITEM_PRICE(idx) != r->price)))
+            return fuzz_fail(z, when, "item", key);
+    }
+    return true;
+}
+
+/* Close the store and load it again: snapshot (or CSV), then the log. */
+static bool fuzz_reopen(bool from_csv) {
+    wal_close();
+    store_clear(true);
+    snapshot_release();
+    if (from_csv) remove(SNAPSHOT_FILE);
+    return store_open();
+}
+
+static void fuzz_report(const char *what, int threads, size_t ops, uint64_t ns) {
+    double sec = (double)ns / 1e9;
+    printf("{\"fuzz\":\"%s\",\"threads\":%d,\"ops\":%zu,\"seconds\":%.6f,\"ops_per_sec\":%.0f}\n",
+           what, threads, ops, sec, sec > 0 ? (double)ops / sec : 0.0);
+    fflush(stdout);
+}
+
+/* The concurrent phase: reserves and releases on FUZZ_HOT keys live at its start. */
+typedef struct {
+    const Fuzz *z;
+    size_t      ops;   /* per thread                          */
+    size_t     *live;  /* keys to draw from                   */
+    size_t      nlive;
+    int64_t    *delta; /* [FUZZ_THREADS][FUZZ_KEYS] net change */
+    atomic_bool bad;
+} FuzzStress;
+
+static void fuzz_stress_worker(void *ctx, int w) {
+    FuzzStress *s     = ctx;
+    int64_t    *delta = s->delta + (size_t)w * FUZZ_KEYS;
+    uint64_t    state = bench_mix(s->z->seed + ((uint64_t)(w + 1) << 40));
+    for (size_t j = 0; j < s->ops && !atomic_load_explicit(&s->bad, memory_order_relaxed); j++) {
+        uint64_t r   = fuzz_next(&state);
+        size_t   k   = s->live[(r >> 8) % s->nlive];
+        int      qty = 1 + (int)((r >> 32) % 8), pos;
+        int32_t  now = 0;
+        const BenchKey *key = &s->z->key[k];
+        bool     take = r & 1;
+        OpStatus st = take ? inv_reserve(key->name, key->len, key->hash, qty, &pos, &now)
+                           : inv_release(key->name, key->len, key->hash, qty, &pos, &now);
+        if (st == OP_OK) delta[k] += take ? -qty : qty;
+        if ((st != OP_OK && st != (take ? OP_SHORT : OP_OVERFLOW)) || now < 0)
+            atomic_store(&s->bad, true);
+    }
+}
+
+static bool fuzz_stress(Fuzz *z, size_t ops) {
+    FuzzStress s = { .z = z, .ops = ops / FUZZ_THREADS ? ops / FUZZ_THREADS : 1 };
+    s.live  = malloc(FUZZ_HOT * sizeof *s.live);
+    s.delta = calloc((size_t)FUZZ_THREADS * FUZZ_KEYS, sizeof *s.delta);
+    atomic_init(&s.bad, false);
+    bool ok = s.live && s.delta;
+    for (size_t k = 0; ok && k < FUZZ_KEYS && s.nlive < FUZZ_HOT; k++)
+        if (z->ref[k].live) s.live[s.nlive++] = k;
+    if (ok && s.nlive) {
+        uint64_t t0 = now_ns();
+        g_serving = true; /* atomic totals, as while serving */
+        parallel_run(FUZZ_THREADS, fuzz_stress_worker, &s);
+        g_serving = false;
+        fuzz_report("stress", FUZZ_THREADS, s.ops * FUZZ_THREADS, now_ns() - t0);
+        if (atomic_load(&s.bad)) ok = fuzz_fail(z, "stress", "a concurrent reserve or release", NULL);
+        for (size_t k = 0; ok && k < FUZZ_KEYS; k++) {
+            int64_t d = 0;
+            for (int w = 0; w < FUZZ_THREADS; w++) d += s.delta[(size_t)w * FUZZ_KEYS + k];
+            if (d) fuzz_set(z, &z->ref[k], (int32_t)(z->ref[k].qty + d), z->ref[k].price);
+        }
+        ok = ok && fuzz_compare(z, "after stress") &&
+             fuzz_reopen(false) && fuzz_compare(z, "stress replay");
+    }
+    free(s.live);
+    free(s.delta);
+    return ok;
+}
+
+/*
+ * The server phase: FUZZ_THREADS workers send requests through
+ * serve_apply(), under the store gate and shard locks as the server
+ * runs them. Worker w owns the keys k with k % FUZZ_THREADS == w, apart
+ * from the FUZZ_HOT shared ones: it adds, restocks, updates, removes,
+ * reserves and releases them against its own part of the model, so the
+ * reply to each is known, while removals move other workers' items.
+ * Every worker also reserves and releases the shared keys, totalled as
+ * in fuzz_stress(), and now and then lists, totals or saves the store.
+ */
+typedef struct {
+    Fuzz        part[FUZZ_THREADS]; /* each worker's model: its keys, its share of the totals */
+    size_t      ops;   /* per thread */
+    const bool *hot;   /* [FUZZ_KEYS] */
+    size_t     *live;  /* the hot keys */
+    size_t      nlive;
+    int64_t    *delta; /* [FUZZ_THREADS][FUZZ_KEYS] net change of the hot keys */
+    atomic_bool bad;
+} FuzzServe;
+
+static void fuzz_serve_worker(void *ctx, int w) {
+    static const char *const report[] = { "list sort=name limit=5", "total", "save" };
+    FuzzServe *s     = ctx;
+    Fuzz      *z     = &s->part[w];
+    int64_t   *delta = s->delta + (size_t)w * FUZZ_KEYS;
+    uint64_t   state = bench_mix(z->seed + ((uint64_t)(w + 1) << 44));
+    OutBuf     o = { NULL, 0, 0, false }, want = { NULL, 0, 0, false };
+    for (size_t j = 0; j < s->ops && !atomic_load_explicit(&s->bad, memory_order_relaxed); j++) {
+        uint64_t r    = fuzz_next(&state);
+        unsigned pick = (unsigned)(r % 100);
+        size_t   k    = (size_t)((r >> 8) % (FUZZ_KEYS / FUZZ_THREADS)) * FUZZ_THREADS + (size_t)w;
+        FuzzVerb verb = pick < 30 ? FUZZ_ADD : pick < 40 ? FUZZ_SETQTY : pick < 55 ? FUZZ_REMOVE
+                      : pick < 65 ? FUZZ_RESERVE : pick < 75 ? FUZZ_RELEASE : FUZZ_GET;
+        bool     shared = pick >= 85 || s->hot[k];
+        if (shared) {
+            k    = s->live[(r >> 8) % s->nlive];
+            verb = r & 1 ? FUZZ_RESERVE : FUZZ_RELEASE;
+        }
+        const BenchKey *key = &z->key[k];
+        int   qty   = (verb == FUZZ_SETQTY ? 0 : 1) + (int)((r >> 40) % 100);
+        Money price = (Money)((r >> 48) % 4) * 125 * MONEY_SCALE / 100; /* restocks keep some */
+        char  line[LINE_BUF + 64], pb[MONEY_BUF];
+        int   n = snprintf(line, sizeof line, "%s %s", fuzz_verb[verb], key->name);
+        if (verb == FUZZ_ADD)
+            n += snprintf(line + n, sizeof line - (size_t)n, ",%d,%s", qty, money_str(pb, price));
+        else if (verb != FUZZ_REMOVE && verb != FUZZ_GET)
+            n += snprintf(line + n, sizeof line - (size_t)n, ",%d", qty);
+        BatchCmd c = { .line = (int)(j % BATCH_OPS) + 1 };
+        batch_parse(line, line + n, &c);
+        o.len = want.len = 0;
+        bool ok = serve_apply(w, &c, &o);
+
+        /* The reply a client would have to get; a shared key's new stock is not known. */
+        OpStatus st = shared ? (ok ? OP_OK : verb == FUZZ_RESERVE ? OP_SHORT : OP_OVERFLOW)
+                             : fuzz_model(z, verb, k, qty, price);
+        if (st != OP_OK)              out_error(&want, &c, st);
+        else if (verb == FUZZ_REMOVE) out_printf(&want, "OK remove %s\n", key->name);
+        else if (shared)              out_printf(&want, "OK %s %s,", fuzz_verb[verb], key->name);
+        else out_item(&want, fuzz_verb[verb], key->name, z->ref[k].qty, z->ref[k].price);
+        if (shared && ok) delta[k] += verb == FUZZ_RESERVE ? -qty : qty;
+        if (o.lost || want.lost || o.len < want.len || memcmp(o.buf, want.buf, want.len) != 0 ||
+            (o.len != want.len && !(shared && ok))) {
+            char what[96];
+            snprintf(what, sizeof what, "the reply to %s %d of", fuzz_verb[verb], qty);
+            atomic_store(&s->bad, true);
+            fuzz_fail(z, "serve", what, key);
+            break;
+        }
+
+        /* Now and then a report from a pinned image, or a save. */
+        if (j % 4096 == 4095) {
+            size_t      i = j / 4096;
+            const char *q = report[(i + (size_t)w) % 8 == 0 ? 2 : i & 1];
+            c = (BatchCmd){ .line = (int)(j % BATCH_OPS) + 1 };
+            batch_parse(q, q + strlen(q), &c);
+            o.len = 0;
+            if (!serve_apply(w, &c, &o) || o.len < 3 || memcmp(o.buf, "OK ", 3) != 0) {
+                atomic_store(&s->bad, true);
+                fuzz_fail(z, "serve", q, NULL);
+                break;
+            }
+        }
+        /* As serve_conn() ends a batch. */
+        if (j % BATCH_OPS == BATCH_OPS - 1) {
+            wal_wait(g_wal_mine);
+            serve_after();
+        }
+    }
+    wal_wait(g_wal_mine);
+    serve_after();
+    free(o.buf);
+    free(want.buf);
+}
+
+static bool fuzz_serve(Fuzz *z, size_t ops) {
+    FuzzServe s = { .ops = ops / FUZZ_THREADS ? ops / FUZZ_THREADS : 1 };
+    bool *hot = calloc(FUZZ_KEYS, sizeof *hot);
+    s.hot   = hot;
+    s.live  = malloc(FUZZ_HOT * sizeof *s.live);
+    s.delta = calloc((size_t)FUZZ_THREADS * FUZZ_KEYS, sizeof *s.delta);
+    atomic_init(&s.bad, false);
+    bool ok = hot && s.live && s.delta;
+    for (size_t k = 0; ok && k < FUZZ_KEYS && s.nlive < FUZZ_HOT; k++)
+        if (z->ref[k].live) hot[s.live[s.nlive++] = k] = true;
+    for (int w = 0; w < FUZZ_THREADS; w++)
+        s.part[w] = (Fuzz){ .key = z->key, .ref = z->ref, .seed = z->seed, .batch = z->batch };
+    if (ok && s.nlive && !serve_gates_open(FUZZ_THREADS)) {
+        fprintf(stderr, "[ERROR] Out of memory.\n");
+        ok = false;
+    }
+    if (ok && s.nlive) {
+        uint64_t t0 = now_ns();
+        parallel_run(FUZZ_THREADS, fuzz_serve_worker, &s);
+        serve_gates_close();
+        fuzz_report("serve", FUZZ_THREADS, s.ops * FUZZ_THREADS, now_ns() - t0);
+        ok = !atomic_load(&s.bad); /* fuzz_fail() has said why */
+        for (int w = 0; w < FUZZ_THREADS; w++) {
+            z->count += s.part[w].count;
+            z->units += s.part[w].units;
+            z->cents += s.part[w].cents;
+        }
+        for (size_t k = 0; ok && k < FUZZ_KEYS; k++) {
+            int64_t d = 0;
+            for (int w = 0; w < FUZZ_THREADS; w++) d += s.delta[(size_t)w * FUZZ_KEYS + k];
+            if (d) fuzz_set(z, &z->ref[k], (int32_t)(z->ref[k].qty + d), z->ref[k].price);
+        }
+        ok = ok && fuzz_compare(z, "after serve") &&
+             fuzz_reopen(false) && fuzz_compare(z, "serve replay");
+    }
+    free(hot);
+    free(s.live);
+    free(s.delta);
+    return ok;
+}
+
+/*
+ * fuzz_suite
+ *   The serial workload, in batches of FUZZ_BATCH. Every fourth batch
+ *   ends with a save, in the compressed format in every other run of
+ *   eight batches. Two batches after one save the store is reopened
+ *   from the snapshot, replaying the log written since; right after
+ *   the next, from the CSV alone (a checkpoint may have trimmed the log
+ *   past the CSV by any other time).
+ */
+static bool fuzz_suite(size_t ops, uint64_t seed) {
+    Fuzz z = { .seed = seed };
+    z.key = malloc(FUZZ_KEYS * sizeof *z.key);
+    z.ref = calloc(FUZZ_KEYS, sizeof *z.ref);
+    if (!z.key || !z.ref) {
+        fprintf(stderr, "[ERROR] Out of memory.\n");
+        free(z.key); free(z.ref);
+        return false;
     }
+    for (size_t k = 0; k < FUZZ_KEYS; k++) {
+        z.key[k].len  = bench_name(bench_mix(seed) % BENCH_MAX_ROWS + k, z.key[k].name);
+        z.key[k].hash = name_hash(z.key[k].name, z.key[k].len);
+    }
+
+    bool     ok       = true, compress = g_snap_compress;
+    uint64_t state    = bench_mix(seed), ns = 0;
+    size_t   reopens  = 0, saves = 0;
+    for (size_t done = 0; ok && done < ops; z.batch++) {
+        size_t n = ops - done < FUZZ_BATCH ? ops - done : FUZZ_BATCH;
+        uint64_t t0 = now_ns();
+        wal_batch();
+        for (size_t j = 0; j < n; j++) {
+            size_t   k;
+            int      qty;
+            Money    price;
+            FuzzVerb verb = fuzz_draw(&z, &state, &k, &qty, &price);
+            OpStatus want = fuzz_model(&z, verb, k, qty, price);
+            OpStatus got  = fuzz_engine(verb, &z.key[k], qty, price);
+            if (got != want) {
+                char what[64];
+                snprintf(what, sizeof what, "the status of %s %d of", fuzz_verb[verb], qty);
+                ok = fuzz_fail(&z, "serial", what, &z.key[k]);
+                break;
+            }
+        }
+        wal_commit();
+        ns   += now_ns() - t0;
+        done += n;
+        ok = ok && fuzz_compare(&z, "serial");
+        if (ok && z.batch % 4 == 3) {
+            g_snap_compress = z.batch / 8 & 1;
+            ok = save_inventory();
+            saves++;
+        }
+        if (ok && (z.batch % 8 == 5 || z.batch % 8 == 7)) {
+            ok = fuzz_reopen(z.batch % 8 == 7) && fuzz_compare(&z, "reopen");
+            reopens++;
+        }
+    }
+    g_snap_compress = compress;
+    if (ok) fuzz_report("serial", 1, ops, ns);
+    ok = ok && fuzz_stress(&z, ops) && fuzz_serve(&z, ops);
+    if (ok)
+        printf("[INFO] Fuzz seed %llu: %zu operation(s) in %zu batch(es), %zu save(s) and "
+               "%zu reopen(s); the engine matches the model.\n",
+               (unsigned long long)seed, ops, z.batch, saves, reopens);
+    free(z.key);
+    free(z.ref);
+    return ok;
+}
+
+/*
+ * fuzz_run
+ *   Runs the fuzz workload in FUZZ_DIR, created under the current
+ *   directory and removed afterwards, logging with --durability=write
+ *   so every reopen has a log to replay.
+ */
+static int fuzz_run(size_t ops, uint64_t seed) {
+    if ((dir_make(FUZZ_DIR) != 0 && errno != EEXIST) || dir_enter(FUZZ_DIR) != 0) {
+        fprintf(stderr, "[ERROR] Cannot use directory '%s': %s\n", FUZZ_DIR, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    remove(INVENTORY_FILE);
+    remove(SNAPSHOT_FILE);
+    remove(WAL_FILE);
+
+    g_durability   = DUR_WRITE;
+    g_load_threads = 0;
+    bool ok = wal_start(false, 0) && fuzz_suite(ops, seed);
+    wal_close();
+    store_clear(true);
+    snapshot_release();
+    remove(INVENTORY_FILE);
+    remove(INVENTORY_TMP);
+    remove(SNAPSHOT_FILE);
+    remove(SNAPSHOT_TMP);
+    remove(WAL_FILE);
+    remove(WAL_TMP);
+    if (dir_enter("..") == 0) dir_remove(FUZZ_DIR);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 /* ══════════════════════════════════════════════════════════════
- *  main – interactive menu loop
+ *  Program modes
+ *    The menu loop, and the self-contained --bench and --fuzz runs,
+ *    as inventory.h entry points; main.c parses the command line and
+ *    picks one of these, inventory_batch() or inventory_serve().
  * ══════════════════════════════════════════════════════════════ */
 
-int main(void) {
-    SetConsoleOutputCP(CP_UTF8);
-    SetConsoleCP(CP_UTF8);
-    printf("╔══════════════════════════════════════════╗\n");
-    printf("║   Retail Store Inventory Manager v1.0   ║\n");
-    printf("╚══════════════════════════════════════════╝\n\n");
+int inventory_bench(size_t rows, const InventoryOptions *opt) {
+    options_apply(opt);
+    version_init();
+    return bench_run(rows ? rows : BENCH_ROWS);
+}
 
-    if (!load_inventory()) return EXIT_FAILURE;
+int inventory_fuzz(size_t ops, uint64_t seed, const InventoryOptions *opt) {
+    options_apply(opt);
+    version_init();
+    return fuzz_run(ops ? ops : FUZZ_OPS, seed);
+}
 
-    char choice[8];
+int inventory_menu(void) {
+    char choice[8], mb[MONEY_BUF];
     bool running = true;
 
     while (running) {
@@ -397,24 +8798,31 @@ int main(void) {
         printf("│  6. Show total inventory value           │\n");
         printf("│  7. Save & exit                          │\n");
         printf("│  8. Exit without saving                  │\n");
+        printf("│  9. Reports: stock, prices, ABC, stats   │\n");
         printf("└──────────────────────────────────────────┘\n");
 
         if (!read_line("Choice: ", choice, sizeof choice)) break;
 
         switch (choice[0]) {
-            case '1': list_inventory();                                      break;
+            case '1': menu_list();                                           break;
             case '2': menu_add();                                            break;
             case '3': menu_remove();                                         break;
             case '4': menu_update_qty();                                     break;
             case '5': menu_search();                                         break;
-            case '6': printf("  Total inventory value: $%.2f\n",
-                             calculate_total());                             break;
+            case '6': printf("  Total inventory value: $%s\n"
+                             "  Items: %d   Units in stock: %lld\n",
+                             money_str(mb, calculate_total()), g_count,
+                             (long long)g_total_units);                      break;
             case '7': save_inventory(); running = false;                     break;
-            case '8': printf("[INFO] Exiting without saving.\n");
+            case '8': if (g_wal.open)
+                          printf("[INFO] Exiting; unsaved changes are kept in '%s'.\n",
+                                 WAL_FILE);
+                      else
+                          printf("[INFO] Exiting without saving.\n");
                       running = false;                                       break;
-            default:  printf("[WARN] Unknown option '%s'. Try 1–8.\n", choice);
+            case '9': menu_report();                                         break;
+            default:  printf("[WARN] Unknown option '%s'. Try 1–9.\n", choice);
         }
     }
-
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,152 @@
+/*
+ * inventory.h – C API of the inventory engine (inventory_engine library)
+ * Standard : C11
+ *
+ * The engine keeps one store per process, backed by inventory.txt,
+ * inventory.snap and inventory.wal in the working directory, exactly
+ * as the program does: inventory_open() loads it (snapshot or CSV, then
+ * the change log), every change is logged per `durability`, and
+ * inventory_save() writes the CSV and the snapshot.
+ *
+ * Calls are not thread-safe; make them from one thread at a time. For
+ * many concurrent clients run the server instead (inventory_serve()).
+ * The program's modes are entry points too; main.c is the command line
+ * on top of them.
+ */
+#ifndef INVENTORY_H
+#define INVENTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Upper bounds of the thread and size settings. */
+#define INVENTORY_MAX_THREADS       64          /* load_threads, chain_threads */
+#define INVENTORY_MAX_SERVE_THREADS 1024        /* serve_threads               */
+#define INVENTORY_BENCH_MAX_ROWS    100000000   /* inventory_bench() rows      */
+#define INVENTORY_FUZZ_MAX_OPS      ((size_t)1 << 40) /* inventory_fuzz() ops  */
+
+/* A price or value in units of 10^-inventory_money_digits() (cents by default). */
+typedef int64_t InventoryMoney;
+
+/* Outcome of an item operation. */
+typedef enum {
+    INVENTORY_OK,
+    INVENTORY_BAD_NAME,   /* empty or oversized name             */
+    INVENTORY_BAD_QTY,    /* quantity out of range for the op    */
+    INVENTORY_BAD_PRICE,  /* negative or oversized price         */
+    INVENTORY_NOT_FOUND,
+    INVENTORY_OVERFLOW,   /* quantity would exceed INT32_MAX     */
+    INVENTORY_INDEX_FULL, /* name index cannot grow              */
+    INVENTORY_FULL,       /* memory limit reached                */
+    INVENTORY_SHORT,      /* fewer units in stock than requested */
+    INVENTORY_DAMAGED     /* lazy snapshot damaged; later calls fail too */
+} InventoryStatus;
+
+/* How changes are logged between saves (see --durability). */
+typedef enum {
+    INVENTORY_DURABILITY_DEFAULT, /* group */
+    INVENTORY_DURABILITY_OFF,
+    INVENTORY_DURABILITY_WRITE,
+    INVENTORY_DURABILITY_GROUP,
+    INVENTORY_DURABILITY_SYNC
+} InventoryDurability;
+
+/* Order of the item listing and the CSV export (see --order). */
+typedef enum {
+    INVENTORY_ORDER_INSERTION,
+    INVENTORY_ORDER_NAME,
+    INVENTORY_ORDER_STORE
+} InventoryOrder;
+
+/* inventory_open() settings; all-zero gives the defaults. */
+typedef struct {
+    size_t              mem_limit;     /* bytes for store and index; 0 = unlimited */
+    InventoryDurability durability;
+    int                 load_threads;  /* CSV parse threads; 0 = one per CPU      */
+    bool                check_totals;  /* verify totals after every change        */
+    bool                snapshot_only; /* saves skip the CSV export               */
+    bool                lazy_load;     /* page the snapshot in on use (--lazy-load) */
+    bool                compress_snapshot; /* --snapshot-compress */
+    InventoryOrder      order;
+    const char         *chain;         /* other locations' list file (--chain)  */
+    int                 chain_threads; /* their load threads; 0 = one per CPU   */
+    const char         *stats_file;    /* JSON counters file (--stats-file)     */
+    int                 stats_interval; /* its rewrite period, s; 0 = default   */
+    int                 serve_threads; /* inventory_serve() workers; 0 = default */
+    const char         *replicate;     /* serve the change log, [HOST:]PORT     */
+    const char         *follow;        /* serve a read-only copy of HOST:PORT   */
+} InventoryOptions;
+
+/* Load the store (NULL opt = defaults). Call once per process; false on a fatal error. */
+bool inventory_open(const InventoryOptions *opt);
+
+/* Flush and close the change log; unsaved changes stay in it for the next open. */
+void inventory_close(void);
+
+/*
+ * The program's modes, each returning an exit status. The menu, batch
+ * and server run on the store inventory_open() loaded; call
+ * inventory_close() after them. inventory_batch() reads FILE ("-" or
+ * NULL: stdin); inventory_serve() listens on [HOST:]PORT until SIGINT
+ * or SIGTERM. Bench and fuzz work on a scratch store of their own
+ * instead of inventory_open(); 0 rows or ops picks the default size.
+ */
+int inventory_menu(void);
+int inventory_batch(const char *file);
+int inventory_serve(const char *spec);
+int inventory_bench(size_t rows, const InventoryOptions *opt);
+int inventory_fuzz(size_t ops, uint64_t seed, const InventoryOptions *opt);
+
+/* A NULL or empty name is INVENTORY_BAD_NAME in each call below. */
+
+/* Add qty (> 0) units at `price`: a new item, or a restock that sets the price. */
+InventoryStatus inventory_add(const char *name, int qty, InventoryMoney price);
+
+/* Set an item's stock to qty (>= 0). */
+InventoryStatus inventory_set_qty(const char *name, int qty);
+
+InventoryStatus inventory_remove(const char *name);
+
+/* Take qty units, only if that many remain, or put them back; *left receives the stock. */
+InventoryStatus inventory_reserve(const char *name, int qty, int *left);
+InventoryStatus inventory_release(const char *name, int qty, int *left);
+
+/* An item's stock and unit price; either pointer may be NULL. */
+InventoryStatus inventory_get(const char *name, int *qty, InventoryMoney *price);
+
+/* Items in the store. */
+int inventory_count(void);
+
+/* Stock value (quantity × price summed, exactly); *units, if set, receives the unit count. */
+InventoryMoney inventory_total(int64_t *units);
+
+/* Write inventory.txt and inventory.snap; false on failure, as on a damaged store. */
+bool inventory_save(void);
+
+/*
+ * Run one --batch command line (e.g. "list sort=value limit=10") and
+ * store its reply, "OK ..." or "ERR ...", NUL-terminated in reply[cap],
+ * truncated if need be. Returns the reply's full length.
+ */
+size_t inventory_exec(const char *cmd, char *reply, size_t cap);
+
+/*
+ * Parse a whole decimal string as an integer in [0, 1000000], the
+ * menu's rule for quantities and main.c's for thread counts and
+ * intervals. Returns false on bad input.
+ */
+bool inventory_parse_int(const char *s, int *out);
+
+/* Decimals kept in prices (the MONEY_DIGITS the engine was built with). */
+int inventory_money_digits(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INVENTORY_H */
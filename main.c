@@ -0,0 +1,216 @@
+/*
+ * main.c – the inventory program: the command line on top of the engine
+ * Standard : C11
+ *
+ * Parses the options below into InventoryOptions, then runs one of the
+ * engine's modes (see inventory.h): the menu, --batch, --serve, --bench
+ * or --fuzz.
+ *
+ * Run      : ./inventory [--mem-limit=SIZE] [--check-totals] [--load-threads=N]
+ *                        [--snapshot-only] [--lazy-load] [--snapshot-compress]
+ *                        [--durability=MODE] [--order=ORDER]
+ *                        [--stats-file=FILE [--stats-interval=SECONDS]]
+ *                        [--chain=FILE [--chain-threads=N]]
+ *                        [--batch[=FILE] | --serve=[HOST:]PORT [--serve-threads=N]
+ *                           [--replicate=[HOST:]PORT | --follow=HOST:PORT]
+ *                         | --bench[=ROWS] | --fuzz[=OPS] [--fuzz-seed=N]]
+ *            SIZE caps memory used by the item store and its index,
+ *            e.g. 64M or 1G (suffixes K, M, G; default unlimited).
+ *            --check-totals verifies the running totals after every
+ *            mutation (debug aid; O(n) per operation).
+ *            --load-threads parses large files on N threads
+ *            (0 = one per CPU; default 1).
+ *            --snapshot-only saves just the binary snapshot, skipping
+ *            the CSV export.
+ *            --lazy-load maps the snapshot without reading it through:
+ *            items are paged in as they are first used.
+ *            --snapshot-compress saves the snapshot column-encoded:
+ *            several times smaller, decoded rather than mapped on load.
+ *            --durability sets how changes are logged between saves:
+ *            off, write (survives a crash), group (default; fsync'd
+ *            within 50 ms) or sync (fsync'd before each reply).
+ *            --order sets the order of the listing and the CSV export:
+ *            insertion (default), name, or store (fastest).
+ *            --batch applies commands from FILE or stdin instead of
+ *            running the menu, one per line: add, setqty, remove, get,
+ *            total, save, reserve, release, import, search, low,
+ *            prices, list, export, top, abc, stats, chain total and
+ *            chain get (see README.md).
+ *            --serve accepts the same commands from any number of TCP
+ *            clients, answered by N worker threads (default 64), until
+ *            SIGINT/SIGTERM.
+ *            --replicate streams every logged change to followers
+ *            there; --follow serves a read-only copy kept current
+ *            from the primary at HOST:PORT.
+ *            --stats-file rewrites FILE with the operation counters
+ *            and latencies as JSON every SECONDS (default 10).
+ *            --chain loads the other locations' inventories listed in
+ *            FILE for the chain commands, on N threads (default: one
+ *            per CPU).
+ *            --bench times load, save, lookup, add, remove and total
+ *            on ROWS synthetic items (default 1000000) and prints one
+ *            JSON result per line.
+ *            --fuzz applies OPS random operations (default 4000000),
+ *            serially and on several threads, saving and reloading as
+ *            it goes, and checks the store against a reference model
+ *            throughout; the workload depends only on --fuzz-seed.
+ */
+#include <errno.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>   /* SetConsoleOutputCP */
+#endif
+
+#include "inventory.h"
+
+#define OUT_BUF (1 << 20) /* stdout buffer for --batch replies */
+
+/* Parse a byte count with optional K/M/G suffix. Returns false on bad input. */
+static bool parse_size(const char *s, size_t *out) {
+    char *ep;
+    errno = 0;
+    unsigned long long v = strtoull(s, &ep, 10);
+    if (ep == s || errno == ERANGE) return false;
+    unsigned shift = 0;
+    switch (toupper((unsigned char)*ep)) {
+        case 'K': shift = 10; ep++; break;
+        case 'M': shift = 20; ep++; break;
+        case 'G': shift = 30; ep++; break;
+    }
+    if (*ep != '\0' || v > (SIZE_MAX >> shift)) return false;
+    *out = (size_t)(v << shift); return true;
+}
+
+/* Parse a count in [1, max]. Returns false on bad input. */
+static bool parse_count(const char *s, unsigned long long max, size_t *out) {
+    char *ep;
+    errno = 0;
+    unsigned long long v = strtoull(s, &ep, 10);
+    if (ep == s || *ep != '\0' || errno != 0 || v < 1 || v > max) return false;
+    *out = (size_t)v; return true;
+}
+
+/* Index of s in names[n], or -1. */
+static int pick(const char *s, const char *const *names, int n) {
+    for (int m = 0; m < n; m++)
+        if (strcmp(s, names[m]) == 0) return m;
+    return -1;
+}
+
+static int usage(const char *argv0) {
+    fprintf(stderr, "Usage: %s [--mem-limit=SIZE] [--check-totals] [--load-threads=N]"
+                    " [--snapshot-only] [--lazy-load] [--snapshot-compress]\n"
+                    "       [--durability=off|write|group|sync] [--order=insertion|name|store]\n"
+                    "       [--stats-file=FILE [--stats-interval=SECONDS]]"
+                    " [--chain=FILE [--chain-threads=N]]\n"
+                    "       [--batch[=FILE] | --serve=[HOST:]PORT [--serve-threads=N]\n"
+                    "          [--replicate=[HOST:]PORT | --follow=HOST:PORT] | --bench[=ROWS]\n"
+                    "        | --fuzz[=OPS] [--fuzz-seed=N]]\n",
+            argv0);
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+    static const char *const orders[] = { "insertion", "name", "store" };
+    static const char *const modes[]  = { "off", "write", "group", "sync" };
+    InventoryOptions opt = { .load_threads = 1 };
+    const char *batch = NULL, *serve = NULL;
+    bool   bench = false, fuzz = false;
+    size_t rows = 0, ops = 0; /* 0: the mode's default size */
+    unsigned long long fuzz_seed = 1;
+    int m;
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        if (strncmp(a, "--mem-limit=", 12) == 0 && parse_size(a + 12, &opt.mem_limit)) continue;
+        if (strcmp(a, "--check-totals") == 0)      { opt.check_totals = true;      continue; }
+        if (strcmp(a, "--snapshot-only") == 0)     { opt.snapshot_only = true;     continue; }
+        if (strcmp(a, "--lazy-load") == 0)         { opt.lazy_load = true;         continue; }
+        if (strcmp(a, "--snapshot-compress") == 0) { opt.compress_snapshot = true; continue; }
+        if (strcmp(a, "--batch") == 0) { batch = "-"; continue; }
+        if (strncmp(a, "--batch=", 8) == 0 && a[8])         { batch = a + 8;         continue; }
+        if (strncmp(a, "--serve=", 8) == 0 && a[8])         { serve = a + 8;         continue; }
+        if (strncmp(a, "--chain=", 8) == 0 && a[8])         { opt.chain = a + 8;     continue; }
+        if (strncmp(a, "--replicate=", 12) == 0 && a[12])   { opt.replicate = a + 12; continue; }
+        if (strncmp(a, "--follow=", 9) == 0 && a[9])        { opt.follow = a + 9;    continue; }
+        if (strncmp(a, "--stats-file=", 13) == 0 && a[13])  { opt.stats_file = a + 13; continue; }
+        if (strncmp(a, "--chain-threads=", 16) == 0 &&
+            inventory_parse_int(a + 16, &opt.chain_threads) &&
+            opt.chain_threads <= INVENTORY_MAX_THREADS)
+            continue;
+        if (strncmp(a, "--stats-interval=", 17) == 0 &&
+            inventory_parse_int(a + 17, &opt.stats_interval) && opt.stats_interval >= 1)
+            continue;
+        if (strcmp(a, "--bench") == 0) { bench = true; rows = 0; continue; }
+        if (strncmp(a, "--bench=", 8) == 0 && parse_count(a + 8, INVENTORY_BENCH_MAX_ROWS, &rows)) {
+            bench = true;
+            continue;
+        }
+        if (strcmp(a, "--fuzz") == 0) { fuzz = true; ops = 0; continue; }
+        if (strncmp(a, "--fuzz=", 7) == 0 && parse_count(a + 7, INVENTORY_FUZZ_MAX_OPS, &ops)) {
+            fuzz = true;
+            continue;
+        }
+        if (strncmp(a, "--fuzz-seed=", 12) == 0) {
+            char *ep;
+            errno = 0;
+            fuzz_seed = strtoull(a + 12, &ep, 10);
+            if (ep != a + 12 && *ep == '\0' && errno == 0) continue;
+        }
+        if (strncmp(a, "--serve-threads=", 16) == 0 &&
+            inventory_parse_int(a + 16, &opt.serve_threads) &&
+            opt.serve_threads >= 1 && opt.serve_threads <= INVENTORY_MAX_SERVE_THREADS)
+            continue;
+        if (strncmp(a, "--order=", 8) == 0 && (m = pick(a + 8, orders, 3)) >= 0) {
+            opt.order = (InventoryOrder)m;
+            continue;
+        }
+        if (strncmp(a, "--durability=", 13) == 0 && (m = pick(a + 13, modes, 4)) >= 0) {
+            opt.durability = (InventoryDurability)(INVENTORY_DURABILITY_OFF + m);
+            continue;
+        }
+        if (strncmp(a, "--load-threads=", 15) == 0 &&
+            inventory_parse_int(a + 15, &opt.load_threads) &&
+            opt.load_threads <= INVENTORY_MAX_THREADS)
+            continue;
+        return usage(argv[0]);
+    }
+    if ((batch != NULL) + (serve != NULL) + bench + fuzz > 1) {
+        fprintf(stderr, "[ERROR] --batch, --serve, --bench and --fuzz cannot be combined.\n");
+        return EXIT_FAILURE;
+    }
+    if ((opt.replicate || opt.follow) && !serve) {
+        fprintf(stderr, "[ERROR] --replicate and --follow need --serve.\n");
+        return EXIT_FAILURE;
+    }
+    if (opt.replicate && opt.follow) {
+        fprintf(stderr, "[ERROR] --replicate and --follow cannot be combined.\n");
+        return EXIT_FAILURE;
+    }
+    if (opt.replicate && opt.durability == INVENTORY_DURABILITY_OFF) {
+        fprintf(stderr, "[ERROR] --replicate streams the change log; it needs --durability "
+                        "other than off.\n");
+        return EXIT_FAILURE;
+    }
+    if (bench) return inventory_bench(rows, &opt);
+    if (fuzz)  return inventory_fuzz(ops, fuzz_seed, &opt);
+
+#ifdef _WIN32
+    SetConsoleOutputCP(CP_UTF8);
+    SetConsoleCP(CP_UTF8);
+#endif
+    if (batch) {
+        setvbuf(stdout, NULL, _IOFBF, OUT_BUF);
+    } else if (!serve) {
+        printf("╔══════════════════════════════════════════╗\n");
+        printf("║   Retail Store Inventory Manager v1.0   ║\n");
+        printf("╚══════════════════════════════════════════╝\n\n");
+    }
+    if (!inventory_open(&opt)) return EXIT_FAILURE;
+    int status = batch ? inventory_batch(batch) : serve ? inventory_serve(serve) : inventory_menu();
+    inventory_close();
+    return status;
+}